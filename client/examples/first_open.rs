@@ -0,0 +1,30 @@
+//! Plays the first open cell in each game.
+//! usage: first_open <server url> <api key> <game id>...
+
+use codekata_client::{Board, Bot, Client, Move, Runner};
+use std::env;
+
+struct FirstOpen;
+
+impl Bot for FirstOpen {
+    fn choose(&mut self, board: &Board) -> Move {
+        board.empty_cells().next().unwrap()
+    }
+}
+
+fn main() {
+    let args = env::args().collect::<Vec<String>>();
+    if args.len() < 4 {
+        eprintln!("usage: {} <server url> <api key> <game id>...", args[0]);
+        return;
+    }
+    let games = args[3..]
+        .iter()
+        .map(|id| id.parse::<i32>().expect("invalid game id"))
+        .collect::<Vec<i32>>();
+
+    let client = Client::new(&args[1], &args[2]);
+    if let Err(e) = Runner::new(client).play(&games, |_| FirstOpen) {
+        eprintln!("{}", e);
+    }
+}
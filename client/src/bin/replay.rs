@@ -0,0 +1,432 @@
+//! Replay a request capture (see src/capture.rs in the server) against a server, and compare the
+//! replayed latencies with the captured ones.
+//!
+//! usage: replay <capture> <server url> --admin-key <key> [--speed N] [--threads N]
+//!
+//! Each user alias in the capture is played by a new user, created with the admin key. A game
+//! created by a captured game_new is the game that request's replay creates. Other games are
+//! created on the server the first time the capture uses them, so requests on games that were
+//! already running when the capture started may get different responses (these show up as
+//! status mismatches). --speed replays the capture faster than it was recorded (ie -- 10 sends
+//! requests 10 times as often).
+
+use serde::{Deserialize, Serialize};
+use std::collections::{BTreeMap, HashMap};
+use std::env;
+use std::fs::File;
+use std::io::{BufRead, BufReader};
+use std::process;
+use std::sync::mpsc;
+use std::sync::{Arc, Condvar, Mutex};
+use std::thread;
+use std::time::{Duration, Instant, SystemTime, UNIX_EPOCH};
+
+/// users created per bulk request
+const USER_BATCH: usize = 500;
+
+#[derive(Deserialize, Clone)]
+struct Line {
+    t: u64,
+    m: String,
+    r: String,
+    s: u16,
+    l: u64,
+    u: Option<u32>,
+    p: Option<String>,
+    b: Option<String>,
+    c: Option<String>,
+    i: Option<i32>,
+}
+
+#[derive(Serialize)]
+struct BulkUser {
+    username: String,
+    display_name: String,
+    password: String,
+}
+
+#[derive(Serialize)]
+struct BulkUsersReq {
+    users: Vec<BulkUser>,
+    generate_api_keys: bool,
+}
+
+#[derive(Deserialize)]
+struct BulkUserResp {
+    api_key: Option<String>,
+    error: Option<String>,
+}
+
+#[derive(Deserialize)]
+struct BulkUsersResp {
+    users: Vec<BulkUserResp>,
+}
+
+#[derive(Deserialize)]
+struct IdResp {
+    id: String,
+}
+
+/// The result of replaying one request
+struct Replayed {
+    route: String,
+    captured_us: u64,
+    captured_status: u16,
+    latency_us: u64,
+    status: u16,
+    /// how late the request was sent
+    lag_us: u64,
+}
+
+/// The game made on the server for a captured game
+#[derive(Clone, Copy)]
+enum GameSlot {
+    /// being created by another request
+    Creating,
+    Created(i32),
+    /// couldn't be created. Requests keep the captured id
+    Failed,
+}
+
+struct Replayer {
+    agent: ureq::Agent,
+    base: String,
+    keys: HashMap<u32, String>,
+    admin_key: String,
+    /// captured game ids to the games created for them
+    games: Mutex<HashMap<i32, GameSlot>>,
+    /// notified when a game is created (or fails to be)
+    created: Condvar,
+}
+
+fn usage() -> ! {
+    eprintln!("usage: replay <capture> <server url> --admin-key <key> [--speed N] [--threads N]");
+    process::exit(2);
+}
+
+fn fail(msg: String) -> ! {
+    eprintln!("{}", msg);
+    process::exit(1);
+}
+
+fn percentile(sorted: &[u64], p: f64) -> f64 {
+    if sorted.is_empty() {
+        return 0.0;
+    }
+    let i = ((sorted.len() - 1) as f64 * p).round() as usize;
+    sorted[i] as f64 / 1000.0
+}
+
+impl Replayer {
+    /// create a user for each alias
+    fn create_users(&mut self, aliases: &[u32]) -> Result<(), String> {
+        let run = SystemTime::now()
+            .duration_since(UNIX_EPOCH)
+            .map_or(0, |d| d.as_secs());
+        for batch in aliases.chunks(USER_BATCH) {
+            let req = BulkUsersReq {
+                users: batch
+                    .iter()
+                    .map(|alias| BulkUser {
+                        username: format!("replay_{}_{}", run, alias),
+                        display_name: format!("Replay {}", alias),
+                        password: format!("replay_{}", run),
+                    })
+                    .collect(),
+                generate_api_keys: true,
+            };
+            let resp = self
+                .agent
+                .post(&format!("{}/api/admin/users/bulk", self.base))
+                .set("X-API-KEY", &self.admin_key)
+                .send_json(serde_json::to_value(&req).unwrap())
+                .map_err(|e| format!("couldn't create users: {}", e))?
+                .into_json::<BulkUsersResp>()
+                .map_err(|e| format!("couldn't create users (is the key an admin's?): {}", e))?;
+            for (alias, user) in batch.iter().zip(resp.users) {
+                match (user.api_key, user.error) {
+                    (Some(key), _) => {
+                        self.keys.insert(*alias, key);
+                    }
+                    (None, error) => {
+                        return Err(format!(
+                            "couldn't create user: {}",
+                            error.unwrap_or_default()
+                        ))
+                    }
+                }
+            }
+        }
+        Ok(())
+    }
+
+    fn key_for(&self, alias: Option<u32>) -> Option<&str> {
+        alias.and_then(|a| self.keys.get(&a)).map(|k| k.as_str())
+    }
+
+    /// note that a captured game will be created by replaying its game_new, so requests on it
+    /// wait for that instead of creating it themselves. Called in capture order
+    fn expect_game(&self, captured: i32) {
+        self.games
+            .lock()
+            .unwrap()
+            .entry(captured)
+            .or_insert(GameSlot::Creating);
+    }
+
+    /// record the game created for a captured one (or None if it couldn't be created)
+    fn set_game(&self, captured: i32, created: Option<i32>) {
+        let slot = created.map_or(GameSlot::Failed, GameSlot::Created);
+        self.games.lock().unwrap().insert(captured, slot);
+        self.created.notify_all();
+    }
+
+    fn create_game(&self, alias: Option<u32>) -> Option<i32> {
+        let key = self.key_for(alias).unwrap_or(&self.admin_key);
+        self.agent
+            .post(&format!("{}/api/game/new", self.base))
+            .set("X-API-KEY", key)
+            .send_form(&[("name", "replay")])
+            .ok()
+            .and_then(|r| r.into_json::<IdResp>().ok())
+            .and_then(|r| r.id.parse::<i32>().ok())
+    }
+
+    /// rewrite the game id in a /api/game/<id>/... path to the game created for it, creating one
+    /// if this is the game's first use
+    fn map_path(&self, path: &str, alias: Option<u32>) -> String {
+        let id_start = "/api/game/".len();
+        let id_end = path[id_start.min(path.len())..]
+            .find(|c| c == '/' || c == '?')
+            .map_or(path.len(), |i| i + id_start);
+        let id = match path.get(id_start..id_end).map(|id| id.parse::<i32>()) {
+            Some(Ok(id)) if path.starts_with("/api/game/") => id,
+            _ => return path.to_string(),
+        };
+
+        let mut games = self.games.lock().unwrap();
+        let mapped = loop {
+            match games.get(&id).copied() {
+                Some(GameSlot::Created(mapped)) => break mapped,
+                // leave the id alone, the request will probably fail
+                Some(GameSlot::Failed) => break id,
+                Some(GameSlot::Creating) => games = self.created.wait(games).unwrap(),
+                None => {
+                    // create it without holding the lock, so requests on other games go ahead
+                    games.insert(id, GameSlot::Creating);
+                    drop(games);
+                    let created = self.create_game(alias);
+                    self.set_game(id, created);
+                    games = self.games.lock().unwrap();
+                }
+            }
+        };
+        drop(games);
+
+        format!("{}{}{}", &path[..id_start], mapped, &path[id_end..])
+    }
+
+    fn replay(&self, line: &Line) -> (u64, u16) {
+        let path = self.map_path(line.p.as_deref().unwrap_or("/"), line.u);
+        let body = match line.r.as_str() {
+            "game_new" => Some("name=replay"),
+            _ => line.b.as_deref(),
+        };
+        let mut req = self
+            .agent
+            .request(&line.m, &format!("{}{}", self.base, path));
+        if let Some(key) = self.key_for(line.u) {
+            req = req.set("X-API-KEY", key);
+        }
+        let content_type = match line.r.as_str() {
+            "game_new" => Some("application/x-www-form-urlencoded"),
+            _ => line.c.as_deref(),
+        };
+        if let Some(content_type) = content_type {
+            req = req.set("Content-Type", content_type);
+        }
+
+        let start = Instant::now();
+        let res = match body {
+            Some(body) => req.send_string(body),
+            None => req.call(),
+        };
+        let (status, resp_body) = match res {
+            Ok(resp) => {
+                let status = resp.status();
+                // read the whole response, so its time is counted and the connection is reused
+                (status, resp.into_string().ok())
+            }
+            Err(ureq::Error::Status(status, _)) => (status, None),
+            Err(_) => (0, None),
+        };
+        let latency_us = start.elapsed().as_micros() as u64;
+
+        if let (Some(captured), "game_new") = (line.i, line.r.as_str()) {
+            let created = resp_body
+                .and_then(|body| serde_json::from_str::<IdResp>(&body).ok())
+                .and_then(|r| r.id.parse::<i32>().ok());
+            self.set_game(captured, created);
+        }
+        (latency_us, status)
+    }
+}
+
+fn main() {
+    let args = env::args().skip(1).collect::<Vec<_>>();
+    if args.len() < 2 {
+        usage();
+    }
+    let (capture, base) = (&args[0], args[1].trim_end_matches('/').to_string());
+    let mut admin_key = None;
+    let mut speed = 1.0;
+    let mut threads = 32;
+    for pair in args[2..].chunks(2) {
+        let value = pair.get(1).unwrap_or_else(|| usage());
+        match pair[0].as_str() {
+            "--admin-key" => admin_key = Some(value.clone()),
+            "--speed" => speed = value.parse::<f64>().unwrap_or_else(|_| usage()),
+            "--threads" => threads = value.parse::<usize>().unwrap_or_else(|_| usage()).max(1),
+            _ => usage(),
+        }
+    }
+    let admin_key = admin_key.unwrap_or_else(|| usage());
+    if speed <= 0.0 {
+        usage();
+    }
+
+    let file =
+        File::open(capture).unwrap_or_else(|e| fail(format!("couldn't open capture: {}", e)));
+    let mut skipped = 0;
+    let mut lines = Vec::new();
+    for line in BufReader::new(file).lines() {
+        let line = line.unwrap_or_else(|e| fail(format!("couldn't read capture: {}", e)));
+        match serde_json::from_str::<Line>(&line) {
+            Ok(line) if line.p.is_some() => lines.push(line),
+            _ => skipped += 1,
+        }
+    }
+    lines.sort_by_key(|line| line.t);
+
+    let mut aliases = lines.iter().filter_map(|line| line.u).collect::<Vec<_>>();
+    aliases.sort_unstable();
+    aliases.dedup();
+
+    let mut replayer = Replayer {
+        agent: ureq::AgentBuilder::new()
+            .max_idle_connections(threads * 2)
+            .build(),
+        base,
+        keys: HashMap::new(),
+        admin_key,
+        games: Mutex::new(HashMap::new()),
+        created: Condvar::new(),
+    };
+    println!("creating {} users", aliases.len());
+    replayer.create_users(&aliases).unwrap_or_else(|e| fail(e));
+
+    println!(
+        "replaying {} requests at {}x ({} requests in the capture can't be replayed)",
+        lines.len(),
+        speed,
+        skipped
+    );
+    let replayer = Arc::new(replayer);
+    let (queue, requests) = mpsc::channel::<(Instant, Line)>();
+    let requests = Arc::new(Mutex::new(requests));
+    let results = Arc::new(Mutex::new(Vec::with_capacity(lines.len())));
+    let workers = (0..threads)
+        .map(|_| {
+            let replayer = replayer.clone();
+            let requests = requests.clone();
+            let results = results.clone();
+            thread::spawn(move || loop {
+                let next = requests.lock().unwrap().recv();
+                let (due, line) = match next {
+                    Ok(next) => next,
+                    Err(_) => return,
+                };
+                let lag_us = due.elapsed().as_micros() as u64;
+                let (latency_us, status) = replayer.replay(&line);
+                results.lock().unwrap().push(Replayed {
+                    route: line.r,
+                    captured_us: line.l,
+                    captured_status: line.s,
+                    latency_us,
+                    status,
+                    lag_us,
+                });
+            })
+        })
+        .collect::<Vec<_>>();
+
+    let start = Instant::now();
+    let first = lines.first().map_or(0, |line| line.t);
+    for line in lines {
+        let due = start + Duration::from_secs_f64((line.t - first) as f64 / 1000.0 / speed);
+        let now = Instant::now();
+        if due > now {
+            thread::sleep(due - now);
+        }
+        if let (Some(captured), "game_new") = (line.i, line.r.as_str()) {
+            replayer.expect_game(captured);
+        }
+        let _ = queue.send((due, line));
+    }
+    drop(queue);
+    for worker in workers {
+        let _ = worker.join();
+    }
+    let elapsed = start.elapsed();
+
+    let results = results.lock().unwrap();
+    let mut routes = BTreeMap::<&str, (Vec<u64>, Vec<u64>, usize)>::new();
+    let mut lags = Vec::with_capacity(results.len());
+    for r in results.iter() {
+        let route = routes.entry(r.route.as_str()).or_default();
+        route.0.push(r.captured_us);
+        route.1.push(r.latency_us);
+        if r.status != r.captured_status {
+            route.2 += 1;
+        }
+        lags.push(r.lag_us);
+    }
+    lags.sort_unstable();
+
+    println!("replayed in {:.1?}", elapsed);
+    println!(
+        "{:<22} {:>7} {:>10} {:>10} {:>10} {:>10} {:>8} {:>9}",
+        "route", "count", "cap p50", "cap p99", "p50", "p99", "p99 diff", "mismatch"
+    );
+    for (route, (captured, replayed, mismatched)) in routes.iter_mut() {
+        captured.sort_unstable();
+        replayed.sort_unstable();
+        let (cap_p99, p99) = (percentile(captured, 0.99), percentile(replayed, 0.99));
+        println!(
+            "{:<22} {:>7} {:>8.2}ms {:>8.2}ms {:>8.2}ms {:>8.2}ms {:>+7.0}% {:>9}",
+            route,
+            captured.len(),
+            percentile(captured, 0.5),
+            cap_p99,
+            percentile(replayed, 0.5),
+            p99,
+            if cap_p99 > 0.0 {
+                (p99 / cap_p99 - 1.0) * 100.0
+            } else {
+                0.0
+            },
+            mismatched
+        );
+    }
+    // if requests went out late, the replayer (not the server) was the bottleneck
+    println!(
+        "send lag p50 {:.2}ms, p99 {:.2}ms{}",
+        percentile(&lags, 0.5),
+        percentile(&lags, 0.99),
+        if percentile(&lags, 0.99) > 50.0 {
+            " (the replay fell behind, try more --threads)"
+        } else {
+            ""
+        }
+    );
+}
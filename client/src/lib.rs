@@ -0,0 +1,475 @@
+//! Client for codekata servers.
+//!
+//! Implement [`Bot`] and hand it to a [`Runner`] to play any number of games at once:
+//!
+//! ```no_run
+//! use codekata_client::{Board, Bot, Client, Move, Runner};
+//!
+//! struct FirstOpen;
+//!
+//! impl Bot for FirstOpen {
+//!     fn choose(&mut self, board: &Board) -> Move {
+//!         board.empty_cells().next().unwrap()
+//!     }
+//! }
+//!
+//! let client = Client::new("https://codekata.herokuapp.com", "your api key");
+//! Runner::new(client).play(&[1, 2, 3], |_| FirstOpen).unwrap();
+//! ```
+
+use serde::de::DeserializeOwned;
+use serde::Deserialize;
+use std::cmp::Reverse;
+use std::collections::BinaryHeap;
+use std::fmt;
+use std::sync::{Arc, Condvar, Mutex};
+use std::thread;
+use std::time::{Duration, Instant};
+
+pub const BOARD_SIZE: usize = 15;
+/// how many times in a row a failed request is retried before giving up on its game
+const MAX_RETRIES: u32 = 6;
+/// backoff between retries, doubling from min to max. A longer Retry-After from the server wins
+const RETRY_MIN: Duration = Duration::from_millis(250);
+const RETRY_MAX: Duration = Duration::from_secs(30);
+/// the fields of a game the client reads. Leaving out player names saves the server looking them up
+const STATUS_FIELDS: &str = "state,player_ids,active,started,waiting_on";
+
+/// A gomoku board, from the perspective of the player it was loaded for
+#[derive(Clone, Debug, Deserialize)]
+pub struct Board {
+    /// cells indexed [x][y]. -1 is empty, 0 is your stone, 1 is your opponent's
+    pub board: [[i8; BOARD_SIZE]; BOARD_SIZE],
+}
+
+impl Board {
+    pub fn get(&self, x: usize, y: usize) -> i8 {
+        self.board[x][y]
+    }
+
+    pub fn is_empty(&self, x: usize, y: usize) -> bool {
+        self.board[x][y] == -1
+    }
+
+    /// iterate over the empty cells of the board
+    pub fn empty_cells<'a>(&'a self) -> impl Iterator<Item = Move> + 'a {
+        (0..BOARD_SIZE)
+            .flat_map(|x| (0..BOARD_SIZE).map(move |y| (x, y)))
+            .filter(move |(x, y)| self.is_empty(*x, *y))
+            .map(|(x, y)| Move {
+                x: x as i32,
+                y: y as i32,
+            })
+    }
+}
+
+#[derive(Clone, Copy, PartialEq, Eq, Debug)]
+pub struct Move {
+    pub x: i32,
+    pub y: i32,
+}
+
+/// Something that plays a game. A new bot is created for each game
+pub trait Bot: Send {
+    /// choose a move for the given board. Called only when it is your turn
+    fn choose(&mut self, board: &Board) -> Move;
+}
+
+#[derive(Debug)]
+pub enum Error {
+    Http(Box<ureq::Error>),
+    Io(std::io::Error),
+    /// the server rejected the request
+    Api(String),
+    /// games that were given up on after too many failed requests, and the last error of each.
+    /// The other games were played to the end
+    Games(Vec<(i32, Error)>),
+}
+
+impl fmt::Display for Error {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        match self {
+            Error::Http(e) => write!(f, "http error: {}", e),
+            Error::Io(e) => write!(f, "io error: {}", e),
+            Error::Api(e) => write!(f, "server error: {}", e),
+            Error::Games(games) => {
+                write!(f, "{} games failed", games.len())?;
+                for (id, e) in games {
+                    write!(f, "\n  game {}: {}", id, e)?;
+                }
+                Ok(())
+            }
+        }
+    }
+}
+
+impl Error {
+    /// whether the request may succeed if made again. Requests the server turned away as
+    /// overloaded, failed in transit, or were rejected (ie -- while it hands off to a new process)
+    /// can. Requests that are malformed or unauthorized can't
+    fn retryable(&self) -> bool {
+        match self {
+            Error::Http(e) => match &**e {
+                ureq::Error::Status(code, _) => *code == 429 || *code >= 500,
+                ureq::Error::Transport(_) => true,
+            },
+            Error::Io(_) | Error::Api(_) => true,
+            Error::Games(_) => false,
+        }
+    }
+
+    /// how long the server asked to wait before retrying, if it did
+    fn retry_after(&self) -> Option<Duration> {
+        match self {
+            Error::Http(e) => match &**e {
+                ureq::Error::Status(_, resp) => resp
+                    .header("Retry-After")
+                    .and_then(|secs| secs.trim().parse::<u64>().ok())
+                    .map(Duration::from_secs),
+                _ => None,
+            },
+            _ => None,
+        }
+    }
+}
+
+/// how long to wait before a retry, after failures requests in a row have failed
+fn backoff(failures: u32, e: &Error) -> Duration {
+    let delay = (RETRY_MIN * 2u32.pow(failures.min(16))).min(RETRY_MAX);
+    e.retry_after().map_or(delay, |after| after.max(delay))
+}
+
+/// make a request, retrying with backoff while it fails with a retryable error
+fn with_retries<T, F: FnMut() -> Result<T, Error>>(mut request: F) -> Result<T, Error> {
+    let mut failures = 0;
+    loop {
+        match request() {
+            Err(e) if e.retryable() && failures < MAX_RETRIES => {
+                thread::sleep(backoff(failures, &e));
+                failures += 1;
+            }
+            res => return res,
+        }
+    }
+}
+
+impl std::error::Error for Error {}
+
+impl From<ureq::Error> for Error {
+    fn from(e: ureq::Error) -> Error {
+        Error::Http(Box::new(e))
+    }
+}
+
+impl From<std::io::Error> for Error {
+    fn from(e: std::io::Error) -> Error {
+        Error::Io(e)
+    }
+}
+
+/// Responses from the server are either the expected value or an error message
+#[derive(Deserialize)]
+#[serde(untagged)]
+enum ApiResp<T> {
+    Err { error: String },
+    Ok(T),
+}
+
+#[derive(Deserialize)]
+struct UserResp {
+    id: i32,
+}
+
+#[derive(Deserialize)]
+struct SuccessResp {}
+
+/// The parts of a game a client needs
+#[derive(Deserialize, Debug)]
+pub struct GameStatus {
+    pub state: Option<Board>,
+    pub player_ids: Vec<i32>,
+    pub active: bool,
+    pub started: bool,
+    pub waiting_on: Vec<bool>,
+}
+
+/// A connection to a codekata server. Connections are kept alive and shared between threads
+#[derive(Clone)]
+pub struct Client {
+    agent: ureq::Agent,
+    base: String,
+    api_key: String,
+}
+
+impl Client {
+    /// create a client for the server at base_url (ie -- https://codekata.herokuapp.com)
+    pub fn new(base_url: &str, api_key: &str) -> Client {
+        Client {
+            agent: ureq::agent(),
+            base: format!("{}/api", base_url.trim_end_matches('/')),
+            api_key: api_key.to_string(),
+        }
+    }
+
+    fn get<T: DeserializeOwned>(&self, path: &str) -> Result<T, Error> {
+        let resp = self
+            .agent
+            .get(&format!("{}{}", self.base, path))
+            .set("X-API-KEY", &self.api_key)
+            .call()?;
+        match resp.into_json::<ApiResp<T>>()? {
+            ApiResp::Ok(v) => Ok(v),
+            ApiResp::Err { error } => Err(Error::Api(error)),
+        }
+    }
+
+    fn post<T: DeserializeOwned>(&self, path: &str, form: &[(&str, &str)]) -> Result<T, Error> {
+        let resp = self
+            .agent
+            .post(&format!("{}{}", self.base, path))
+            .set("X-API-KEY", &self.api_key)
+            .send_form(form)?;
+        match resp.into_json::<ApiResp<T>>()? {
+            ApiResp::Ok(v) => Ok(v),
+            ApiResp::Err { error } => Err(Error::Api(error)),
+        }
+    }
+
+    /// get the id of the user the api key belongs to
+    pub fn user_id(&self) -> Result<i32, Error> {
+        Ok(self.get::<UserResp>("/user")?.id)
+    }
+
+    pub fn join(&self, game: i32) -> Result<(), Error> {
+        self.post::<SuccessResp>(&format!("/game/{}/join", game), &[])?;
+        Ok(())
+    }
+
+    /// load a game's state and who it is waiting on, in a single request
+    pub fn status(&self, game: i32) -> Result<GameStatus, Error> {
+        self.get(&format!("/game/{}?fields={}", game, STATUS_FIELDS))
+    }
+
+    pub fn make_move(&self, game: i32, m: Move) -> Result<(), Error> {
+        self.post::<SuccessResp>(
+            &format!("/game/{}/move", game),
+            &[("x", &m.x.to_string()), ("y", &m.y.to_string())],
+        )?;
+        Ok(())
+    }
+}
+
+/// Polling intervals. While waiting on an opponent, the interval backs off from min to max, and
+/// resets once it is your turn again.
+#[derive(Clone, Copy, Debug)]
+pub struct PollConfig {
+    pub min: Duration,
+    pub max: Duration,
+}
+
+impl Default for PollConfig {
+    fn default() -> PollConfig {
+        PollConfig {
+            min: Duration::from_millis(25),
+            max: Duration::from_millis(500),
+        }
+    }
+}
+
+struct GameSlot<B: Bot> {
+    id: i32,
+    bot: B,
+    interval: Duration,
+    /// requests for this game that have failed in a row
+    failures: u32,
+}
+
+/// Games scheduled to be polled, ordered by when they are next due
+struct Schedule<B: Bot> {
+    due: BinaryHeap<Reverse<(Instant, usize)>>,
+    /// games checked out by a worker are None
+    slots: Vec<Option<GameSlot<B>>>,
+    /// games not yet finished
+    remaining: usize,
+    /// games given up on, with the error that ended each
+    failed: Vec<(i32, Error)>,
+}
+
+/// Plays many games at once on a small pool of threads, sharing kept-alive connections
+pub struct Runner {
+    client: Client,
+    threads: usize,
+    poll: PollConfig,
+}
+
+impl Runner {
+    pub fn new(client: Client) -> Runner {
+        Runner {
+            client,
+            threads: 4,
+            poll: PollConfig::default(),
+        }
+    }
+
+    /// number of worker threads making requests and running bots
+    pub fn threads(mut self, threads: usize) -> Runner {
+        self.threads = threads.max(1);
+        self
+    }
+
+    pub fn poll(mut self, poll: PollConfig) -> Runner {
+        self.poll = poll;
+        self
+    }
+
+    /// join and play each of the games until they are all finished. make_bot is called with
+    /// each game's id to create the bot that plays it. Failed requests are retried with backoff,
+    /// and a game is only given up on (and returned in Error::Games) after MAX_RETRIES failures
+    /// in a row
+    pub fn play<B: Bot + 'static, F: Fn(i32) -> B>(
+        &self,
+        games: &[i32],
+        make_bot: F,
+    ) -> Result<(), Error> {
+        let me = with_retries(|| self.client.user_id())?;
+        for game in games {
+            // joining a game that has already started (or we have already joined) isn't an error
+            // here, so rejections aren't retried
+            let join = || match self.client.join(*game) {
+                Err(Error::Api(_)) => Ok(()),
+                res => res,
+            };
+            with_retries(join)?;
+        }
+
+        let now = Instant::now();
+        let schedule = Arc::new((
+            Mutex::new(Schedule {
+                due: (0..games.len()).map(|i| Reverse((now, i))).collect(),
+                slots: games
+                    .iter()
+                    .map(|id| {
+                        Some(GameSlot {
+                            id: *id,
+                            bot: make_bot(*id),
+                            interval: self.poll.min,
+                            failures: 0,
+                        })
+                    })
+                    .collect(),
+                remaining: games.len(),
+                failed: Vec::new(),
+            }),
+            Condvar::new(),
+        ));
+
+        let workers = (0..self.threads.min(games.len()))
+            .map(|_| {
+                let schedule = schedule.clone();
+                let client = self.client.clone();
+                let poll = self.poll;
+                thread::spawn(move || worker(&client, me, poll, &schedule))
+            })
+            .collect::<Vec<_>>();
+        for w in workers {
+            let _ = w.join();
+        }
+
+        let mut schedule = schedule.0.lock().unwrap();
+        if schedule.failed.is_empty() {
+            Ok(())
+        } else {
+            Err(Error::Games(std::mem::take(&mut schedule.failed)))
+        }
+    }
+}
+
+/// poll a game once, and move if it is our turn. Returns whether the game is still going, and
+/// whether we moved
+fn step<B: Bot>(client: &Client, me: i32, slot: &mut GameSlot<B>) -> Result<(bool, bool), Error> {
+    let status = client.status(slot.id)?;
+    if status.started && !status.active {
+        return Ok((false, false));
+    }
+    let our_turn = status
+        .player_ids
+        .iter()
+        .position(|id| *id == me)
+        .and_then(|index| status.waiting_on.get(index).copied())
+        .unwrap_or(false);
+
+    match (our_turn, &status.state) {
+        (true, Some(board)) => {
+            let m = slot.bot.choose(board);
+            client.make_move(slot.id, m)?;
+            Ok((true, true))
+        }
+        _ => Ok((true, false)),
+    }
+}
+
+fn worker<B: Bot>(
+    client: &Client,
+    me: i32,
+    poll: PollConfig,
+    schedule: &(Mutex<Schedule<B>>, Condvar),
+) {
+    let (lock, cond) = schedule;
+    let mut sched = lock.lock().unwrap();
+    loop {
+        if sched.remaining == 0 {
+            cond.notify_all();
+            return;
+        }
+        let (due, index) = match sched.due.peek() {
+            Some(Reverse(next)) => *next,
+            None => {
+                // every remaining game is checked out by another worker
+                sched = cond.wait(sched).unwrap();
+                continue;
+            }
+        };
+        let now = Instant::now();
+        if due > now {
+            sched = cond.wait_timeout(sched, due - now).unwrap().0;
+            continue;
+        }
+        sched.due.pop();
+        let mut slot = sched.slots[index].take().unwrap();
+        drop(sched);
+
+        let res = step(client, me, &mut slot);
+
+        sched = lock.lock().unwrap();
+        let delay = match res {
+            Ok((true, moved)) => {
+                // poll again right away after moving, back off while the opponent thinks
+                slot.interval = if moved {
+                    poll.min
+                } else {
+                    (slot.interval * 2).min(poll.max)
+                };
+                slot.failures = 0;
+                Some(slot.interval)
+            }
+            Ok((false, _)) => None,
+            Err(e) if e.retryable() && slot.failures < MAX_RETRIES => {
+                let delay = backoff(slot.failures, &e);
+                slot.failures += 1;
+                Some(delay)
+            }
+            Err(e) => {
+                sched.failed.push((slot.id, e));
+                None
+            }
+        };
+        match delay {
+            Some(delay) => {
+                sched.due.push(Reverse((Instant::now() + delay, index)));
+                sched.slots[index] = Some(slot);
+                cond.notify_one();
+            }
+            None => sched.remaining -= 1,
+        }
+    }
+}
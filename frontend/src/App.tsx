@@ -12,6 +12,8 @@ import ApiGen from './ApiGen';
 import EditUser from './EditUser';
 import Games, { UrlGame } from './Games';
 import Page from './Page';
+import Ops from './Ops';
+import Wall from './Wall';
 
 interface AppState {
   session: SessionInfo;
@@ -74,6 +76,12 @@ export default class App extends Component<{}, AppState> {
             <Route exact path="/user_edit">
               <EditUser session={this.state.session} session_change_callback={this.update_session} />
             </Route>
+            <Route exact path="/ops">
+              <Ops session={this.state.session} />
+            </Route>
+            <Route exact path="/wall">
+              <Wall />
+            </Route>
             <Route path="/game/:game_id">
               <UrlGame session={this.state.session} />
             </Route>
@@ -2,7 +2,7 @@ import React, { Fragment, useEffect, useState, useRef } from 'react';
 import './form.css';
 import './flex.css';
 import './games.css';
-import { checkError, GAME_INDEX, postArgs, rejectedPromiseHandler, SessionInfo, GET_GAME, GAME_NEW, GAME_JOIN, GAME_LEAVE, GAME_START } from './api';
+import { checkError, GAME_INDEX_PAGE, postArgs, rejectedPromiseHandler, SessionInfo, GET_GAME, GAME_NEW, GAME_JOIN, GAME_LEAVE, GAME_START } from './api';
 import Gomoku from './Gomoku';
 import { Link, useParams } from 'react-router-dom';
 
@@ -50,63 +50,138 @@ export interface GamesProps {
   session: SessionInfo,
 }
 
+// games fetched from the index at a time
+const PAGE_SIZE = 10;
+// how often to check for games newer than the first one shown
+const NEW_GAMES_POLL_MS = 5000;
+// how long to wait before trying a page again after it failed to load
+const PAGE_RETRY_MS = 2000;
+// games this far outside the viewport are unmounted, so they stop polling and drop their canvas
+const MOUNT_MARGIN = "800px 0px";
+// height of a game that hasn't been shown yet
+const ESTIMATED_GAME_HEIGHT = 600;
+
+interface GameSlotProps {
+  id: number,
+  session: SessionInfo,
+  game_update_callback: () => void,
+}
+
+// a game that is only mounted while it's near the viewport. Otherwise it's an empty box as tall as
+// the game was, so the page doesn't jump
+function GameSlot(props: GameSlotProps) {
+  const [visible, setVisible] = useState(false);
+  const [height, setHeight] = useState(ESTIMATED_GAME_HEIGHT);
+  const slotRef = useRef(null as HTMLDivElement | null);
+
+  useEffect(() => {
+    const observer = new IntersectionObserver((entries) => {
+      for(const entry of entries) {
+        if(!entry.isIntersecting && entry.boundingClientRect.height > 0) {
+          setHeight(entry.boundingClientRect.height);
+        }
+        setVisible(entry.isIntersecting);
+      }
+    }, { rootMargin: MOUNT_MARGIN });
+    observer.observe(slotRef.current as HTMLDivElement);
+
+    return () => observer.disconnect();
+  }, []);
+
+  return (
+    <div ref={slotRef} style={visible ? {} : {height: height}}>
+      {visible &&
+        <Game id={props.id} session={props.session} game_update_callback={props.game_update_callback} />
+      }
+    </div>
+  );
+}
+
 export default function Games(props: GamesProps) {
-  const [numLoaded, setNumLoaded] = useState(3);
-  const [totalNumGames, setTotalNumGames] = useState(-1);
   const [games, setGames] = useState([] as number[]);
-  const [shedId, setShedId] = useState(-1);
-
+  // cursor for the next page. undefined before the first page, and null once every game is loaded
+  const [next, setNext] = useState(undefined as number | null | undefined);
+  // bumped to try a failed page again, since next didn't change
+  const [retries, setRetries] = useState(0);
+  const loadingRef = useRef(false);
+  const firstPageRef = useRef(false);
+  const sentinelRef = useRef(null as HTMLDivElement | null);
   const mountedRef = useRef(true);
 
-  function loadGames() {
-    if(shedId !== -1) {
-      window.clearTimeout(shedId);
-    }
+  function loadPage(before?: number) {
+    if(loadingRef.current) return;
+    loadingRef.current = true;
+    let loaded = false;
 
-    fetch(GAME_INDEX, {
+    fetch(GAME_INDEX_PAGE(PAGE_SIZE, before), {
       method: 'GET'
     }).then(resp => (resp.json())).then(json => {
+      if(!mountedRef.current) return;
       if(checkError(json)) {
-        setTotalNumGames(json.games.length);
-        const games = json.games.slice(0, numLoaded);
-        setGames(games);
+        loaded = true;
+        firstPageRef.current = true;
+        setGames(games => games.concat(json.games));
+        setNext(json.next);
       }
     }).catch(rejectedPromiseHandler).finally(() => {
-      if(shedId !== -1) {
-        window.clearTimeout(shedId);
-      }
-      if(mountedRef.current) {
-        setShedId(window.setTimeout(() => loadGames(), 2000));
+      loadingRef.current = false;
+      // the sentinel only fires again when it comes back into view, so watch it again
+      if(!loaded) {
+        window.setTimeout(() => {
+          if(mountedRef.current) setRetries(retries => retries + 1);
+        }, PAGE_RETRY_MS);
       }
     });
   }
 
+  // add games created since the first page was loaded
+  function loadNewGames() {
+    fetch(GAME_INDEX_PAGE(PAGE_SIZE), {
+      method: 'GET'
+    }).then(resp => (resp.json())).then(json => {
+      // until the first page is in, it has the newest games
+      if(!mountedRef.current || !firstPageRef.current || json.error !== undefined) return;
+      setGames(games => {
+        const newest = games.length > 0 ? games[0] : -1;
+        const added = (json.games as number[]).filter(id => id > newest);
+        return added.length > 0 ? added.concat(games) : games;
+      });
+    }).catch(() => {});
+  }
+
   useEffect(() => {
-    loadGames();
+    const poll = window.setInterval(loadNewGames, NEW_GAMES_POLL_MS);
 
     return () => {
       mountedRef.current = false;
-      if(shedId !== -1) window.clearTimeout(shedId);
+      window.clearInterval(poll);
     }
   }, []);
 
+  // load the next page whenever the end of the list comes into view
+  useEffect(() => {
+    if(next === null) return;
+
+    const observer = new IntersectionObserver((entries) => {
+      if(entries.some(entry => entry.isIntersecting)) {
+        loadPage(next);
+      }
+    }, { rootMargin: MOUNT_MARGIN });
+    observer.observe(sentinelRef.current as HTMLDivElement);
+
+    return () => observer.disconnect();
+  }, [next, retries]);
+
   return (
     <div className="pageContainer">
       {props.session.logged_in &&
-        <NewGame game_update_callback={() => loadGames()} />
+        <NewGame game_update_callback={() => loadNewGames()} />
       }
       {games.map((id) =>
-        <Game id={id} session={props.session} game_update_callback={() => loadGames()} key={id} />
+        <GameSlot id={id} session={props.session} game_update_callback={() => loadNewGames()} key={id} />
       )}
-      {(totalNumGames === -1 || numLoaded < totalNumGames + 3) &&
-        <button onClick={
-          () => { 
-            setNumLoaded(numLoaded + 3);
-            loadGames();
-          }
-        } className="btn">Load More Games</button>
-      }
-      {totalNumGames === 0 &&
+      <div ref={sentinelRef} />
+      {next === null && games.length === 0 &&
         <p>No games found.</p>
       }
     </div>
@@ -122,26 +197,23 @@ export interface GameProps {
 
 export function Game(props: GameProps) {
   const [game, setGame] = useState(null as any);
-  const [shedId, setShedId] = useState(-1);
+  // the pending poll, kept in a ref so unmounting can always cancel it
+  const pollRef = useRef(-1);
 
   const mountedRef = useRef(true);
 
   function loadGame(id: number) {
-    if(shedId !== -1) {
-      window.clearTimeout(shedId);
-    }
+    window.clearTimeout(pollRef.current);
     fetch(GET_GAME(id) + "?dont_invert=true", {
       method: 'GET'
     }).then((resp) => resp.json()).then((json) => {
-      if(checkError(json)) {
+      if(mountedRef.current && checkError(json)) {
         setGame(json);
       }
     }).catch(rejectedPromiseHandler).finally(() => {
-      if(shedId !== -1) {
-        window.clearTimeout(shedId);
-      }
+      window.clearTimeout(pollRef.current);
       if(mountedRef.current) {
-        setShedId(window.setTimeout(() => loadGame(id), 1500));
+        pollRef.current = window.setTimeout(() => loadGame(id), 1500);
       }
     })
   }
@@ -162,9 +234,7 @@ export function Game(props: GameProps) {
     
     return () => {
       mountedRef.current = false;
-      if(shedId !== -1) {
-        window.clearTimeout(shedId);
-      }
+      window.clearTimeout(pollRef.current);
     }
   }, []);
 
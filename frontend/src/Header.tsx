@@ -70,6 +70,13 @@ export default class Header extends Component<HeaderProps, any> {
                 }>New Page</Link>
               </div>
             }
+            { this.props.session.is_admin &&
+              <div>
+                <Link to="/ops" onClick={
+                  () => {this.setState({user_menu_toggled: false})}
+                }>Operations</Link>
+              </div>
+            }
           </div>
         }
       </div>
@@ -90,6 +97,9 @@ export default class Header extends Component<HeaderProps, any> {
           <div className="flexShrink headerBtn">
             <Link to="/pages/about"><span>About</span></Link>
           </div>
+          <div className="flexShrink headerBtn">
+            <Link to="/wall"><span>Wall</span></Link>
+          </div>
           <div className="flexExpand" />
           { this.header_btns() }
         </div>
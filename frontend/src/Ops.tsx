@@ -0,0 +1,125 @@
+import React, { useEffect, useState } from 'react';
+import './games.css';
+import './ops.css';
+import { ADMIN_METRICS_STREAM, SessionInfo } from './api';
+import AuthRequired from './AuthRequired';
+
+interface RouteMetrics {
+  route: string,
+  requests_per_sec: number,
+  errors_per_sec: number,
+  p99_ms: number,
+}
+
+interface BotMetrics {
+  user_id: number,
+  mean_move_ms: number,
+  moves: number,
+}
+
+interface MetricsSnapshot {
+  ts_ms: number,
+  window_secs: number,
+  requests_per_sec: number,
+  p99_ms: number,
+  routes: RouteMetrics[],
+  active_games: number,
+  db_connections_in_use: number,
+  db_pool_size: number,
+  lock_wait_p99_ms: number,
+  slowest_bots: BotMetrics[],
+}
+
+export interface OpsProps {
+  session: SessionInfo,
+}
+
+function Tile(props: {title: string, value: string, warn?: boolean}) {
+  return (
+    <div className={props.warn ? "opsTile opsTileWarn" : "opsTile"}>
+      <span className="opsTileValue">{props.value}</span>
+      {props.title}
+    </div>
+  );
+}
+
+// live server health, pushed by the server every second
+export default function Ops(props: OpsProps) {
+  const [snapshot, setSnapshot] = useState(null as MetricsSnapshot | null);
+  const [connected, setConnected] = useState(false);
+
+  useEffect(() => {
+    if(!props.session.is_admin) return;
+
+    const source = new EventSource(ADMIN_METRICS_STREAM, { withCredentials: true });
+    source.onopen = () => setConnected(true);
+    // the browser reconnects on its own
+    source.onerror = () => setConnected(false);
+    source.onmessage = (e) => setSnapshot(JSON.parse(e.data));
+
+    return () => source.close();
+  }, [props.session.is_admin]);
+
+  if(!props.session.logged_in) {
+    return <AuthRequired />;
+  }
+  if(!props.session.is_admin) {
+    return <p style={{textAlign: "center"}}>You must be an admin to access this page.</p>;
+  }
+  if(snapshot === null) {
+    return <p style={{textAlign: "center"}}>Connecting...</p>;
+  }
+
+  const pool_full = snapshot.db_pool_size > 0 && snapshot.db_connections_in_use >= snapshot.db_pool_size;
+
+  return (
+    <div className="pageContainer">
+      <div className="gameTitle">
+        Operations
+        <span className="gameId">
+          {connected ? `updated ${new Date(snapshot.ts_ms).toLocaleTimeString()}` : "disconnected"}
+        </span>
+      </div>
+      <div className="opsTiles">
+        <Tile title="Requests/sec" value={snapshot.requests_per_sec.toFixed(1)} />
+        <Tile title="p99 Latency" value={`${snapshot.p99_ms.toFixed(1)}ms`} />
+        <Tile title="Active Games" value={`${snapshot.active_games}`} />
+        <Tile title="DB Connections" value={`${snapshot.db_connections_in_use}/${snapshot.db_pool_size}`} warn={pool_full} />
+        <Tile title="p99 Lock Wait" value={`${snapshot.lock_wait_p99_ms.toFixed(2)}ms`} />
+      </div>
+
+      <h3>Routes (last {Math.round(snapshot.window_secs)}s)</h3>
+      <table className="opsTable">
+        <thead>
+          <tr><th>Route</th><th>Requests/sec</th><th>Errors/sec</th><th>p99</th></tr>
+        </thead>
+        <tbody>
+          {snapshot.routes.map((r) =>
+            <tr key={r.route}>
+              <td>{r.route}</td>
+              <td>{r.requests_per_sec.toFixed(1)}</td>
+              <td>{r.errors_per_sec.toFixed(1)}</td>
+              <td>{r.p99_ms.toFixed(1)}ms</td>
+            </tr>
+          )}
+        </tbody>
+      </table>
+
+      <h3>Slowest Bots</h3>
+      <table className="opsTable">
+        <thead>
+          <tr><th>User</th><th>Mean Move Time</th><th>Moves</th></tr>
+        </thead>
+        <tbody>
+          {snapshot.slowest_bots.map((b) =>
+            <tr key={b.user_id}>
+              <td>#{b.user_id}</td>
+              <td>{b.mean_move_ms.toFixed(0)}ms</td>
+              <td>{b.moves}</td>
+            </tr>
+          )}
+        </tbody>
+      </table>
+    </div>
+  );
+}
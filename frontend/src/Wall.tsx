@@ -0,0 +1,394 @@
+import React, { useEffect, useRef, useState } from 'react';
+import { useHistory, useLocation } from 'react-router-dom';
+import './games.css';
+import './wall.css';
+import { GAME_WALL_STREAM } from './api';
+
+// a game as sent by the wall stream, from player 0's side
+interface WallGame {
+  id: number,
+  state: { board: number[][] } | null,
+  player_ids: number[],
+  active: boolean,
+}
+
+// finished games stay up this long, like on the server
+const FINISHED_MS = 30000;
+// gap around each board, in css pixels
+const BOARD_PAD = 4;
+// rgba colors
+const BOARD_COLOR = [1.0, 0.894, 0.769, 1.0];
+const FINISHED_BOARD_COLOR = [0.8, 0.8, 0.8, 1.0];
+const LINE_COLOR = [0.0, 0.0, 0.0, 1.0];
+const STONE_COLORS = [[0.0, 0.0, 0.0, 1.0], [1.0, 1.0, 1.0, 1.0]];
+// each instance is a rectangle (or the circle in it): x, y, width, height (in pixels),
+// r, g, b, a, round
+const INSTANCE_FLOATS = 9;
+
+const VERTEX_SHADER = `#version 300 es
+in vec2 corner;
+in vec4 rect;
+in vec4 color;
+in float round;
+uniform vec2 resolution;
+out vec2 local;
+out vec4 vColor;
+out float vRound;
+void main() {
+  vec2 pixel = rect.xy + corner * rect.zw;
+  gl_Position = vec4(pixel / resolution * vec2(2.0, -2.0) + vec2(-1.0, 1.0), 0.0, 1.0);
+  local = corner * 2.0 - 1.0;
+  vColor = color;
+  vRound = round;
+}`;
+
+const FRAGMENT_SHADER = `#version 300 es
+precision mediump float;
+in vec2 local;
+in vec4 vColor;
+in float vRound;
+out vec4 outColor;
+void main() {
+  float r = dot(local, local);
+  if(vRound > 0.5 && r > 1.0) discard;
+  // stones get a dark outline, so white stones show up on the board
+  outColor = vRound > 0.5 && r > 0.8 ? vec4(0.0, 0.0, 0.0, 1.0) : vColor;
+}`;
+
+// where a game is drawn, and where its instances are in the buffers
+interface Slot {
+  id: number,
+  size: number,
+  x: number,
+  y: number,
+  cell: number,
+  spacing: number,
+  boardInstance: number,
+  stoneInstance: number,
+}
+
+function compile(gl: WebGL2RenderingContext, type: number, source: string): WebGLShader {
+  const shader = gl.createShader(type) as WebGLShader;
+  gl.shaderSource(shader, source);
+  gl.compileShader(shader);
+  if(!gl.getShaderParameter(shader, gl.COMPILE_STATUS)) {
+    throw new Error(`shader didn't compile: ${gl.getShaderInfoLog(shader)}`);
+  }
+  return shader;
+}
+
+function setInstance(data: Float32Array, i: number, x: number, y: number, w: number, h: number, color: number[], round: boolean) {
+  const o = i * INSTANCE_FLOATS;
+  data[o] = x;
+  data[o + 1] = y;
+  data[o + 2] = w;
+  data[o + 3] = h;
+  data.set(color, o + 4);
+  data[o + 8] = round ? 1 : 0;
+}
+
+// Draws every board on one canvas with two instanced draw calls: one for the boards and their
+// grid lines, which only change when the layout does, and one for the stones, where only the
+// boards that changed are rewritten
+class WallRenderer {
+  gl: WebGL2RenderingContext;
+  resolution: WebGLUniformLocation;
+  boards: { vao: WebGLVertexArrayObject, buffer: WebGLBuffer, data: Float32Array };
+  stones: { vao: WebGLVertexArrayObject, buffer: WebGLBuffer, data: Float32Array };
+  slots: Slot[] = [];
+  slotOf: Map<number, Slot> = new Map();
+
+  constructor(gl: WebGL2RenderingContext) {
+    this.gl = gl;
+    const program = gl.createProgram() as WebGLProgram;
+    gl.attachShader(program, compile(gl, gl.VERTEX_SHADER, VERTEX_SHADER));
+    gl.attachShader(program, compile(gl, gl.FRAGMENT_SHADER, FRAGMENT_SHADER));
+    gl.linkProgram(program);
+    if(!gl.getProgramParameter(program, gl.LINK_STATUS)) {
+      throw new Error(`shaders didn't link: ${gl.getProgramInfoLog(program)}`);
+    }
+    gl.useProgram(program);
+    this.resolution = gl.getUniformLocation(program, "resolution") as WebGLUniformLocation;
+
+    const corners = gl.createBuffer();
+    gl.bindBuffer(gl.ARRAY_BUFFER, corners);
+    gl.bufferData(gl.ARRAY_BUFFER, new Float32Array([0, 0, 1, 0, 0, 1, 1, 1]), gl.STATIC_DRAW);
+
+    const layer = () => {
+      const vao = gl.createVertexArray() as WebGLVertexArrayObject;
+      gl.bindVertexArray(vao);
+      gl.bindBuffer(gl.ARRAY_BUFFER, corners);
+      const corner = gl.getAttribLocation(program, "corner");
+      gl.enableVertexAttribArray(corner);
+      gl.vertexAttribPointer(corner, 2, gl.FLOAT, false, 0, 0);
+
+      const buffer = gl.createBuffer() as WebGLBuffer;
+      gl.bindBuffer(gl.ARRAY_BUFFER, buffer);
+      const stride = INSTANCE_FLOATS * 4;
+      for(const [name, size, offset] of [["rect", 4, 0], ["color", 4, 16], ["round", 1, 32]] as [string, number, number][]) {
+        const loc = gl.getAttribLocation(program, name);
+        gl.enableVertexAttribArray(loc);
+        gl.vertexAttribPointer(loc, size, gl.FLOAT, false, stride, offset);
+        gl.vertexAttribDivisor(loc, 1);
+      }
+      gl.bindVertexArray(null);
+      return { vao, buffer, data: new Float32Array(0) };
+    };
+    this.boards = layer();
+    this.stones = layer();
+  }
+
+  // place every game in a grid that fills the canvas, as big as they fit, and rebuild the buffers
+  layout(games: WallGame[]) {
+    const gl = this.gl;
+    const w = gl.canvas.width;
+    const h = gl.canvas.height;
+    const n = Math.max(games.length, 1);
+    let cols = 1;
+    let cell = 0;
+    for(let c = 1; c <= n; c++) {
+      const size = Math.min(w / c, h / Math.ceil(n / c));
+      if(size > cell) {
+        cols = c;
+        cell = size;
+      }
+    }
+
+    const pad = BOARD_PAD * window.devicePixelRatio;
+    let boardInstances = 0;
+    let stoneInstances = 0;
+    this.slots = games.map((game, i) => {
+      const size = game.state === null ? 0 : game.state.board.length;
+      const slot = {
+        id: game.id,
+        size,
+        x: (i % cols) * cell + pad,
+        y: Math.floor(i / cols) * cell + pad,
+        cell,
+        spacing: (cell - 2 * pad) / (size + 1),
+        boardInstance: boardInstances,
+        stoneInstance: stoneInstances,
+      };
+      // the board, then a line for each row and column
+      boardInstances += 1 + 2 * size;
+      stoneInstances += size * size;
+      return slot;
+    });
+    this.slotOf = new Map(this.slots.map(slot => [slot.id, slot]));
+
+    this.boards.data = new Float32Array(boardInstances * INSTANCE_FLOATS);
+    this.stones.data = new Float32Array(stoneInstances * INSTANCE_FLOATS);
+    const line = Math.max(1, Math.round(window.devicePixelRatio));
+    games.forEach((game, i) => {
+      const slot = this.slots[i];
+      const span = slot.spacing * (slot.size - 1);
+      this.writeBoard(slot, game);
+      for(let l = 0; l < slot.size; l++) {
+        const at = (l + 1) * slot.spacing - line / 2;
+        setInstance(this.boards.data, slot.boardInstance + 1 + 2 * l, slot.x + at, slot.y + slot.spacing, line, span, LINE_COLOR, false);
+        setInstance(this.boards.data, slot.boardInstance + 2 + 2 * l, slot.x + slot.spacing, slot.y + at, span, line, LINE_COLOR, false);
+      }
+      this.writeStones(slot, game);
+    });
+
+    gl.viewport(0, 0, w, h);
+    gl.uniform2f(this.resolution, w, h);
+    for(const layer of [this.boards, this.stones]) {
+      gl.bindBuffer(gl.ARRAY_BUFFER, layer.buffer);
+      gl.bufferData(gl.ARRAY_BUFFER, layer.data, gl.DYNAMIC_DRAW);
+    }
+  }
+
+  writeBoard(slot: Slot, game: WallGame) {
+    const side = slot.cell - 2 * BOARD_PAD * window.devicePixelRatio;
+    setInstance(this.boards.data, slot.boardInstance, slot.x, slot.y, side, side, game.active ? BOARD_COLOR : FINISHED_BOARD_COLOR, false);
+  }
+
+  writeStones(slot: Slot, game: WallGame) {
+    if(game.state === null) return;
+    const radius = slot.spacing * 0.45;
+    for(let x = 0; x < slot.size; x++) {
+      for(let y = 0; y < slot.size; y++) {
+        const player = game.state.board[x][y];
+        // empty points are zero sized stones, which draw nothing
+        const r = player === -1 ? 0 : radius;
+        setInstance(this.stones.data, slot.stoneInstance + x * slot.size + y,
+          slot.x + (x + 1) * slot.spacing - r, slot.y + (y + 1) * slot.spacing - r, 2 * r, 2 * r,
+          STONE_COLORS[player] || LINE_COLOR, true);
+      }
+    }
+  }
+
+  // rewrite one game's instances in place. False if it doesn't fit its slot, and needs a new layout
+  update(game: WallGame): boolean {
+    const slot = this.slotOf.get(game.id);
+    const size = game.state === null ? 0 : game.state.board.length;
+    if(slot === undefined || slot.size !== size) {
+      return false;
+    }
+    const gl = this.gl;
+    this.writeBoard(slot, game);
+    gl.bindBuffer(gl.ARRAY_BUFFER, this.boards.buffer);
+    gl.bufferSubData(gl.ARRAY_BUFFER, slot.boardInstance * INSTANCE_FLOATS * 4,
+      this.boards.data, slot.boardInstance * INSTANCE_FLOATS, INSTANCE_FLOATS);
+
+    this.writeStones(slot, game);
+    gl.bindBuffer(gl.ARRAY_BUFFER, this.stones.buffer);
+    gl.bufferSubData(gl.ARRAY_BUFFER, slot.stoneInstance * INSTANCE_FLOATS * 4,
+      this.stones.data, slot.stoneInstance * INSTANCE_FLOATS, size * size * INSTANCE_FLOATS);
+    return true;
+  }
+
+  draw() {
+    const gl = this.gl;
+    gl.clearColor(1, 1, 1, 1);
+    gl.clear(gl.COLOR_BUFFER_BIT);
+    for(const layer of [this.boards, this.stones]) {
+      gl.bindVertexArray(layer.vao);
+      gl.drawArraysInstanced(gl.TRIANGLE_STRIP, 0, 4, layer.data.length / INSTANCE_FLOATS);
+    }
+    gl.bindVertexArray(null);
+  }
+
+  // the game drawn at a point on the canvas, in css pixels
+  gameAt(px: number, py: number): number | null {
+    const x = px * window.devicePixelRatio;
+    const y = py * window.devicePixelRatio;
+    const slot = this.slots.find(s => x >= s.x && x < s.x + s.cell && y >= s.y && y < s.y + s.cell);
+    return slot === undefined ? null : slot.id;
+  }
+}
+
+// every game in progress on one canvas, for putting on a big screen during a tournament.
+// ?games=1,2,3 shows only those games
+export default function Wall(props: {}) {
+  const canvasRef = useRef(null as HTMLCanvasElement | null);
+  const rendererRef = useRef(null as WallRenderer | null);
+  const [connected, setConnected] = useState(false);
+  const [count, setCount] = useState(0);
+  const [failed, setFailed] = useState(null as string | null);
+  const history = useHistory();
+  const games = new URLSearchParams(useLocation().search).get("games");
+
+  useEffect(() => {
+    const canvas = canvasRef.current as HTMLCanvasElement;
+    const gl = canvas.getContext("webgl2");
+    if(gl === null) {
+      setFailed("This page needs WebGL 2.");
+      return;
+    }
+    let renderer: WallRenderer;
+    try {
+      renderer = new WallRenderer(gl);
+    } catch(e) {
+      setFailed(`${e}`);
+      return;
+    }
+    rendererRef.current = renderer;
+
+    // games in the order they're drawn, and when finished games finished
+    const shown: Map<number, WallGame> = new Map();
+    const finishedAt: Map<number, number> = new Map();
+    let frame: number | null = null;
+    let needsLayout = true;
+    // the first frame after (re)connecting has every game
+    let resync = false;
+
+    // draw on the next animation frame, once, however many updates arrive before it
+    const redraw = () => {
+      if(frame !== null) return;
+      frame = requestAnimationFrame(() => {
+        frame = null;
+        if(needsLayout) {
+          renderer.layout(Array.from(shown.values()));
+          needsLayout = false;
+        }
+        renderer.draw();
+        setCount(shown.size);
+      });
+    };
+
+    const resize = () => {
+      const top = canvas.getBoundingClientRect().top;
+      const cssHeight = Math.max(window.innerHeight - top - 8, 100);
+      canvas.style.height = `${cssHeight}px`;
+      canvas.width = canvas.clientWidth * window.devicePixelRatio;
+      canvas.height = cssHeight * window.devicePixelRatio;
+      needsLayout = true;
+      redraw();
+    };
+    resize();
+    window.addEventListener("resize", resize);
+
+    const source = new EventSource(GAME_WALL_STREAM(games), { withCredentials: true });
+    source.onopen = () => {
+      setConnected(true);
+      resync = true;
+    };
+    // the browser reconnects on its own
+    source.onerror = () => setConnected(false);
+    source.onmessage = (e) => {
+      if(resync) {
+        shown.clear();
+        finishedAt.clear();
+        needsLayout = true;
+        resync = false;
+      }
+      for(const game of JSON.parse(e.data).games as WallGame[]) {
+        if(!game.active && !finishedAt.has(game.id)) {
+          finishedAt.set(game.id, Date.now());
+        }
+        shown.set(game.id, game);
+        if(!needsLayout && !renderer.update(game)) {
+          needsLayout = true;
+        }
+      }
+      redraw();
+    };
+
+    const prune = setInterval(() => {
+      const now = Date.now();
+      finishedAt.forEach((at, id) => {
+        if(now - at > FINISHED_MS) {
+          finishedAt.delete(id);
+          shown.delete(id);
+          needsLayout = true;
+        }
+      });
+      if(needsLayout) redraw();
+    }, 1000);
+
+    return () => {
+      source.close();
+      clearInterval(prune);
+      window.removeEventListener("resize", resize);
+      if(frame !== null) cancelAnimationFrame(frame);
+      rendererRef.current = null;
+    };
+  }, [games]);
+
+  function handleClick(e: React.MouseEvent<HTMLCanvasElement>) {
+    const rect = e.currentTarget.getBoundingClientRect();
+    const renderer = rendererRef.current;
+    const id = renderer === null ? null : renderer.gameAt(e.clientX - rect.left, e.clientY - rect.top);
+    if(id !== null) {
+      history.push(`/game/${id}`);
+    }
+  }
+
+  if(failed !== null) {
+    return <p style={{textAlign: "center"}}>{failed}</p>;
+  }
+
+  return (
+    <div className="wallContainer">
+      <div className="gameTitle">
+        Wall
+        <span className="gameId">
+          {connected ? `${count} games` : "disconnected"}
+        </span>
+      </div>
+      <canvas ref={canvasRef} className="wallCanvas" onClick={handleClick}></canvas>
+    </div>
+  );
+}
@@ -9,6 +9,10 @@ export const GAME_INDEX = `${API_ROUTE}/game/index`;
 export const GAME_NEW = `${API_ROUTE}/game/new`;
 export const PAGE_EDIT = `${API_ROUTE}/pages/edit`;
 export const PAGE_NEW = `${API_ROUTE}/pages/new`;
+export const ADMIN_METRICS_STREAM = `${API_ROUTE}/admin/metrics/stream`;
+export function GAME_INDEX_PAGE(limit: number, before?: number) {
+  return before === undefined ? `${GAME_INDEX}?limit=${limit}` : `${GAME_INDEX}?limit=${limit}&before=${before}`;
+}
 export function GET_GAME(id: number) {
   return `${API_ROUTE}/game/${id}`;
 }
@@ -24,6 +28,9 @@ export function GAME_START(id: number) {
 export function GAME_MOVE(id: number) {
   return `${API_ROUTE}/game/${id}/move`;
 }
+export function GAME_WALL_STREAM(games: string | null) {
+  return games === null ? `${API_ROUTE}/game/wall` : `${API_ROUTE}/game/wall?games=${encodeURIComponent(games)}`;
+}
 export function PAGE_GET(path: string) {
   return `${API_ROUTE}/pages/${path}`;
 }
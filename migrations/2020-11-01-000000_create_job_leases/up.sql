@@ -0,0 +1,4 @@
+CREATE TABLE job_leases (
+    name TEXT PRIMARY KEY,
+    token BIGINT NOT NULL
+)
\ No newline at end of file
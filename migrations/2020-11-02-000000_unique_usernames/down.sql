@@ -0,0 +1 @@
+DROP INDEX users_username_key
\ No newline at end of file
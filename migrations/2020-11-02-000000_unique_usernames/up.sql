@@ -0,0 +1 @@
+CREATE UNIQUE INDEX users_username_key ON users (username)
\ No newline at end of file
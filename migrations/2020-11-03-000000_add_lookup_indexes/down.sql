@@ -0,0 +1,3 @@
+DROP INDEX db_games_active_idx;
+DROP INDEX pages_url_idx;
+DROP INDEX users_api_key_hash_idx
\ No newline at end of file
@@ -0,0 +1,3 @@
+CREATE INDEX users_api_key_hash_idx ON users (api_key_hash);
+CREATE INDEX pages_url_idx ON pages (url);
+CREATE INDEX db_games_active_idx ON db_games (id) WHERE active = 1
\ No newline at end of file
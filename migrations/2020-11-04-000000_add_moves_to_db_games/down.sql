@@ -0,0 +1 @@
+ALTER TABLE db_games DROP COLUMN moves
\ No newline at end of file
@@ -0,0 +1 @@
+ALTER TABLE db_games ADD COLUMN moves BYTEA NOT NULL DEFAULT ''
\ No newline at end of file
@@ -0,0 +1 @@
+DROP INDEX db_games_public_idx
\ No newline at end of file
@@ -0,0 +1 @@
+CREATE INDEX db_games_public_idx ON db_games (id) WHERE is_public
\ No newline at end of file
@@ -0,0 +1,204 @@
+use crate::ring::Ring;
+use rocket::fairing::{Fairing, Info, Kind};
+use rocket::response::Body;
+use rocket::{Data, Request, Response};
+use serde::Serialize;
+use std::fs::{self, File, OpenOptions};
+use std::io::{self, BufWriter, Write};
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::Arc;
+use std::time::{Duration, Instant, SystemTime, UNIX_EPOCH};
+use std::{env, thread};
+
+const RING_CAPACITY: usize = 1 << 16;
+const DEFAULT_MAX_BYTES: u64 = 64 * 1024 * 1024;
+const DEFAULT_MAX_FILES: u32 = 5;
+/// how long the writer sleeps when there is nothing to write
+const IDLE_SLEEP: Duration = Duration::from_millis(20);
+
+/// A single access log entry. Fixed size, so it can be queued without allocating
+#[derive(Serialize, Clone, Copy, Default, Debug)]
+pub struct Record {
+    pub ts_ms: u64,
+    pub method: &'static str,
+    pub route: &'static str,
+    pub status: u16,
+    pub latency_us: u64,
+    pub user_id: Option<i32>,
+    pub game_id: Option<i32>,
+    pub bytes: u64,
+}
+
+/// Time a request was received, stored in the request's local cache
+pub struct RequestStart(pub Instant);
+
+/// User that authenticated a request, stored in the request's local cache by the user guards
+pub struct RequestUser(pub Option<i32>);
+
+/// get the game id from a /api/game/<id>/... path
+pub fn game_id_from_path(path: &str) -> Option<i32> {
+    let mut segments = path.split('/').filter(|s| !s.is_empty());
+    match (segments.next(), segments.next()) {
+        (Some("api"), Some("game")) => segments.next().and_then(|s| s.parse::<i32>().ok()),
+        _ => None,
+    }
+}
+
+/// A fairing that records each request into a lock-free ring buffer, which a background
+/// thread writes out as newline delimited json. If the buffer is full, records are dropped
+/// (and counted) instead of blocking the request.
+pub struct AccessLog {
+    ring: Arc<Ring<Record>>,
+    dropped: Arc<AtomicU64>,
+}
+
+impl AccessLog {
+    /// start the access log writing to path (if ACCESS_LOG_PATH is set)
+    pub fn from_env() -> Option<AccessLog> {
+        let path = env::var("ACCESS_LOG_PATH").ok()?;
+        let max_bytes = env::var("ACCESS_LOG_MAX_BYTES")
+            .ok()
+            .and_then(|s| s.parse::<u64>().ok())
+            .unwrap_or(DEFAULT_MAX_BYTES);
+        let max_files = env::var("ACCESS_LOG_FILES")
+            .ok()
+            .and_then(|s| s.parse::<u32>().ok())
+            .unwrap_or(DEFAULT_MAX_FILES);
+
+        let log = AccessLog {
+            ring: Arc::new(Ring::new(RING_CAPACITY)),
+            dropped: Arc::new(AtomicU64::new(0)),
+        };
+        let mut writer =
+            LogWriter::open(path, max_bytes, max_files).expect("couldn't open ACCESS_LOG_PATH");
+        let ring = log.ring.clone();
+        let dropped = log.dropped.clone();
+        thread::spawn(move || writer.run(&ring, &dropped));
+
+        Some(log)
+    }
+}
+
+impl Fairing for AccessLog {
+    fn info(&self) -> Info {
+        Info {
+            name: "Access Log",
+            kind: Kind::Request | Kind::Response,
+        }
+    }
+
+    fn on_request(&self, request: &mut Request, _: &Data) {
+        request.local_cache(|| RequestStart(Instant::now()));
+    }
+
+    fn on_response(&self, request: &Request, response: &mut Response) {
+        let latency = request
+            .local_cache(|| RequestStart(Instant::now()))
+            .0
+            .elapsed();
+        let bytes = match response.body() {
+            Some(Body::Sized(_, size)) => size,
+            _ => 0,
+        };
+        let record = Record {
+            ts_ms: SystemTime::now()
+                .duration_since(UNIX_EPOCH)
+                .map_or(0, |d| d.as_millis() as u64),
+            method: request.method().as_str(),
+            route: request.route().and_then(|r| r.name).unwrap_or(""),
+            status: response.status().code,
+            latency_us: latency.as_micros() as u64,
+            user_id: request.local_cache(|| RequestUser(None)).0,
+            game_id: game_id_from_path(request.uri().path()),
+            bytes,
+        };
+
+        if !self.ring.push(record) {
+            self.dropped.fetch_add(1, Ordering::Relaxed);
+        }
+    }
+}
+
+/// Writes records to a file, rotating it once it grows past max_bytes
+struct LogWriter {
+    path: String,
+    out: BufWriter<File>,
+    written: u64,
+    max_bytes: u64,
+    max_files: u32,
+}
+
+impl LogWriter {
+    fn open(path: String, max_bytes: u64, max_files: u32) -> io::Result<LogWriter> {
+        let file = OpenOptions::new().create(true).append(true).open(&path)?;
+        let written = file.metadata()?.len();
+        Ok(LogWriter {
+            path,
+            out: BufWriter::new(file),
+            written,
+            max_bytes,
+            max_files,
+        })
+    }
+
+    /// move path to path.1, path.1 to path.2, etc, and start a new file at path
+    fn rotate(&mut self) -> io::Result<()> {
+        self.out.flush()?;
+        for i in (1..self.max_files).rev() {
+            let _ = fs::rename(
+                format!("{}.{}", self.path, i),
+                format!("{}.{}", self.path, i + 1),
+            );
+        }
+        fs::rename(&self.path, format!("{}.1", self.path))?;
+        let file = OpenOptions::new()
+            .create(true)
+            .append(true)
+            .open(&self.path)?;
+        self.out = BufWriter::new(file);
+        self.written = 0;
+        Ok(())
+    }
+
+    fn write_line<T: Serialize>(&mut self, value: &T) -> io::Result<()> {
+        let line = serde_json::to_vec(value)?;
+        self.out.write_all(&line)?;
+        self.out.write_all(b"\n")?;
+        self.written += line.len() as u64 + 1;
+        if self.written >= self.max_bytes {
+            self.rotate()?;
+        }
+        Ok(())
+    }
+
+    fn run(&mut self, ring: &Ring<Record>, dropped: &AtomicU64) {
+        let mut reported_dropped = 0;
+        loop {
+            let mut wrote = false;
+            while let Some(record) = ring.pop() {
+                if let Err(e) = self.write_line(&record) {
+                    eprintln!("error writing access log: {}", e);
+                }
+                wrote = true;
+            }
+
+            let total_dropped = dropped.load(Ordering::Relaxed);
+            if total_dropped != reported_dropped {
+                #[derive(Serialize)]
+                struct Dropped {
+                    dropped: u64,
+                }
+                let _ = self.write_line(&Dropped {
+                    dropped: total_dropped - reported_dropped,
+                });
+                reported_dropped = total_dropped;
+                wrote = true;
+            }
+
+            if !wrote {
+                let _ = self.out.flush();
+                thread::sleep(IDLE_SLEEP);
+            }
+        }
+    }
+}
@@ -0,0 +1,291 @@
+//! Admission control: when the server is overloaded, shed low priority requests first so moves
+//! stay fast.
+//!
+//! Routes are split into priority tiers. A request is turned away (503 with Retry-After) if
+//! - too many requests are in flight for its tier. Each tier may only fill part of Rocket's
+//!   workers, so there are always workers left for moves. Workers held by open streams aren't
+//!   counted as free
+//! - requests have been too slow for too long. Like CoDel, the signal is the smallest latency of
+//!   any request finishing in an interval: a burst can make some requests slow, but if even the
+//!   fastest request was over the target the whole interval, requests are queueing. Each such
+//!   interval sheds one more tier (and the next interval is shorter, so shedding ramps up quickly
+//!   if it isn't helping), and each interval under the target sheds one less.
+//!
+//! Latency is measured from when a worker starts on the request (fairings run on the worker), so
+//! it doesn't include time spent waiting for a free worker. It rises when handlers slow down (eg
+//! -- waiting on the database or the game manager lock). Waiting for workers is what the in
+//! flight limits guard against.
+//!
+//! Critical requests (moves and move checks) are never shed. Streams are long lived and aren't
+//! admission controlled, but are capped on their own (see broadcast::StreamSlot).
+
+use crate::broadcast;
+use crate::shared::{Error, ErrorResp};
+use rocket::fairing::{Fairing, Info, Kind};
+use rocket::http::uri::Origin;
+use rocket::http::{Method, Status};
+use rocket::response::{self, Responder};
+use rocket::{Data, Request, Response, Rocket};
+use rocket_contrib::json::Json;
+use std::env;
+use std::sync::atomic::{AtomicU64, AtomicU8, AtomicUsize, Ordering};
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+
+const DEFAULT_TARGET_MS: u64 = 50;
+const DEFAULT_INTERVAL_MS: u64 = 500;
+/// most tiers that can be shed (all but Critical)
+const MAX_LEVEL: u8 = 2;
+
+/// Priority of a request, most important first
+#[derive(Clone, Copy, PartialEq, Eq, Debug)]
+pub enum Tier {
+    /// moves and checking whether a move is needed
+    Critical = 0,
+    /// the rest of the api
+    Normal = 1,
+    /// pages, the game index, simulations, bulk admin work and frontend files
+    Low = 2,
+}
+
+impl Tier {
+    /// share of the workers this tier can fill, in quarters
+    fn worker_quarters(self) -> usize {
+        match self {
+            Tier::Critical => 4,
+            Tier::Normal => 3,
+            Tier::Low => 2,
+        }
+    }
+
+    fn retry_after_secs(self) -> u32 {
+        match self {
+            Tier::Critical | Tier::Normal => 1,
+            Tier::Low => 5,
+        }
+    }
+}
+
+/// tier of a request, or None if it isn't admission controlled
+fn classify(method: Method, path: &str) -> Option<Tier> {
+    let mut segments = [""; 4];
+    for (slot, segment) in segments
+        .iter_mut()
+        .zip(path.split('/').filter(|s| !s.is_empty()))
+    {
+        *slot = segment;
+    }
+    match (method, segments) {
+        (Method::Options, _) => None,
+        (_, ["api", "game", _, "watch"])
+        | (_, ["api", "game", "wall", _])
+        | (_, ["api", "admin", "metrics", _]) => None,
+        (Method::Post, ["api", "game", _, "move"])
+        | (Method::Post, ["api", "game", _, "premoves"])
+        | (Method::Get, ["api", "game", _, "move_needed"]) => Some(Tier::Critical),
+        (_, ["api", "game", "index", _])
+        | (_, ["api", "pages", _, _])
+        | (_, ["api", "tournament", _, _])
+        | (_, ["api", "admin", "users", _]) => Some(Tier::Low),
+        (_, ["api", _, _, _]) => Some(Tier::Normal),
+        _ => Some(Tier::Low),
+    }
+}
+
+/// An admitted request, stored in the request's local cache. It counts as in flight until the
+/// request is dropped (even if the handler panics)
+struct Admitted(Option<InFlight>);
+
+struct InFlight {
+    state: Arc<State>,
+    start: Instant,
+}
+
+impl Drop for InFlight {
+    fn drop(&mut self) {
+        self.state.in_flight.fetch_sub(1, Ordering::Relaxed);
+    }
+}
+
+struct State {
+    started: Instant,
+    target_us: u64,
+    interval_us: u64,
+    workers: AtomicUsize,
+    /// admitted requests that haven't finished
+    in_flight: AtomicUsize,
+    /// number of tiers being shed, from the lowest up
+    level: AtomicU8,
+    /// intervals in a row that were over target
+    over: AtomicU64,
+    /// end of the current interval, in us since started. u64::MAX while a thread is ending it
+    interval_end: AtomicU64,
+    /// smallest latency of a request that finished this interval
+    min_latency_us: AtomicU64,
+}
+
+impl State {
+    fn now_us(&self) -> u64 {
+        self.started.elapsed().as_micros() as u64
+    }
+
+    fn admit(&self, tier: Tier) -> bool {
+        if tier as u8 + self.level.load(Ordering::Relaxed) > MAX_LEVEL {
+            return false;
+        }
+        let in_flight = self.in_flight.load(Ordering::Relaxed);
+        // each open stream holds a worker until it ends
+        let workers = self
+            .workers
+            .load(Ordering::Relaxed)
+            .saturating_sub(broadcast::open_streams());
+        tier == Tier::Critical || in_flight * 4 < workers * tier.worker_quarters()
+    }
+
+    /// end the interval if it is over, and shed more or fewer tiers
+    fn maybe_end_interval(&self) {
+        let now = self.now_us();
+        let end = self.interval_end.load(Ordering::Relaxed);
+        if now < end
+            || self
+                .interval_end
+                .compare_exchange(end, u64::MAX, Ordering::AcqRel, Ordering::Relaxed)
+                .is_err()
+        {
+            return;
+        }
+
+        let min_latency_us = self.min_latency_us.swap(u64::MAX, Ordering::Relaxed);
+        let level = self.level.load(Ordering::Relaxed);
+        // with no requests finishing, nothing is queueing behind them
+        let (level, over) = if min_latency_us != u64::MAX && min_latency_us > self.target_us {
+            (
+                (level + 1).min(MAX_LEVEL),
+                self.over.fetch_add(1, Ordering::Relaxed) + 1,
+            )
+        } else {
+            self.over.store(0, Ordering::Relaxed);
+            (level.saturating_sub(1), 0)
+        };
+        let old_level = self.level.swap(level, Ordering::Relaxed);
+        if level != old_level {
+            let fastest = match min_latency_us {
+                u64::MAX => "no requests".to_string(),
+                us => format!("fastest request {}ms", us / 1000),
+            };
+            eprintln!(
+                "admission control: shedding {} tier(s) ({}, target {}ms)",
+                level,
+                fastest,
+                self.target_us / 1000
+            );
+        }
+
+        // CoDel's control law: the longer it's been over target, the sooner to act again
+        let next = self.interval_us as f64 / (over.max(1) as f64).sqrt();
+        self.interval_end
+            .store(now + next as u64, Ordering::Release);
+    }
+}
+
+/// A fairing that sheds low priority requests when the server is overloaded
+pub struct Admission {
+    state: Arc<State>,
+}
+
+impl Admission {
+    /// create an admission controller, with the latency target (ADMISSION_TARGET_MS) and
+    /// interval (ADMISSION_INTERVAL_MS) from the environment. Setting ADMISSION_TARGET_MS to 0
+    /// turns admission control off
+    pub fn from_env() -> Option<Admission> {
+        let ms = |var: &str, default: u64| {
+            env::var(var)
+                .ok()
+                .and_then(|s| s.parse::<u64>().ok())
+                .unwrap_or(default)
+        };
+        let target = Duration::from_millis(ms("ADMISSION_TARGET_MS", DEFAULT_TARGET_MS));
+        let interval = Duration::from_millis(ms("ADMISSION_INTERVAL_MS", DEFAULT_INTERVAL_MS));
+        if target == Duration::from_millis(0) {
+            return None;
+        }
+
+        Some(Admission {
+            state: Arc::new(State {
+                started: Instant::now(),
+                target_us: target.as_micros() as u64,
+                interval_us: interval.as_micros().max(1) as u64,
+                workers: AtomicUsize::new(0),
+                in_flight: AtomicUsize::new(0),
+                level: AtomicU8::new(0),
+                over: AtomicU64::new(0),
+                interval_end: AtomicU64::new(interval.as_micros() as u64),
+                min_latency_us: AtomicU64::new(u64::MAX),
+            }),
+        })
+    }
+}
+
+impl Fairing for Admission {
+    fn info(&self) -> Info {
+        Info {
+            name: "Admission Control",
+            kind: Kind::Attach | Kind::Request | Kind::Response,
+        }
+    }
+
+    fn on_attach(&self, rocket: Rocket) -> Result<Rocket, Rocket> {
+        let workers = rocket.config().workers as usize;
+        self.state.workers.store(workers, Ordering::Relaxed);
+        Ok(rocket.mount("/api", routes![overloaded]))
+    }
+
+    fn on_request(&self, request: &mut Request, _: &Data) {
+        let tier = match classify(request.method(), request.uri().path()) {
+            Some(tier) => tier,
+            None => return,
+        };
+        if self.state.admit(tier) {
+            self.state.in_flight.fetch_add(1, Ordering::Relaxed);
+            request.local_cache(|| {
+                Admitted(Some(InFlight {
+                    state: self.state.clone(),
+                    start: Instant::now(),
+                }))
+            });
+        } else {
+            // send the request to the overloaded route instead
+            let uri = format!("/api/overloaded?retry_after={}", tier.retry_after_secs());
+            request.set_method(Method::Get);
+            request.set_uri(Origin::parse_owned(uri).unwrap());
+        }
+    }
+
+    fn on_response(&self, request: &Request, _: &mut Response) {
+        if let Some(in_flight) = &request.local_cache(|| Admitted(None)).0 {
+            let latency_us = in_flight.start.elapsed().as_micros() as u64;
+            self.state
+                .min_latency_us
+                .fetch_min(latency_us, Ordering::Relaxed);
+        }
+        self.state.maybe_end_interval();
+    }
+}
+
+/// A 503 response telling the client when to retry
+pub struct Overloaded(pub u32);
+
+impl<'r> Responder<'r> for Overloaded {
+    fn respond_to(self, request: &Request) -> response::Result<'r> {
+        Response::build_from(Json(ErrorResp::from(Error::Overloaded)).respond_to(request)?)
+            .status(Status::ServiceUnavailable)
+            .raw_header("Retry-After", self.0.to_string())
+            .ok()
+    }
+}
+
+/// where shed requests are sent
+#[get("/overloaded?<retry_after>")]
+pub fn overloaded(retry_after: Option<u32>) -> Overloaded {
+    Overloaded(retry_after.unwrap_or(1))
+}
@@ -0,0 +1,71 @@
+//! Measure how game manager throughput scales with threads, with games kept in memory.
+//!
+//! usage: contention [--games N] [--secs S] [--threads 1,2,4,...] [--mix get:save:join:move]
+
+use codekata::contention::{self, ContentionConfig, Mix};
+use std::env;
+use std::process;
+use std::time::Duration;
+
+fn usage() -> ! {
+    eprintln!(
+        "usage: contention [--games N] [--secs S] [--threads 1,2,4,...] [--mix get:save:join:move]"
+    );
+    process::exit(2);
+}
+
+fn parse_list<T: std::str::FromStr>(s: &str, sep: char) -> Vec<T> {
+    s.split(sep)
+        .map(|n| n.parse::<T>().unwrap_or_else(|_| usage()))
+        .collect()
+}
+
+fn main() {
+    let mut config = ContentionConfig::default();
+    let args = env::args().skip(1).collect::<Vec<_>>();
+    for pair in args.chunks(2) {
+        let value = pair.get(1).unwrap_or_else(|| usage());
+        match pair[0].as_str() {
+            "--games" => config.games = value.parse().unwrap_or_else(|_| usage()),
+            "--secs" => {
+                config.duration = Duration::from_secs_f64(value.parse().unwrap_or_else(|_| usage()))
+            }
+            "--threads" => config.threads = parse_list(value, ','),
+            "--mix" => match parse_list::<u32>(value, ':')[..] {
+                [get, save, join, moves] => {
+                    config.mix = Mix {
+                        get,
+                        save,
+                        join,
+                        moves,
+                    }
+                }
+                _ => usage(),
+            },
+            _ => usage(),
+        }
+    }
+
+    println!(
+        "{} games, {:?} per run, mix {:?}",
+        config.games, config.duration, config.mix
+    );
+    println!(
+        "{:>7} {:>12} {:>8} {:>10} {:>9} {:>9}",
+        "threads", "ops/s", "speedup", "efficiency", "mean us", "rejected"
+    );
+    let mut base = None;
+    for point in contention::run(&config) {
+        let per_thread = point.ops_per_sec() / point.threads as f64;
+        let base = *base.get_or_insert(per_thread);
+        println!(
+            "{:>7} {:>12.0} {:>7.2}x {:>9.0}% {:>9.2} {:>9}",
+            point.threads,
+            point.ops_per_sec(),
+            point.ops_per_sec() / base,
+            100.0 * per_thread / base,
+            point.mean_op_us(),
+            point.ops.rejected
+        );
+    }
+}
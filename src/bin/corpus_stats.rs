@@ -0,0 +1,111 @@
+//! Read every game in a corpus, and print a summary of the games and how long reading them took.
+//!
+//! usage: corpus_stats <path>
+
+use codekata::corpus::{Corpus, Outcome};
+use codekata::game::{BinaryMove, Game};
+use codekata::GameType;
+use std::collections::HashMap;
+use std::env;
+use std::process;
+use std::time::Instant;
+
+type Move = <GameType as Game>::Move;
+
+/// openings are the positions after this many moves
+const OPENING_MOVES: usize = 4;
+
+fn main() {
+    let path = match env::args().nth(1) {
+        Some(path) => path,
+        None => {
+            eprintln!("usage: corpus_stats <path>");
+            process::exit(2);
+        }
+    };
+    let corpus = Corpus::open(&path).unwrap_or_else(|e| {
+        eprintln!("couldn't open {}: {}", path, e);
+        process::exit(1);
+    });
+    if corpus.move_len() != <Move as BinaryMove>::ENCODED_LEN {
+        eprintln!(
+            "corpus has {} byte moves, expected {}",
+            corpus.move_len(),
+            <Move as BinaryMove>::ENCODED_LEN
+        );
+        process::exit(1);
+    }
+
+    let start = Instant::now();
+    let mut moves = 0;
+    let mut invalid = 0;
+    let mut longest = 0;
+    let mut wins = [0; 2];
+    let mut ties = 0;
+    for game in corpus.iter() {
+        for m in game.decode_moves::<Move>() {
+            match m {
+                Some(_) => moves += 1,
+                None => invalid += 1,
+            }
+        }
+        longest = longest.max(game.num_moves());
+        match game.outcome() {
+            Outcome::Win(player) if (player as usize) < wins.len() => wins[player as usize] += 1,
+            Outcome::Tie => ties += 1,
+            _ => (),
+        }
+    }
+    let elapsed = start.elapsed();
+
+    // count openings up to symmetry, so mirrored and rotated openings are the same opening
+    let mut openings = HashMap::new();
+    for game in corpus.iter() {
+        if game.num_moves() < OPENING_MOVES || !GameType::check_num_players(game.num_players()) {
+            continue;
+        }
+        let mut position = GameType::new_with_players(game.num_players());
+        let players = game.num_players() as u32;
+        let legal = game.decode_moves::<Move>().take(OPENING_MOVES).all(|m| {
+            let player = (0..players).find(|p| position.waiting_on(*p));
+            match (m, player) {
+                (Some(m), Some(player)) => position.make_move(player, &m),
+                _ => false,
+            }
+        });
+        if legal {
+            *openings.entry(position.canonical_hash()).or_insert(0) += 1;
+        }
+    }
+    let mut common = openings.values().copied().collect::<Vec<u64>>();
+    common.sort_unstable_by(|a, b| b.cmp(a));
+
+    println!(
+        "{} games, {} moves ({} invalid)",
+        corpus.len(),
+        moves,
+        invalid
+    );
+    if !corpus.is_empty() {
+        println!(
+            "{:.1} moves per game, longest {}",
+            moves as f64 / corpus.len() as f64,
+            longest
+        );
+    }
+    println!(
+        "first player won {}, second player won {}, {} ties",
+        wins[0], wins[1], ties
+    );
+    println!(
+        "{} distinct openings after {} moves (up to symmetry), most common played {:?} times",
+        openings.len(),
+        OPENING_MOVES,
+        &common[..common.len().min(5)]
+    );
+    println!(
+        "read in {:.1?} ({:.0} games/s)",
+        elapsed,
+        corpus.len() as f64 / elapsed.as_secs_f64()
+    );
+}
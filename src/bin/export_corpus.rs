@@ -0,0 +1,52 @@
+//! Export finished games from the database at DATABASE_URL to a game corpus (see src/corpus.rs).
+//! If the corpus already exists, only games that aren't in it yet are added.
+//!
+//! usage: export_corpus <path>
+
+use codekata::corpus::{self, CorpusWriter};
+use codekata::game::{BinaryMove, Game};
+use codekata::{run_migrations, GameType};
+use std::env;
+use std::path::Path;
+use std::process;
+use std::time::Instant;
+
+fn main() {
+    let path = match env::args().nth(1) {
+        Some(path) => path,
+        None => {
+            eprintln!("usage: export_corpus <path>");
+            process::exit(2);
+        }
+    };
+
+    let writer = if Path::new(&path).exists() {
+        CorpusWriter::open_append(&path)
+    } else {
+        CorpusWriter::create(&path, <<GameType as Game>::Move as BinaryMove>::ENCODED_LEN)
+    };
+    let mut writer = writer.unwrap_or_else(|e| {
+        eprintln!("couldn't open {}: {}", path, e);
+        process::exit(1);
+    });
+
+    let conn = run_migrations::open_db();
+    let start = Instant::now();
+    let added = corpus::export::<GameType>(&conn, &mut writer).and_then(|added| {
+        let total = writer.len();
+        writer.finish()?;
+        Ok((added, total))
+    });
+    match added {
+        Ok((added, total)) => println!(
+            "added {} games in {:.1?} ({} in corpus)",
+            added,
+            start.elapsed(),
+            total
+        ),
+        Err(e) => {
+            eprintln!("export failed: {}", e);
+            process::exit(1);
+        }
+    }
+}
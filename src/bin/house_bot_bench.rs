@@ -0,0 +1,84 @@
+//! Measure how many moves per second the house bot's engine chooses, one position at a time and
+//! in batches of every position it is on move in.
+//!
+//! usage: house_bot_bench [--games N] [--rounds N]
+
+use codekata::game::{BatchMoves, Game};
+use codekata::tournament_sim::Rng;
+use codekata::GameType;
+use std::env;
+use std::process;
+use std::time::Instant;
+
+fn usage() -> ! {
+    eprintln!("usage: house_bot_bench [--games N] [--rounds N]");
+    process::exit(2);
+}
+
+/// a game partway through, with random moves played
+fn random_position(rng: &mut Rng) -> (GameType, u32) {
+    let mut game = GameType::new_with_players(2);
+    let mut legal = Vec::new();
+    let mut player = 0;
+    for _ in 0..rng.range(0, 60) {
+        game.legal_moves(player, &mut legal);
+        if legal.is_empty() {
+            break;
+        }
+        let m = legal[rng.range(0, legal.len() as u32 - 1) as usize].clone();
+        game.make_move(player, &m);
+        player = 1 - player;
+    }
+    if game.finished() {
+        return random_position(rng);
+    }
+    (game, player)
+}
+
+fn main() {
+    let mut games = 500;
+    let mut rounds = 20;
+    let args = env::args().skip(1).collect::<Vec<_>>();
+    for pair in args.chunks(2) {
+        let value = pair
+            .get(1)
+            .and_then(|v| v.parse::<usize>().ok())
+            .unwrap_or_else(|| usage());
+        match pair[0].as_str() {
+            "--games" => games = value.max(1),
+            "--rounds" => rounds = value.max(1),
+            _ => usage(),
+        }
+    }
+
+    let mut rng = Rng::new(1);
+    let positions = (0..games)
+        .map(|_| random_position(&mut rng))
+        .collect::<Vec<_>>();
+    let positions = positions
+        .iter()
+        .map(|(game, player)| (game, *player))
+        .collect::<Vec<_>>();
+
+    let start = Instant::now();
+    for _ in 0..rounds {
+        for position in &positions {
+            GameType::choose_moves(std::slice::from_ref(position));
+        }
+    }
+    let single = (games * rounds) as f64 / start.elapsed().as_secs_f64();
+
+    let start = Instant::now();
+    for _ in 0..rounds {
+        GameType::choose_moves(&positions);
+    }
+    let batched = (games * rounds) as f64 / start.elapsed().as_secs_f64();
+
+    println!("{} games", games);
+    println!("one at a time: {:>10.0} moves/s", single);
+    println!(
+        "batched:       {:>10.0} moves/s ({:.1}x)",
+        batched,
+        batched / single
+    );
+}
@@ -0,0 +1,94 @@
+//! Measure the speed of the othello engine's move generation: perft (counting every position a
+//! number of moves deep, by making and undoing each legal move) and playing random games to the
+//! end, the way the server validates submitted moves.
+//!
+//! usage: othello_bench [--depth N] [--games N]
+
+use codekata::game::Game;
+use codekata::othello::{Move, Othello};
+use codekata::tournament_sim::Rng;
+use std::env;
+use std::process;
+use std::time::Instant;
+
+fn usage() -> ! {
+    eprintln!("usage: othello_bench [--depth N] [--games N]");
+    process::exit(2);
+}
+
+fn player_on_move(game: &Othello) -> u32 {
+    if game.waiting_on(0) {
+        0
+    } else {
+        1
+    }
+}
+
+/// count the positions depth moves from game, and the moves made to reach them. buffers has a
+/// move list for each depth, so nothing is allocated while searching
+fn perft(game: &mut Othello, depth: usize, buffers: &mut [Vec<Move>]) -> (u64, u64) {
+    if depth == 0 || game.finished() {
+        return (1, 0);
+    }
+    let player = player_on_move(game);
+    let (moves, rest) = buffers.split_first_mut().unwrap();
+    game.legal_moves(player, moves);
+    let (mut positions, mut made) = (0, 0);
+    for m in moves.iter() {
+        game.make_move(player, m);
+        let (p, n) = perft(game, depth - 1, rest);
+        game.undo_move(player, m);
+        positions += p;
+        made += n + 1;
+    }
+    (positions, made)
+}
+
+fn main() {
+    let mut depth = 9;
+    let mut games = 100_000;
+    let args = env::args().skip(1).collect::<Vec<_>>();
+    for pair in args.chunks(2) {
+        let value = pair
+            .get(1)
+            .and_then(|v| v.parse::<usize>().ok())
+            .unwrap_or_else(|| usage());
+        match pair[0].as_str() {
+            "--depth" => depth = value,
+            "--games" => games = value,
+            _ => usage(),
+        }
+    }
+
+    let mut buffers = vec![Vec::new(); depth];
+    let start = Instant::now();
+    let (positions, made) = perft(&mut Othello::new_with_players(2), depth, &mut buffers);
+    let elapsed = start.elapsed().as_secs_f64();
+    println!(
+        "perft {}: {} positions, {:.1}M moves/s (make + undo)",
+        depth,
+        positions,
+        made as f64 / elapsed / 1e6
+    );
+
+    let mut rng = Rng::new(1);
+    let mut legal = Vec::new();
+    let mut made = 0;
+    let start = Instant::now();
+    for _ in 0..games {
+        let mut game = Othello::new_with_players(2);
+        while !game.finished() {
+            let player = player_on_move(&game);
+            game.legal_moves(player, &mut legal);
+            let m = legal[rng.range(0, legal.len() as u32 - 1) as usize];
+            game.make_move(player, &m);
+            made += 1;
+        }
+    }
+    let elapsed = start.elapsed().as_secs_f64();
+    println!(
+        "{} random games: {:.1}M moves/s (legal moves + make)",
+        games,
+        made as f64 / elapsed / 1e6
+    );
+}
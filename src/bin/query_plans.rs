@@ -0,0 +1,59 @@
+//! Check the plans and timing of every query the app issues against the database at DATABASE_URL.
+//! Run seed_fixtures first, so the tables are big enough for the plans to mean something.
+//!
+//! usage: query_plans [--verbose]
+//! exits with status 1 if any query fails its check
+
+use codekata::query_plans;
+use codekata::run_migrations;
+use std::env;
+use std::process;
+
+fn main() {
+    let verbose = env::args().any(|a| a == "--verbose");
+    let conn = run_migrations::open_db();
+
+    let reports = query_plans::app_queries(&conn)
+        .and_then(|checks| query_plans::check(&conn, &checks))
+        .unwrap_or_else(|e| {
+            eprintln!(
+                "couldn't check query plans (have fixtures been seeded?): {:?}",
+                e
+            );
+            process::exit(1);
+        });
+
+    let mut failed = 0;
+    for report in &reports {
+        let status = if report.problems.is_empty() {
+            "ok"
+        } else {
+            "FAIL"
+        };
+        println!(
+            "{:<4} {:<32} {:>9.2}ms (budget {:.0}ms)",
+            status, report.name, report.execution_ms, report.budget_ms
+        );
+        for problem in &report.problems {
+            println!("       {}", problem);
+        }
+        if verbose || !report.problems.is_empty() {
+            println!(
+                "{}",
+                serde_json::to_string_pretty(&report.plan["Plan"]).unwrap_or_default()
+            );
+        }
+        if !report.problems.is_empty() {
+            failed += 1;
+        }
+    }
+
+    println!(
+        "{} of {} queries passed",
+        reports.len() - failed,
+        reports.len()
+    );
+    if failed > 0 {
+        process::exit(1);
+    }
+}
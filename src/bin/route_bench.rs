@@ -0,0 +1,246 @@
+//! Time route handlers in process, with Rocket's local client, against the database at
+//! ROCKET_DATABASES (seeded with seed_fixtures). Requests go through the real routes, fairings
+//! and guards, but not the network, so changes in handler code show up clearly.
+//!
+//! usage: route_bench [--iterations N] [--routes game_get_user_authd,game_move,...]
+
+use codekata::fixtures::USERNAME_PREFIX;
+use codekata::game::Game;
+use codekata::{game_manage, run_migrations, users, GameType};
+use rocket::http::{ContentType, Cookie, Status};
+use rocket::local::{Client, LocalRequest};
+use std::collections::HashMap;
+use std::env;
+use std::process;
+use std::sync::{Arc, RwLock};
+use std::time::{Duration, Instant};
+
+/// routes that can be benchmarked
+const ROUTES: &[&str] = &[
+    "game_get_user_authd",
+    "game_move_needed",
+    "game_move",
+    "game_index",
+    "session_new",
+];
+/// session_new checks a bcrypt hash, which is slow on purpose, so it gets fewer iterations
+const SESSION_ITERATIONS: usize = 20;
+const WARMUP_ITERATIONS: usize = 5;
+
+fn usage() -> ! {
+    eprintln!("usage: route_bench [--iterations N] [--routes game_get_user_authd,game_move,...]");
+    process::exit(2);
+}
+
+fn fail(msg: String) -> ! {
+    eprintln!("{}", msg);
+    process::exit(1);
+}
+
+/// A fixture user, logged in
+struct Player {
+    username: String,
+    session: Cookie<'static>,
+}
+
+/// A game between two players, and a copy of it to choose moves from
+struct BenchGame {
+    id: String,
+    game: GameType,
+}
+
+struct Bench {
+    client: Client,
+    players: [Player; 2],
+}
+
+/// send req and read the whole response, checking that it succeeded
+fn send(req: LocalRequest) -> String {
+    let mut resp = req.dispatch();
+    let status = resp.status();
+    let body = resp.body_string().unwrap_or_default();
+    if status != Status::Ok || body.contains("\"success\":false") {
+        fail(format!("request failed ({}): {}", status, body));
+    }
+    body
+}
+
+fn login_body(username: &str) -> String {
+    format!("username={}&password=password", username)
+}
+
+impl Bench {
+    fn login(client: &Client, username: String) -> Player {
+        let mut resp = client
+            .post("/api/session/new")
+            .header(ContentType::Form)
+            .body(login_body(&username))
+            .dispatch();
+        let _ = resp.body_string();
+        let session = resp
+            .cookies()
+            .into_iter()
+            .find(|c| c.name() == "session_key")
+            .map(|c| c.into_owned())
+            .unwrap_or_else(|| {
+                fail(format!(
+                    "couldn't log in as {} (has the database been seeded?)",
+                    username
+                ))
+            });
+        Player { username, session }
+    }
+
+    fn as_player<'c>(&'c self, player: usize, req: LocalRequest<'c>) -> LocalRequest<'c> {
+        req.cookie(self.players[player].session.clone())
+    }
+
+    /// create a game between the two players and start it
+    fn new_game(&self) -> BenchGame {
+        let body = send(
+            self.as_player(
+                0,
+                self.client
+                    .post("/api/game/new")
+                    .header(ContentType::Form)
+                    .body("name=route_bench"),
+            ),
+        );
+        let id = serde_json::from_str::<serde_json::Value>(&body)
+            .ok()
+            .and_then(|v| v["id"].as_str().map(|id| id.to_string()))
+            .unwrap_or_else(|| fail(format!("couldn't create a game: {}", body)));
+        for player in 0..2 {
+            send(self.as_player(player, self.client.post(format!("/api/game/{}/join", id))));
+        }
+        send(self.as_player(0, self.client.post(format!("/api/game/{}/start", id))));
+        BenchGame {
+            id,
+            game: GameType::new_with_players(2),
+        }
+    }
+
+    /// the request to make the next move in game. Starts a new game once game is finished
+    fn next_move(&self, game: &mut BenchGame) -> LocalRequest {
+        if game.game.finished() {
+            *game = self.new_game();
+        }
+        let player = if game.game.waiting_on(0) { 0 } else { 1 };
+        let mut legal = Vec::new();
+        game.game.legal_moves(player as u32, &mut legal);
+        // the middle legal move, so games last a while
+        let m = legal[legal.len() / 2].clone();
+        game.game.make_move(player as u32, &m);
+
+        let fields = match serde_json::to_value(&m) {
+            Ok(serde_json::Value::Object(fields)) => fields,
+            _ => fail("moves don't serialize to an object".to_string()),
+        };
+        let body = fields
+            .iter()
+            .map(|(k, v)| format!("{}={}", k, v))
+            .collect::<Vec<_>>()
+            .join("&");
+        let req = self
+            .client
+            .post(format!("/api/game/{}/move", game.id))
+            .header(ContentType::Form)
+            .body(body);
+        self.as_player(player, req)
+    }
+
+    /// time iterations requests to route
+    fn run(&self, route: &str, iterations: usize) -> Vec<Duration> {
+        let mut game = self.new_game();
+        let mut times = Vec::with_capacity(iterations);
+        for i in 0..iterations + WARMUP_ITERATIONS {
+            let req = match route {
+                "game_get_user_authd" => {
+                    self.as_player(0, self.client.get(format!("/api/game/{}", game.id)))
+                }
+                "game_move_needed" => self.as_player(
+                    0,
+                    self.client
+                        .get(format!("/api/game/{}/move_needed", game.id)),
+                ),
+                "game_move" => self.next_move(&mut game),
+                "game_index" => self.client.get("/api/game/index"),
+                "session_new" => self
+                    .client
+                    .post("/api/session/new")
+                    .header(ContentType::Form)
+                    .body(login_body(&self.players[i % 2].username)),
+                _ => usage(),
+            };
+            let start = Instant::now();
+            send(req);
+            if i >= WARMUP_ITERATIONS {
+                times.push(start.elapsed());
+            }
+        }
+        times
+    }
+}
+
+fn percentile_us(sorted: &[Duration], p: f64) -> f64 {
+    let i = ((sorted.len() - 1) as f64 * p).round() as usize;
+    sorted[i].as_secs_f64() * 1e6
+}
+
+fn main() {
+    let mut iterations = 1000;
+    let mut routes = ROUTES.iter().map(|r| r.to_string()).collect::<Vec<_>>();
+    let args = env::args().skip(1).collect::<Vec<_>>();
+    for pair in args.chunks(2) {
+        let value = pair.get(1).unwrap_or_else(|| usage());
+        match pair[0].as_str() {
+            "--iterations" => {
+                iterations = value.parse::<usize>().unwrap_or_else(|_| usage()).max(1)
+            }
+            "--routes" => routes = value.split(',').map(|r| r.to_string()).collect(),
+            _ => usage(),
+        }
+    }
+    if routes.iter().any(|r| !ROUTES.contains(&r.as_str())) {
+        usage();
+    }
+    // logging every request would be most of what's measured
+    if env::var("ROCKET_LOG").is_err() {
+        env::set_var("ROCKET_LOG", "critical");
+    }
+
+    run_migrations::run_migrations();
+    let manager = Arc::new(RwLock::new(game_manage::GameManager::<GameType>::default()));
+    let sessions = Arc::new(RwLock::new(HashMap::<String, users::PlayerId>::new()));
+    let client = Client::untracked(codekata::rocket(manager, sessions))
+        .unwrap_or_else(|e| fail(format!("couldn't build the app: {}", e)));
+    let players = [
+        Bench::login(&client, format!("{}1", USERNAME_PREFIX)),
+        Bench::login(&client, format!("{}2", USERNAME_PREFIX)),
+    ];
+    let bench = Bench { client, players };
+
+    println!(
+        "{:<20} {:>7} {:>10} {:>10} {:>10} {:>10}",
+        "route", "count", "mean us", "p50 us", "p99 us", "min us"
+    );
+    for route in &routes {
+        let n = if route == "session_new" {
+            iterations.min(SESSION_ITERATIONS)
+        } else {
+            iterations
+        };
+        let mut times = bench.run(route, n);
+        times.sort_unstable();
+        let mean = times.iter().sum::<Duration>().as_secs_f64() * 1e6 / times.len() as f64;
+        println!(
+            "{:<20} {:>7} {:>10.1} {:>10.1} {:>10.1} {:>10.1}",
+            route,
+            times.len(),
+            mean,
+            percentile_us(&times, 0.5),
+            percentile_us(&times, 0.99),
+            percentile_us(&times, 0.0)
+        );
+    }
+}
@@ -0,0 +1,44 @@
+//! Seed the database at DATABASE_URL with realistic volumes of data, for checking query plans.
+//!
+//! usage: seed_fixtures [--users N] [--games N] [--tournaments N] [--pages N]
+
+use codekata::fixtures::{self, Volumes};
+use codekata::run_migrations;
+use std::env;
+use std::process;
+use std::time::Instant;
+
+fn main() {
+    let mut volumes = Volumes::default();
+    let args = env::args().skip(1).collect::<Vec<_>>();
+    for pair in args.chunks(2) {
+        let count = match pair.get(1).and_then(|n| n.parse::<i32>().ok()) {
+            Some(n) if n >= 0 => n,
+            _ => {
+                eprintln!(
+                    "usage: seed_fixtures [--users N] [--games N] [--tournaments N] [--pages N]"
+                );
+                process::exit(2);
+            }
+        };
+        match pair[0].as_str() {
+            "--users" => volumes.users = count.max(1),
+            "--games" => volumes.games = count,
+            "--tournaments" => volumes.tournaments = count,
+            "--pages" => volumes.pages = count,
+            other => {
+                eprintln!("unknown option {}", other);
+                process::exit(2);
+            }
+        }
+    }
+
+    run_migrations::run_migrations();
+    let conn = run_migrations::open_db();
+    let start = Instant::now();
+    if let Err(e) = fixtures::seed(&conn, volumes) {
+        eprintln!("seeding failed: {:?}", e);
+        process::exit(1);
+    }
+    println!("seeded {:?} in {:.1?}", volumes, start.elapsed());
+}
@@ -0,0 +1,622 @@
+use crate::admission::Overloaded;
+use crate::shared::{Error, ErrorResp};
+use rocket::http::ContentType;
+use rocket_contrib::json::Json;
+use std::collections::{HashMap, HashSet, VecDeque};
+use std::io::{self, Read};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{Arc, Condvar, Mutex, RwLock};
+use std::thread;
+use std::time::{Duration, Instant};
+
+/// streamed frames are padded to a multiple of this, and streamed in chunks of this size, so
+/// Rocket flushes each frame as soon as it is written
+pub const STREAM_FRAME: usize = 512;
+/// frames kept for each subscription. Subscribers further behind than this skip to the latest frame
+const RING_LEN: usize = 32;
+/// feed subscribers are sent at most one frame this often. Updates in between are coalesced
+const FEED_INTERVAL: Duration = Duration::from_millis(50);
+/// finished games stay in the feed this long, so subscribers see how they ended
+const FEED_FINISHED_TTL: Duration = Duration::from_secs(30);
+/// most subscribers watching a single game
+const MAX_GAME_WATCHERS: usize = 16;
+/// most subscribers to the feed
+const MAX_FEED_SUBSCRIBERS: usize = 16;
+/// a stream with nothing to send sends a heartbeat this often, so a client that has gone away is
+/// noticed (writing to it fails) and its worker is freed
+const HEARTBEAT_INTERVAL: Duration = Duration::from_secs(15);
+/// share of Rocket's workers that open streams can hold, in quarters. Each open stream holds a
+/// worker until it ends, so the rest are always left for requests
+const STREAM_WORKER_QUARTERS: usize = 2;
+
+/// number of Rocket's workers, set when the app is attached
+static WORKERS: AtomicUsize = AtomicUsize::new(0);
+/// streams open on this server
+static OPEN_STREAMS: AtomicUsize = AtomicUsize::new(0);
+
+/// record how many workers Rocket has, which bounds how many streams can be open at once
+pub fn set_workers(workers: usize) {
+    WORKERS.store(workers, Ordering::Relaxed);
+}
+
+/// number of streams open, each of which holds one of Rocket's workers
+pub fn open_streams() -> usize {
+    OPEN_STREAMS.load(Ordering::Relaxed)
+}
+
+/// An open stream, counted against the streams' share of the workers until it's dropped
+pub struct StreamSlot(());
+
+impl StreamSlot {
+    /// take a slot for a new stream, unless streams already hold their share of the workers
+    pub fn acquire() -> Result<StreamSlot, Error> {
+        let max = WORKERS.load(Ordering::Relaxed) * STREAM_WORKER_QUARTERS / 4;
+        OPEN_STREAMS
+            .fetch_update(Ordering::AcqRel, Ordering::Relaxed, |open| {
+                if open < max {
+                    Some(open + 1)
+                } else {
+                    None
+                }
+            })
+            .map(|_| StreamSlot(()))
+            .map_err(|_| Error::Overloaded)
+    }
+}
+
+impl Drop for StreamSlot {
+    fn drop(&mut self) {
+        OPEN_STREAMS.fetch_sub(1, Ordering::AcqRel);
+    }
+}
+
+/// Why a stream didn't start: there's no room for it (503 with Retry-After), or the request failed
+#[derive(Responder)]
+pub enum StreamError {
+    Busy(Overloaded),
+    Failed(Json<ErrorResp>),
+}
+
+impl From<Error> for StreamError {
+    fn from(e: Error) -> StreamError {
+        match e {
+            Error::Overloaded => StreamError::Busy(Overloaded(1)),
+            e => StreamError::Failed(Json(ErrorResp::from(e))),
+        }
+    }
+}
+
+/// An encoded frame, shared between every subscriber that reads it
+pub type Frame = Arc<[u8]>;
+
+#[derive(PartialEq, Eq, Hash, Clone, Copy, Debug)]
+pub enum Format {
+    /// server sent events
+    Sse,
+    /// newline delimited json
+    Ndjson,
+}
+
+impl Format {
+    pub fn from_param(format: Option<&str>) -> Option<Format> {
+        match format {
+            None | Some("sse") => Some(Format::Sse),
+            Some("ndjson") => Some(Format::Ndjson),
+            _ => None,
+        }
+    }
+
+    pub fn content_type(&self) -> ContentType {
+        match self {
+            Format::Sse => ContentType::new("text", "event-stream"),
+            Format::Ndjson => ContentType::new("application", "x-ndjson"),
+        }
+    }
+}
+
+/// wrap json in a frame of the given format, padded to a multiple of STREAM_FRAME
+pub fn frame(format: Format, json: &[u8]) -> Vec<u8> {
+    let mut buf = Vec::with_capacity(json.len() + STREAM_FRAME);
+    match format {
+        Format::Sse => {
+            buf.extend_from_slice(b"data: ");
+            buf.extend_from_slice(json);
+            // padding goes in a comment line
+            buf.extend_from_slice(b"\n\n:");
+        }
+        // json allows trailing whitespace
+        Format::Ndjson => buf.extend_from_slice(json),
+    }
+    let padded = (buf.len() + 1 + STREAM_FRAME - 1) / STREAM_FRAME * STREAM_FRAME;
+    buf.resize(padded - 1, b' ');
+    buf.push(b'\n');
+    buf
+}
+
+/// a frame with no data (an sse comment, or a blank ndjson line), padded like other frames
+pub fn heartbeat(format: Format) -> Vec<u8> {
+    let mut buf = match format {
+        Format::Sse => b":".to_vec(),
+        Format::Ndjson => Vec::new(),
+    };
+    buf.resize(STREAM_FRAME - 1, b' ');
+    buf.push(b'\n');
+    buf
+}
+
+/// a game's player index to show the game from, and the format to encode it in
+pub type Key = (u32, Format);
+
+struct Subscription {
+    subscribers: usize,
+    /// the latest frames and their sequence numbers, oldest first
+    frames: VecDeque<(u64, Frame)>,
+}
+
+struct ChannelState {
+    /// sequence number of the latest update
+    seq: u64,
+    /// the game's version (moves made) in the latest update, so updates published out of order
+    /// are dropped
+    version: u64,
+    subscriptions: HashMap<Key, Subscription>,
+    /// set once the game has finished. Subscribers end after reading the last frame
+    closed: bool,
+}
+
+/// The subscribers watching a game
+struct Channel {
+    state: Mutex<ChannelState>,
+    updated: Condvar,
+}
+
+/// Fans out game updates to the subscribers watching them. Each update is encoded once for each
+/// (perspective, format) being watched, no matter how many subscribers there are
+#[derive(Default)]
+pub struct Hub {
+    channels: RwLock<HashMap<i32, Arc<Channel>>>,
+}
+
+impl Hub {
+    /// whether anyone is watching a game
+    pub fn watched(&self, game_id: i32) -> bool {
+        self.channels.read().unwrap().contains_key(&game_id)
+    }
+
+    /// publish an update to a game's subscribers. encode is called with the update's sequence
+    /// number once for each subscribed key. version must increase as the game changes, and an
+    /// update older than the latest is dropped. If finished, subscribers end after this update
+    pub fn publish<F: Fn(u64, Key) -> Vec<u8>>(
+        &self,
+        game_id: i32,
+        version: u64,
+        finished: bool,
+        encode: F,
+    ) {
+        let channel = match self.channels.read().unwrap().get(&game_id) {
+            Some(channel) => channel.clone(),
+            None => return,
+        };
+
+        let mut state = channel.state.lock().unwrap();
+        if state.closed || version < state.version {
+            return;
+        }
+        state.version = version;
+        state.seq += 1;
+        let seq = state.seq;
+        for (key, sub) in state.subscriptions.iter_mut() {
+            if sub.frames.len() == RING_LEN {
+                sub.frames.pop_front();
+            }
+            sub.frames.push_back((seq, Frame::from(encode(seq, *key))));
+        }
+        state.closed = finished;
+        drop(state);
+        channel.updated.notify_all();
+
+        // later subscribers to a finished game get their own channel
+        if finished {
+            let mut channels = self.channels.write().unwrap();
+            if channels
+                .get(&game_id)
+                .map_or(false, |c| Arc::ptr_eq(c, &channel))
+            {
+                channels.remove(&game_id);
+            }
+        }
+    }
+
+    /// start watching a game. The subscriber's first frame is the game's current state at
+    /// version, which is encoded with snapshot (unless another subscriber with the same key
+    /// already has it). The caller must make sure the game isn't saved between taking the
+    /// snapshot and subscribing. If finished, the subscriber ends after its first frame.
+    /// Fails with Overloaded if the game or the server has too many watchers
+    pub fn subscribe<F: FnOnce(u64) -> Vec<u8>>(
+        hub: &Arc<Hub>,
+        game_id: i32,
+        key: Key,
+        version: u64,
+        finished: bool,
+        snapshot: F,
+    ) -> Result<Subscriber, Error> {
+        let slot = StreamSlot::acquire()?;
+        // hold the hub lock while registering, so the channel can't be removed in between
+        let mut channels = hub.channels.write().unwrap();
+        // a closed channel is about to be removed by the publish that closed it
+        let open = channels
+            .get(&game_id)
+            .filter(|c| !c.state.lock().unwrap().closed)
+            .cloned();
+        let (channel, created) = match open {
+            Some(channel) => (channel, false),
+            None => {
+                let channel = Arc::new(Channel {
+                    state: Mutex::new(ChannelState {
+                        seq: 0,
+                        version,
+                        subscriptions: HashMap::new(),
+                        closed: false,
+                    }),
+                    updated: Condvar::new(),
+                });
+                channels.insert(game_id, channel.clone());
+                (channel, true)
+            }
+        };
+
+        let mut state = channel.state.lock().unwrap();
+        let watchers: usize = state.subscriptions.values().map(|s| s.subscribers).sum();
+        if watchers >= MAX_GAME_WATCHERS {
+            return Err(Error::Overloaded);
+        }
+        let seq = state.seq;
+        state.version = state.version.max(version);
+        let sub = state
+            .subscriptions
+            .entry(key)
+            .or_insert_with(|| Subscription {
+                subscribers: 0,
+                frames: VecDeque::new(),
+            });
+        sub.subscribers += 1;
+        if sub.frames.back().map_or(true, |(s, _)| *s != seq) {
+            sub.frames.push_back((seq, Frame::from(snapshot(seq))));
+            if sub.frames.len() > RING_LEN {
+                sub.frames.pop_front();
+            }
+        }
+        // a channel that was already open has subscribers waiting for the game's last update, and
+        // is closed by its publish
+        let close = finished && created;
+        if close {
+            state.closed = true;
+        }
+        drop(state);
+        if close {
+            channels.remove(&game_id);
+        }
+        drop(channels);
+
+        Ok(Subscriber {
+            hub: hub.clone(),
+            channel,
+            game_id,
+            key,
+            // read the current state first
+            cursor: seq.wrapping_sub(1),
+            frame: Frame::from(Vec::new()),
+            pos: 0,
+            _slot: slot,
+        })
+    }
+}
+
+/// A stream of a game's frames for one subscriber
+pub struct Subscriber {
+    hub: Arc<Hub>,
+    channel: Arc<Channel>,
+    game_id: i32,
+    key: Key,
+    /// sequence number of the last frame read
+    cursor: u64,
+    frame: Frame,
+    pos: usize,
+    _slot: StreamSlot,
+}
+
+impl Subscriber {
+    /// wait for the next frame, or a heartbeat if there isn't one for HEARTBEAT_INTERVAL. Returns
+    /// None once the game has finished and every frame is read
+    fn next_frame(&mut self) -> Option<Frame> {
+        let mut state = self.channel.state.lock().unwrap();
+        loop {
+            let frames = &state.subscriptions[&self.key].frames;
+            let cursor = self.cursor;
+            if let Some((oldest, _)) = frames.front() {
+                // frames are full states, so a subscriber that has fallen behind resyncs by
+                // skipping to the latest one instead of buffering what it missed
+                let next = if *oldest > cursor.wrapping_add(1) {
+                    frames.back()
+                } else {
+                    frames
+                        .iter()
+                        .find(|(seq, _)| *seq == cursor.wrapping_add(1))
+                };
+                if let Some((seq, frame)) = next {
+                    self.cursor = *seq;
+                    return Some(frame.clone());
+                }
+            }
+            if state.closed {
+                return None;
+            }
+            let (next, wait) = self
+                .channel
+                .updated
+                .wait_timeout(state, HEARTBEAT_INTERVAL)
+                .unwrap();
+            if wait.timed_out() {
+                return Some(Frame::from(heartbeat(self.key.1)));
+            }
+            state = next;
+        }
+    }
+}
+
+impl Read for Subscriber {
+    fn read(&mut self, out: &mut [u8]) -> io::Result<usize> {
+        if self.pos == self.frame.len() {
+            match self.next_frame() {
+                Some(frame) => {
+                    self.frame = frame;
+                    self.pos = 0;
+                }
+                None => return Ok(0),
+            }
+        }
+        let n = out.len().min(self.frame.len() - self.pos);
+        out[..n].copy_from_slice(&self.frame[self.pos..self.pos + n]);
+        self.pos += n;
+        Ok(n)
+    }
+}
+
+impl Drop for Subscriber {
+    fn drop(&mut self) {
+        // lock order is always hub, then channel
+        let mut channels = self.hub.channels.write().unwrap();
+        let mut state = self.channel.state.lock().unwrap();
+        let empty_key = match state.subscriptions.get_mut(&self.key) {
+            Some(sub) => {
+                sub.subscribers -= 1;
+                sub.subscribers == 0
+            }
+            None => false,
+        };
+        if empty_key {
+            state.subscriptions.remove(&self.key);
+        }
+        if state.subscriptions.is_empty()
+            && channels
+                .get(&self.game_id)
+                .map_or(false, |c| Arc::ptr_eq(c, &self.channel))
+        {
+            channels.remove(&self.game_id);
+        }
+    }
+}
+
+/// A game's latest state in the feed
+struct FeedGame {
+    /// feed sequence number of the update
+    seq: u64,
+    /// the game's own version (moves made), so updates published out of order are dropped
+    version: u64,
+    finished_at: Option<Instant>,
+    json: Arc<str>,
+}
+
+#[derive(Default)]
+struct FeedState {
+    /// sequence number of the latest update
+    seq: u64,
+    subscribers: usize,
+    games: HashMap<i32, FeedGame>,
+    pruned_at: Option<Instant>,
+}
+
+/// The latest state of every game, as one stream for views that show many games at once.
+/// Each frame holds only the games that changed since the subscriber's last frame, and frames
+/// are sent at most every FEED_INTERVAL, so a busy server sends a few large frames instead of a
+/// frame per move. The feed only holds games while it has subscribers
+#[derive(Default)]
+pub struct Feed {
+    state: Mutex<FeedState>,
+    updated: Condvar,
+    /// copy of state.subscribers, to check without locking
+    subscribers: AtomicUsize,
+}
+
+impl Feed {
+    /// whether anyone is subscribed to the feed
+    pub fn active(&self) -> bool {
+        self.subscribers.load(Ordering::Acquire) > 0
+    }
+
+    /// publish a game's latest state (a json object). version must increase as the game changes
+    pub fn publish(&self, game_id: i32, version: u64, finished: bool, json: String) {
+        let mut state = self.state.lock().unwrap();
+        if state.subscribers == 0
+            || state
+                .games
+                .get(&game_id)
+                .map_or(false, |game| game.version > version)
+        {
+            return;
+        }
+        let now = Instant::now();
+        if state
+            .pruned_at
+            .map_or(true, |at| now - at >= FEED_FINISHED_TTL)
+        {
+            state.games.retain(|_, game| {
+                game.finished_at
+                    .map_or(true, |at| now - at < FEED_FINISHED_TTL)
+            });
+            state.pruned_at = Some(now);
+        }
+        state.seq += 1;
+        let seq = state.seq;
+        state.games.insert(
+            game_id,
+            FeedGame {
+                seq,
+                version,
+                finished_at: if finished { Some(now) } else { None },
+                json: Arc::from(json),
+            },
+        );
+        drop(state);
+        self.updated.notify_all();
+    }
+
+    /// subscribe to the feed, for the games in filter (or every game). If the feed has no other
+    /// subscribers, it is started from snapshot: every game's (id, version, finished, json). The
+    /// caller must make sure no game is published between taking the snapshot and subscribing.
+    /// Fails with Overloaded if the feed or the server has too many subscribers
+    pub fn subscribe<F: FnOnce() -> Vec<(i32, u64, bool, String)>>(
+        feed: &Arc<Feed>,
+        format: Format,
+        filter: Option<HashSet<i32>>,
+        snapshot: F,
+    ) -> Result<FeedSubscriber, Error> {
+        let slot = StreamSlot::acquire()?;
+        let mut state = feed.state.lock().unwrap();
+        if state.subscribers >= MAX_FEED_SUBSCRIBERS {
+            return Err(Error::Overloaded);
+        }
+        state.subscribers += 1;
+        feed.subscribers.store(state.subscribers, Ordering::Release);
+        if state.subscribers == 1 {
+            let now = Instant::now();
+            for (game_id, version, finished, json) in snapshot() {
+                state.seq += 1;
+                let seq = state.seq;
+                state.games.insert(
+                    game_id,
+                    FeedGame {
+                        seq,
+                        version,
+                        finished_at: if finished { Some(now) } else { None },
+                        json: Arc::from(json),
+                    },
+                );
+            }
+        }
+        drop(state);
+
+        Ok(FeedSubscriber {
+            feed: feed.clone(),
+            format,
+            filter,
+            cursor: None,
+            last_frame: None,
+            frame: Vec::new(),
+            pos: 0,
+            _slot: slot,
+        })
+    }
+}
+
+/// The feed, as a stream of frames for one subscriber. Frames are {"games": [...]}
+pub struct FeedSubscriber {
+    feed: Arc<Feed>,
+    format: Format,
+    filter: Option<HashSet<i32>>,
+    /// sequence number of the latest update sent, or None before the first frame
+    cursor: Option<u64>,
+    last_frame: Option<Instant>,
+    frame: Vec<u8>,
+    pos: usize,
+    _slot: StreamSlot,
+}
+
+impl FeedSubscriber {
+    fn wanted(&self, game_id: i32) -> bool {
+        self.filter
+            .as_ref()
+            .map_or(true, |filter| filter.contains(&game_id))
+    }
+
+    /// wait for games to change, and encode every changed game in one frame. The first frame
+    /// holds every game. If nothing changes for HEARTBEAT_INTERVAL, returns a heartbeat
+    fn next_frame(&mut self) -> Vec<u8> {
+        if let Some(since) = self.last_frame.map(|at| at.elapsed()) {
+            if since < FEED_INTERVAL {
+                thread::sleep(FEED_INTERVAL - since);
+            }
+        }
+
+        let mut state = self.feed.state.lock().unwrap();
+        let mut json = String::from("{\"games\":[");
+        loop {
+            let first = self.cursor.is_none();
+            let cursor = self.cursor.unwrap_or(0);
+            let mut changed = 0;
+            for (game_id, game) in state.games.iter() {
+                if game.seq > cursor && self.wanted(*game_id) {
+                    if changed > 0 {
+                        json.push(',');
+                    }
+                    json.push_str(&game.json);
+                    changed += 1;
+                }
+            }
+            self.cursor = Some(state.seq);
+            if changed > 0 || first {
+                break;
+            }
+            let (next, wait) = self
+                .feed
+                .updated
+                .wait_timeout(state, HEARTBEAT_INTERVAL)
+                .unwrap();
+            if wait.timed_out() {
+                return heartbeat(self.format);
+            }
+            state = next;
+        }
+        drop(state);
+        json.push_str("]}");
+        self.last_frame = Some(Instant::now());
+        frame(self.format, json.as_bytes())
+    }
+}
+
+impl Read for FeedSubscriber {
+    fn read(&mut self, out: &mut [u8]) -> io::Result<usize> {
+        if self.pos == self.frame.len() {
+            self.frame = self.next_frame();
+            self.pos = 0;
+        }
+        let n = out.len().min(self.frame.len() - self.pos);
+        out[..n].copy_from_slice(&self.frame[self.pos..self.pos + n]);
+        self.pos += n;
+        Ok(n)
+    }
+}
+
+impl Drop for FeedSubscriber {
+    fn drop(&mut self) {
+        let mut state = self.feed.state.lock().unwrap();
+        state.subscribers -= 1;
+        self.feed
+            .subscribers
+            .store(state.subscribers, Ordering::Release);
+        // the next first subscriber starts from a fresh snapshot
+        if state.subscribers == 0 {
+            state.games.clear();
+        }
+    }
+}
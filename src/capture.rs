@@ -0,0 +1,256 @@
+//! Opt-in capture of the request stream, for replaying real traffic against a test server (see
+//! client/src/bin/replay.rs).
+//!
+//! Each request is written as a line of json:
+//!   t: ms from the start of the capture to when the request arrived, m: method, r: route name,
+//!   s: status, l: latency in us, u: user alias, p: path and query, b: body, c: content type,
+//!   i: id of the game a game_new request created
+//! Captures are sanitized: users are replaced by aliases numbered in the order they are first
+//! seen, and only game routes keep their path and body (the rest have only their route and
+//! timing, so passwords, api keys and page contents are never written). Game names are dropped,
+//! and user_get is written without its query, which it doesn't use.
+
+use crate::access_log::{RequestStart, RequestUser};
+use crate::shared::IdResp;
+use rocket::fairing::{Fairing, Info, Kind};
+use rocket::{Data, Request, Response};
+use serde::Serialize;
+use std::collections::HashMap;
+use std::env;
+use std::fs::File;
+use std::io::{BufWriter, Cursor, Write};
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::mpsc::{self, Receiver, RecvTimeoutError, SyncSender};
+use std::sync::Arc;
+use std::thread;
+use std::time::{Duration, Instant};
+
+/// requests queued for the writer. If the writer falls behind, requests are dropped
+const QUEUE_LEN: usize = 1 << 14;
+const DEFAULT_MAX_BYTES: u64 = 256 * 1024 * 1024;
+/// how long the writer waits for a request before flushing
+const FLUSH_INTERVAL: Duration = Duration::from_millis(200);
+
+/// routes whose path and body are captured. Everything else only has its route and timing
+const REPLAYABLE_ROUTES: &[&str] = &[
+    "game_get_user_authd",
+    "game_get",
+    "game_move_needed",
+    "game_move",
+    "game_premoves",
+    "game_threats",
+    "game_new",
+    "game_join",
+    "game_leave",
+    "game_start",
+    "game_index",
+    "user_get",
+];
+/// routes whose body is replaced (game_new's body is the game's name)
+const BODY_DROPPED_ROUTES: &[&str] = &["game_new"];
+/// routes captured without their query. These routes take no parameters, so a query can only be
+/// something the client added (which may identify the user)
+const QUERY_DROPPED_ROUTES: &[&str] = &["user_get"];
+
+/// A request, as sent to the writer (before the user is aliased)
+struct Captured {
+    at: Duration,
+    method: &'static str,
+    route: &'static str,
+    status: u16,
+    latency_us: u64,
+    user_id: Option<i32>,
+    path: Option<String>,
+    body: Option<String>,
+    content_type: Option<String>,
+    created_game: Option<i32>,
+}
+
+/// A captured request, as written to the capture file
+#[derive(Serialize)]
+struct Line<'a> {
+    t: u64,
+    m: &'a str,
+    r: &'a str,
+    s: u16,
+    l: u64,
+    #[serde(skip_serializing_if = "Option::is_none")]
+    u: Option<u32>,
+    #[serde(skip_serializing_if = "Option::is_none")]
+    p: Option<&'a str>,
+    #[serde(skip_serializing_if = "Option::is_none")]
+    b: Option<&'a str>,
+    #[serde(skip_serializing_if = "Option::is_none")]
+    c: Option<&'a str>,
+    #[serde(skip_serializing_if = "Option::is_none")]
+    i: Option<i32>,
+}
+
+/// Body of a request, peeked at before it is handled. Stored in the request's local cache
+struct PeekedBody(Option<String>);
+
+/// A fairing that captures requests to the file at CAPTURE_PATH
+pub struct Capture {
+    started: Instant,
+    queue: SyncSender<Captured>,
+    dropped: Arc<AtomicU64>,
+}
+
+impl Capture {
+    /// start capturing to CAPTURE_PATH (if it is set). The capture stops once it reaches
+    /// CAPTURE_MAX_BYTES
+    pub fn from_env() -> Option<Capture> {
+        let path = env::var("CAPTURE_PATH").ok()?;
+        let max_bytes = env::var("CAPTURE_MAX_BYTES")
+            .ok()
+            .and_then(|s| s.parse::<u64>().ok())
+            .unwrap_or(DEFAULT_MAX_BYTES);
+        let file = File::create(&path).expect("couldn't open CAPTURE_PATH");
+
+        let (queue, requests) = mpsc::sync_channel(QUEUE_LEN);
+        let dropped = Arc::new(AtomicU64::new(0));
+        let writer_dropped = dropped.clone();
+        thread::spawn(move || write_capture(file, max_bytes, requests, &writer_dropped));
+
+        Some(Capture {
+            started: Instant::now(),
+            queue,
+            dropped,
+        })
+    }
+}
+
+impl Fairing for Capture {
+    fn info(&self) -> Info {
+        Info {
+            name: "Request Capture",
+            kind: Kind::Request | Kind::Response,
+        }
+    }
+
+    fn on_request(&self, request: &mut Request, data: &Data) {
+        request.local_cache(|| RequestStart(Instant::now()));
+        // the route isn't known yet, so keep any game route body that could be replayed. Bodies
+        // bigger than peek's buffer are left out rather than captured truncated
+        let replayable_body = request.uri().path().starts_with("/api/game/")
+            && request
+                .content_type()
+                .map_or(false, |c| c.is_form() || c.is_json())
+            && data.peek_complete();
+        let body = if replayable_body {
+            String::from_utf8(data.peek().to_vec()).ok()
+        } else {
+            None
+        };
+        request.local_cache(|| PeekedBody(body));
+    }
+
+    fn on_response(&self, request: &Request, response: &mut Response) {
+        let start = request.local_cache(|| RequestStart(Instant::now())).0;
+        let route = request.route().and_then(|r| r.name).unwrap_or("");
+        let replayable = REPLAYABLE_ROUTES.contains(&route);
+
+        let (path, body, content_type) = if replayable {
+            let path = match request.uri().query() {
+                Some(query) if !QUERY_DROPPED_ROUTES.contains(&route) => {
+                    format!("{}?{}", request.uri().path(), query)
+                }
+                _ => request.uri().path().to_string(),
+            };
+            let body = if BODY_DROPPED_ROUTES.contains(&route) {
+                None
+            } else {
+                request.local_cache(|| PeekedBody(None)).0.clone()
+            };
+            let content_type = body
+                .as_ref()
+                .and(request.content_type())
+                .map(|c| c.to_string());
+            (Some(path), body, content_type)
+        } else {
+            (None, None, None)
+        };
+
+        // the replayer maps the game created here to the one its replay creates
+        let created_game = if route == "game_new" {
+            response.body_string().and_then(|body| {
+                let id = serde_json::from_str::<IdResp>(&body)
+                    .ok()
+                    .and_then(|resp| resp.id.parse::<i32>().ok());
+                response.set_sized_body(Cursor::new(body));
+                id
+            })
+        } else {
+            None
+        };
+
+        let captured = Captured {
+            at: start.saturating_duration_since(self.started),
+            method: request.method().as_str(),
+            route,
+            status: response.status().code,
+            latency_us: start.elapsed().as_micros() as u64,
+            user_id: request.local_cache(|| RequestUser(None)).0,
+            path,
+            body,
+            content_type,
+            created_game,
+        };
+        if self.queue.try_send(captured).is_err() {
+            self.dropped.fetch_add(1, Ordering::Relaxed);
+        }
+    }
+}
+
+/// alias users and write requests to file until max_bytes have been written
+fn write_capture(file: File, max_bytes: u64, requests: Receiver<Captured>, dropped: &AtomicU64) {
+    let mut out = BufWriter::new(file);
+    let mut aliases = HashMap::<i32, u32>::new();
+    let mut written = 0;
+    let mut reported_dropped = 0;
+
+    while written < max_bytes {
+        let req = match requests.recv_timeout(FLUSH_INTERVAL) {
+            Ok(req) => req,
+            Err(RecvTimeoutError::Timeout) => {
+                let _ = out.flush();
+                continue;
+            }
+            Err(RecvTimeoutError::Disconnected) => break,
+        };
+
+        let next_alias = aliases.len() as u32;
+        let line = Line {
+            t: req.at.as_millis() as u64,
+            m: req.method,
+            r: req.route,
+            s: req.status,
+            l: req.latency_us,
+            u: req
+                .user_id
+                .map(|id| *aliases.entry(id).or_insert(next_alias)),
+            p: req.path.as_deref(),
+            b: req.body.as_deref(),
+            c: req.content_type.as_deref(),
+            i: req.created_game,
+        };
+        let mut bytes = serde_json::to_vec(&line).unwrap_or_default();
+        bytes.push(b'\n');
+        if let Err(e) = out.write_all(&bytes) {
+            eprintln!("error writing request capture: {}", e);
+            return;
+        }
+        written += bytes.len() as u64;
+
+        let total_dropped = dropped.load(Ordering::Relaxed);
+        if total_dropped != reported_dropped {
+            eprintln!(
+                "request capture fell behind, dropped {} requests",
+                total_dropped - reported_dropped
+            );
+            reported_dropped = total_dropped;
+        }
+    }
+    let _ = out.flush();
+    println!("request capture finished ({} bytes)", written);
+}
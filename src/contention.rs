@@ -0,0 +1,242 @@
+use crate::game::Game;
+use crate::game_manage::{AppState, GameId, GameManager, MemoryStore};
+use crate::tournament_sim::Rng;
+use crate::users::PlayerId;
+use crate::GameType;
+use std::ops::AddAssign;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::RwLock;
+use std::thread;
+use std::time::{Duration, Instant};
+
+/// Relative weights of the operations in the benchmark's workload
+#[derive(Clone, Copy, Debug)]
+pub struct Mix {
+    /// get_game on a game in progress
+    pub get: u32,
+    /// get_game then save_game on a game in progress
+    pub save: u32,
+    /// join_game then leave_game on a game waiting for players
+    pub join: u32,
+    /// play_move on a game in progress
+    pub moves: u32,
+}
+
+impl Default for Mix {
+    fn default() -> Mix {
+        Mix {
+            get: 70,
+            save: 5,
+            join: 5,
+            moves: 20,
+        }
+    }
+}
+
+impl Mix {
+    fn total(&self) -> u32 {
+        self.get + self.save + self.join + self.moves
+    }
+}
+
+#[derive(Clone, Debug)]
+pub struct ContentionConfig {
+    /// number of games in progress (there are as many more waiting for players)
+    pub games: usize,
+    /// thread counts to run the workload with
+    pub threads: Vec<usize>,
+    /// how long to run the workload for at each thread count
+    pub duration: Duration,
+    pub mix: Mix,
+    pub seed: u64,
+}
+
+impl Default for ContentionConfig {
+    fn default() -> ContentionConfig {
+        ContentionConfig {
+            games: 1000,
+            threads: vec![1, 2, 4, 8, 16, 32, 64],
+            duration: Duration::from_secs(2),
+            mix: Mix::default(),
+            seed: 0,
+        }
+    }
+}
+
+/// Operations completed by the workload
+#[derive(Clone, Copy, Default, Debug)]
+pub struct OpCounts {
+    pub get: u64,
+    pub save: u64,
+    pub join: u64,
+    pub moves: u64,
+    /// operations the game rejected (ie -- another thread moved in the same game first)
+    pub rejected: u64,
+    /// total time spent in operations, across all threads
+    pub busy: Duration,
+}
+
+impl OpCounts {
+    pub fn total(&self) -> u64 {
+        self.get + self.save + self.join + self.moves
+    }
+}
+
+impl AddAssign for OpCounts {
+    fn add_assign(&mut self, other: OpCounts) {
+        self.get += other.get;
+        self.save += other.save;
+        self.join += other.join;
+        self.moves += other.moves;
+        self.rejected += other.rejected;
+        self.busy += other.busy;
+    }
+}
+
+/// Throughput of the workload at one thread count
+#[derive(Clone, Debug)]
+pub struct ScalingPoint {
+    pub threads: usize,
+    pub ops: OpCounts,
+    pub elapsed: Duration,
+}
+
+impl ScalingPoint {
+    pub fn ops_per_sec(&self) -> f64 {
+        self.ops.total() as f64 / self.elapsed.as_secs_f64()
+    }
+
+    /// mean time an operation took, in microseconds
+    pub fn mean_op_us(&self) -> f64 {
+        self.ops.busy.as_secs_f64() * 1e6 / self.ops.total().max(1) as f64
+    }
+}
+
+/// Run the workload against AppState from each number of threads in config. Games are kept in a
+/// MemoryStore, so only the game manager's locking and cloning are measured
+pub fn run(config: &ContentionConfig) -> Vec<ScalingPoint> {
+    config
+        .threads
+        .iter()
+        .map(|threads| run_threads(config, *threads))
+        .collect()
+}
+
+fn run_threads(config: &ContentionConfig, threads: usize) -> ScalingPoint {
+    let games = config.games.max(1);
+    let players = [PlayerId::new(1), PlayerId::new(2)];
+    // games 1 to games are in progress, the rest are waiting for players
+    let store = MemoryStore::<GameType>::new(games * 2, games, &players, players[0]);
+    let manager = RwLock::new(GameManager::<GameType>::default());
+    let stop = AtomicBool::new(false);
+
+    let start = Instant::now();
+    let ops = thread::scope(|scope| {
+        let workers = (0..threads)
+            .map(|t| {
+                let (store, manager, stop) = (&store, &manager, &stop);
+                let mix = config.mix;
+                let seed = config.seed ^ ((t as u64 + 1) << 32);
+                scope.spawn(move || worker(store, manager, stop, mix, games, t, seed))
+            })
+            .collect::<Vec<_>>();
+        thread::sleep(config.duration);
+        stop.store(true, Ordering::Relaxed);
+
+        let mut ops = OpCounts::default();
+        for w in workers {
+            ops += w.join().unwrap();
+        }
+        ops
+    });
+
+    ScalingPoint {
+        threads,
+        ops,
+        elapsed: start.elapsed(),
+    }
+}
+
+fn worker(
+    store: &MemoryStore<GameType>,
+    manager: &RwLock<GameManager<GameType>>,
+    stop: &AtomicBool,
+    mix: Mix,
+    games: usize,
+    index: usize,
+    seed: u64,
+) -> OpCounts {
+    let app = AppState::new(store, manager);
+    let me = PlayerId::new(1000 + index as i32);
+    let mut rng = Rng::new(seed);
+    let mut moves = Vec::new();
+    let mut ops = OpCounts::default();
+    let total = mix.total().max(1);
+
+    while !stop.load(Ordering::Relaxed) {
+        let game_id = GameId::new(rng.range(1, games as u32) as i32);
+        let lobby_id = GameId::new(rng.range(games as u32 + 1, games as u32 * 2) as i32);
+        let roll = rng.range(0, total - 1);
+        let start = Instant::now();
+
+        let ok = if roll < mix.get {
+            ops.get += 1;
+            app.get_game(game_id).is_ok()
+        } else if roll < mix.get + mix.save {
+            ops.save += 1;
+            app.get_game(game_id)
+                .and_then(|game| app.save_game(game))
+                .is_ok()
+        } else if roll < mix.get + mix.save + mix.join {
+            ops.join += 1;
+            app.join_game(lobby_id, me)
+                .and_then(|()| app.leave_game(lobby_id, me))
+                .is_ok()
+        } else {
+            ops.moves += 1;
+            random_move(&app, store, game_id, &mut rng, &mut moves)
+        };
+
+        ops.busy += start.elapsed();
+        if !ok {
+            ops.rejected += 1;
+        }
+    }
+
+    ops
+}
+
+/// make a random legal move for whoever's turn it is, restarting the game if it has finished
+fn random_move(
+    app: &AppState<GameType, &MemoryStore<GameType>>,
+    store: &MemoryStore<GameType>,
+    game_id: GameId,
+    rng: &mut Rng,
+    moves: &mut Vec<<GameType as Game>::Move>,
+) -> bool {
+    let game = match app.get_game(game_id) {
+        Ok(game) => game,
+        Err(_) => return false,
+    };
+    let state = match game.game() {
+        Some(state) => state,
+        None => return false,
+    };
+    if state.finished() {
+        store.restart(game_id);
+        return true;
+    }
+    let player = match (0..game.players().len() as u32).find(|p| state.waiting_on(*p)) {
+        Some(p) => p,
+        None => return false,
+    };
+    moves.clear();
+    state.legal_moves(player, moves);
+    if moves.is_empty() {
+        store.restart(game_id);
+        return true;
+    }
+    let m = moves[rng.range(0, moves.len() as u32 - 1) as usize].clone();
+    app.play_move(game_id, game.players()[player as usize], m)
+        .is_ok()
+}
@@ -0,0 +1,485 @@
+//! A compact binary format for finished games, for training and analysing bots offline.
+//!
+//! A corpus file is a header, the game records one after another, then an index of record offsets.
+//! All integers are little endian.
+//!
+//! header (64 bytes):
+//!   magic "CKCORPUS", version u32, move_len u32 (bytes per move), num_games u64,
+//!   index_offset u64 (0 while the file is being written), reserved
+//! record (32 bytes, then num_moves * move_len bytes of moves):
+//!   game_id i32, num_moves u32, outcome i8, num_players u8, reserved u16,
+//!   player ids [i32; 4] (unused slots are 0), reserved u32
+//! index (num_games * 8 bytes):
+//!   offset of each record u64, in the order they were written
+//!
+//! Moves are packed with BinaryMove, so a gomoku move is a single byte.
+
+use crate::game::{BinaryMove, Game, GameOutcome};
+use diesel::pg::PgConnection;
+use diesel::prelude::*;
+use memmap::Mmap;
+use std::collections::HashSet;
+use std::convert::TryInto;
+use std::fs::{File, OpenOptions};
+use std::io::{self, BufWriter, Seek, SeekFrom, Write};
+use std::path::Path;
+
+const MAGIC: &[u8; 8] = b"CKCORPUS";
+pub const VERSION: u32 = 1;
+const HEADER_LEN: usize = 64;
+const RECORD_HEADER_LEN: usize = 32;
+/// most players a record can hold
+pub const MAX_PLAYERS: usize = 4;
+/// games loaded from the database at once while exporting
+const EXPORT_BATCH: i64 = 10000;
+
+/// outcome byte for games without a winner or tie
+const OUTCOME_UNKNOWN: i8 = -1;
+const OUTCOME_TIE: i8 = -2;
+
+fn invalid(msg: &str) -> io::Error {
+    io::Error::new(io::ErrorKind::InvalidData, msg)
+}
+
+fn u32_at(b: &[u8], at: usize) -> u32 {
+    u32::from_le_bytes(b[at..at + 4].try_into().unwrap())
+}
+
+fn i32_at(b: &[u8], at: usize) -> i32 {
+    i32::from_le_bytes(b[at..at + 4].try_into().unwrap())
+}
+
+fn u64_at(b: &[u8], at: usize) -> u64 {
+    u64::from_le_bytes(b[at..at + 8].try_into().unwrap())
+}
+
+struct Header {
+    move_len: u32,
+    num_games: u64,
+    index_offset: u64,
+}
+
+impl Header {
+    fn encode(&self) -> [u8; HEADER_LEN] {
+        let mut b = [0; HEADER_LEN];
+        b[0..8].copy_from_slice(MAGIC);
+        b[8..12].copy_from_slice(&VERSION.to_le_bytes());
+        b[12..16].copy_from_slice(&self.move_len.to_le_bytes());
+        b[16..24].copy_from_slice(&self.num_games.to_le_bytes());
+        b[24..32].copy_from_slice(&self.index_offset.to_le_bytes());
+        b
+    }
+
+    fn decode(b: &[u8]) -> io::Result<Header> {
+        if b.len() < HEADER_LEN || &b[0..8] != MAGIC {
+            return Err(invalid("not a game corpus"));
+        }
+        if u32_at(b, 8) != VERSION {
+            return Err(invalid("unsupported corpus version"));
+        }
+        if u32_at(b, 12) == 0 {
+            return Err(invalid("corpus move size is 0"));
+        }
+        Ok(Header {
+            move_len: u32_at(b, 12),
+            num_games: u64_at(b, 16),
+            index_offset: u64_at(b, 24),
+        })
+    }
+}
+
+/// The outcome of a game, as stored in a corpus
+#[derive(Clone, Copy, PartialEq, Eq, Debug)]
+pub enum Outcome {
+    /// the index of the winning player
+    Win(u8),
+    Tie,
+    Unknown,
+}
+
+impl Outcome {
+    pub fn from_game(outcome: GameOutcome) -> Outcome {
+        match outcome {
+            GameOutcome::Win(player) if player <= i8::MAX as u32 => Outcome::Win(player as u8),
+            GameOutcome::Tie => Outcome::Tie,
+            _ => Outcome::Unknown,
+        }
+    }
+
+    fn encode(self) -> i8 {
+        match self {
+            Outcome::Win(player) => player as i8,
+            Outcome::Tie => OUTCOME_TIE,
+            Outcome::Unknown => OUTCOME_UNKNOWN,
+        }
+    }
+
+    fn decode(b: i8) -> Outcome {
+        match b {
+            OUTCOME_TIE => Outcome::Tie,
+            b if b >= 0 => Outcome::Win(b as u8),
+            _ => Outcome::Unknown,
+        }
+    }
+}
+
+/// check that the record at offset fits in data, and return its length
+fn record_len(data: &[u8], offset: usize, move_len: usize) -> Option<usize> {
+    let header = data.get(offset..offset + RECORD_HEADER_LEN)?;
+    let len = RECORD_HEADER_LEN + u32_at(header, 4) as usize * move_len;
+    if offset + len <= data.len() {
+        Some(len)
+    } else {
+        None
+    }
+}
+
+/// Writes a corpus one game at a time. The index is written by finish, and until then the file is
+/// marked incomplete (reopening it with open_append recovers every fully written record)
+pub struct CorpusWriter {
+    file: BufWriter<File>,
+    move_len: u32,
+    /// where the next record goes
+    pos: u64,
+    offsets: Vec<u64>,
+    game_ids: HashSet<i32>,
+}
+
+impl CorpusWriter {
+    /// create a new corpus at path (replacing any file there), for moves of move_len bytes
+    pub fn create<P: AsRef<Path>>(path: P, move_len: usize) -> io::Result<CorpusWriter> {
+        if move_len == 0 {
+            return Err(invalid("corpus move size is 0"));
+        }
+        let mut file = File::create(path)?;
+        let header = Header {
+            move_len: move_len as u32,
+            num_games: 0,
+            index_offset: 0,
+        };
+        file.write_all(&header.encode())?;
+        Ok(CorpusWriter {
+            file: BufWriter::new(file),
+            move_len: move_len as u32,
+            pos: HEADER_LEN as u64,
+            offsets: vec![],
+            game_ids: HashSet::new(),
+        })
+    }
+
+    /// reopen an existing corpus to add more games to it
+    pub fn open_append<P: AsRef<Path>>(path: P) -> io::Result<CorpusWriter> {
+        let mut file = OpenOptions::new().read(true).write(true).open(path)?;
+        let data = unsafe { Mmap::map(&file)? };
+        let header = Header::decode(&data)?;
+
+        let (offsets, game_ids, end) = if header.index_offset != 0 {
+            let corpus = Corpus::from_mmap(data)?;
+            let offsets = corpus.offsets().collect::<Vec<_>>();
+            let game_ids = corpus.iter().map(|record| record.game_id()).collect();
+            (offsets, game_ids, header.index_offset)
+        } else {
+            // the last writer didn't finish, so walk the records to find where they stop
+            let mut offsets = Vec::new();
+            let mut game_ids = HashSet::new();
+            let mut pos = HEADER_LEN;
+            while let Some(len) = record_len(&data, pos, header.move_len as usize) {
+                offsets.push(pos as u64);
+                game_ids.insert(i32_at(&data, pos));
+                pos += len;
+            }
+            drop(data);
+            (offsets, game_ids, pos as u64)
+        };
+
+        // the mapping is dropped by here, so the file can be truncated. Drop the old index (or a
+        // partly written record), which is rewritten by finish
+        let incomplete = Header {
+            move_len: header.move_len,
+            num_games: offsets.len() as u64,
+            index_offset: 0,
+        };
+        file.seek(SeekFrom::Start(0))?;
+        file.write_all(&incomplete.encode())?;
+        file.set_len(end)?;
+        file.seek(SeekFrom::Start(end))?;
+
+        Ok(CorpusWriter {
+            file: BufWriter::new(file),
+            move_len: header.move_len,
+            pos: end,
+            offsets,
+            game_ids,
+        })
+    }
+
+    pub fn move_len(&self) -> usize {
+        self.move_len as usize
+    }
+
+    /// whether a game is already in the corpus
+    pub fn contains(&self, game_id: i32) -> bool {
+        self.game_ids.contains(&game_id)
+    }
+
+    pub fn len(&self) -> usize {
+        self.offsets.len()
+    }
+
+    /// add a game. moves are the game's moves packed one after another
+    pub fn add(
+        &mut self,
+        game_id: i32,
+        outcome: Outcome,
+        players: &[i32],
+        moves: &[u8],
+    ) -> io::Result<()> {
+        if players.len() > MAX_PLAYERS {
+            return Err(invalid("too many players for a corpus record"));
+        }
+        if moves.len() % self.move_len as usize != 0 {
+            return Err(invalid("moves aren't a whole number of moves"));
+        }
+        let num_moves = (moves.len() / self.move_len as usize) as u32;
+
+        let mut header = [0; RECORD_HEADER_LEN];
+        header[0..4].copy_from_slice(&game_id.to_le_bytes());
+        header[4..8].copy_from_slice(&num_moves.to_le_bytes());
+        header[8] = outcome.encode() as u8;
+        header[9] = players.len() as u8;
+        for (i, player) in players.iter().enumerate() {
+            header[12 + i * 4..16 + i * 4].copy_from_slice(&player.to_le_bytes());
+        }
+        self.file.write_all(&header)?;
+        self.file.write_all(moves)?;
+
+        self.offsets.push(self.pos);
+        self.game_ids.insert(game_id);
+        self.pos += (RECORD_HEADER_LEN + moves.len()) as u64;
+        Ok(())
+    }
+
+    /// write the index and mark the corpus complete
+    pub fn finish(mut self) -> io::Result<()> {
+        let index_offset = self.pos;
+        for offset in &self.offsets {
+            self.file.write_all(&offset.to_le_bytes())?;
+        }
+        let header = Header {
+            move_len: self.move_len,
+            num_games: self.offsets.len() as u64,
+            index_offset,
+        };
+        let mut file = self.file.into_inner().map_err(|e| e.into_error())?;
+        // the records and index have to be on disk before the header says they are there
+        file.sync_data()?;
+        file.seek(SeekFrom::Start(0))?;
+        file.write_all(&header.encode())?;
+        file.sync_data()
+    }
+}
+
+/// A finished corpus, memory mapped. Records are read straight out of the mapping
+pub struct Corpus {
+    data: Mmap,
+    move_len: usize,
+    num_games: usize,
+    index_offset: usize,
+}
+
+impl Corpus {
+    pub fn open<P: AsRef<Path>>(path: P) -> io::Result<Corpus> {
+        let file = File::open(path)?;
+        Corpus::from_mmap(unsafe { Mmap::map(&file)? })
+    }
+
+    fn from_mmap(data: Mmap) -> io::Result<Corpus> {
+        let header = Header::decode(&data)?;
+        if header.index_offset == 0 {
+            return Err(invalid("corpus wasn't finished"));
+        }
+        let index_offset = header.index_offset as usize;
+        let num_games = header.num_games as usize;
+        if index_offset + num_games * 8 > data.len() {
+            return Err(invalid("corpus is truncated"));
+        }
+        let corpus = Corpus {
+            move_len: header.move_len as usize,
+            num_games,
+            index_offset,
+            data,
+        };
+        // check every record once, so get doesn't have to
+        for offset in corpus.offsets() {
+            let offset = offset as usize;
+            match record_len(&corpus.data[..index_offset], offset, corpus.move_len) {
+                Some(_) if offset >= HEADER_LEN => (),
+                _ => return Err(invalid("corpus index points outside the records")),
+            }
+        }
+        Ok(corpus)
+    }
+
+    fn offsets<'a>(&'a self) -> impl Iterator<Item = u64> + 'a {
+        self.data[self.index_offset..self.index_offset + self.num_games * 8]
+            .chunks_exact(8)
+            .map(|b| u64_at(b, 0))
+    }
+
+    /// bytes per move
+    pub fn move_len(&self) -> usize {
+        self.move_len
+    }
+
+    pub fn len(&self) -> usize {
+        self.num_games
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.num_games == 0
+    }
+
+    pub fn get(&self, i: usize) -> Option<GameRecord<'_>> {
+        if i >= self.num_games {
+            return None;
+        }
+        let offset = u64_at(&self.data, self.index_offset + i * 8) as usize;
+        let num_moves = u32_at(&self.data, offset + 4) as usize;
+        Some(GameRecord {
+            bytes: &self.data[offset..offset + RECORD_HEADER_LEN + num_moves * self.move_len],
+            move_len: self.move_len,
+        })
+    }
+
+    pub fn iter<'a>(&'a self) -> impl Iterator<Item = GameRecord<'a>> + 'a {
+        (0..self.num_games).map(move |i| self.get(i).unwrap())
+    }
+}
+
+/// A game in a corpus, borrowed from the corpus' mapping
+#[derive(Clone, Copy)]
+pub struct GameRecord<'a> {
+    bytes: &'a [u8],
+    move_len: usize,
+}
+
+impl<'a> GameRecord<'a> {
+    pub fn game_id(&self) -> i32 {
+        i32_at(self.bytes, 0)
+    }
+
+    pub fn num_moves(&self) -> usize {
+        u32_at(self.bytes, 4) as usize
+    }
+
+    pub fn outcome(&self) -> Outcome {
+        Outcome::decode(self.bytes[8] as i8)
+    }
+
+    pub fn num_players(&self) -> usize {
+        (self.bytes[9] as usize).min(MAX_PLAYERS)
+    }
+
+    /// ids of the game's players, in turn order
+    pub fn players(&self) -> impl Iterator<Item = i32> + 'a {
+        let bytes = self.bytes;
+        (0..self.num_players()).map(move |i| i32_at(bytes, 12 + i * 4))
+    }
+
+    /// the packed moves
+    pub fn moves(&self) -> &'a [u8] {
+        &self.bytes[RECORD_HEADER_LEN..]
+    }
+
+    /// decode the moves. M's encoding has to match the corpus' move_len. Moves that don't decode
+    /// are None
+    pub fn decode_moves<M: BinaryMove + 'a>(&self) -> impl Iterator<Item = Option<M>> + 'a {
+        debug_assert_eq!(M::ENCODED_LEN, self.move_len);
+        self.moves().chunks_exact(M::ENCODED_LEN).map(M::decode)
+    }
+}
+
+/// whether moves, played from the start, lead to game. A history that doesn't (the game was
+/// saved while moves weren't recorded, or the moves were cut short) can't be replayed by readers
+fn replays_to<G: Game>(game: &G, players: usize, moves: &[u8]) -> bool {
+    let move_len = <G::Move as BinaryMove>::ENCODED_LEN;
+    if moves.len() % move_len != 0 {
+        return false;
+    }
+    let mut replay = G::new_with_players(players);
+    for bytes in moves.chunks_exact(move_len) {
+        let player = (0..players as u32).find(|p| replay.waiting_on(*p));
+        let legal = match (player, G::Move::decode(bytes)) {
+            (Some(player), Some(m)) => replay.make_move(player, &m),
+            _ => false,
+        };
+        if !legal {
+            return false;
+        }
+    }
+    replay.hash() == game.hash()
+}
+
+/// add every finished game in the database that isn't already in the corpus. Inactive games that
+/// didn't finish, and games whose recorded move history doesn't lead to their final state
+/// (including games without one) are skipped. Returns the number of games added
+pub fn export<G: Game>(conn: &PgConnection, writer: &mut CorpusWriter) -> io::Result<u64> {
+    use crate::schema::db_games::dsl::*;
+
+    if writer.move_len() != <G::Move as BinaryMove>::ENCODED_LEN {
+        return Err(invalid("corpus move size doesn't match the game's"));
+    }
+    let db_err = |e: diesel::result::Error| io::Error::new(io::ErrorKind::Other, e);
+
+    let mut added = 0;
+    let mut after = 0;
+    loop {
+        let page = db_games
+            .filter(active.eq(0))
+            .filter(state.is_not_null())
+            .filter(id.gt(after))
+            .order(id.asc())
+            .limit(EXPORT_BATCH)
+            .select(id)
+            .load::<i32>(conn)
+            .map_err(db_err)?;
+        let new_ids = page
+            .iter()
+            .copied()
+            .filter(|game_id| !writer.contains(*game_id))
+            .collect::<Vec<_>>();
+
+        let games = db_games
+            .filter(id.eq_any(&new_ids))
+            .order(id.asc())
+            .select((id, state, players, moves))
+            .load::<(i32, Option<String>, String, Vec<u8>)>(conn)
+            .map_err(db_err)?;
+        for (game_id, game_state, game_players, game_moves) in games {
+            if game_moves.is_empty() {
+                continue;
+            }
+            let player_ids = serde_json::from_str::<Vec<i32>>(&game_players)?;
+            let game = G::from_state(
+                serde_json::from_str(&game_state.unwrap_or_default())?,
+                player_ids.len(),
+            );
+            // inactive games that never finished were abandoned, and have no outcome to learn from
+            if !game.finished() || !replays_to(&game, player_ids.len(), &game_moves) {
+                continue;
+            }
+            writer.add(
+                game_id,
+                Outcome::from_game(game.outcome()),
+                &player_ids,
+                &game_moves,
+            )?;
+            added += 1;
+        }
+
+        match page.last() {
+            Some(last) if page.len() as i64 == EXPORT_BATCH => after = *last,
+            _ => return Ok(added),
+        }
+    }
+}
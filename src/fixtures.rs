@@ -0,0 +1,154 @@
+use crate::game::Game;
+use crate::shared::Error;
+use diesel::pg::PgConnection;
+use diesel::prelude::*;
+use diesel::sql_types::{Array, Integer, Text};
+
+/// prefix given to seeded usernames, so fixtures can be found (and aren't mixed up with real users)
+pub const USERNAME_PREFIX: &str = "fixture_user_";
+/// prefix given to seeded page urls
+pub const PAGE_PREFIX: &str = "fixture/";
+/// number of distinct game states to spread across the seeded games
+const DISTINCT_STATES: usize = 64;
+
+/// How many rows of each table to seed
+#[derive(Clone, Copy, Debug)]
+pub struct Volumes {
+    pub users: i32,
+    pub games: i32,
+    pub tournaments: i32,
+    pub pages: i32,
+}
+
+impl Default for Volumes {
+    fn default() -> Volumes {
+        Volumes {
+            users: 100_000,
+            games: 1_000_000,
+            tournaments: 10_000,
+            pages: 1_000,
+        }
+    }
+}
+
+/// play a random game to completion (or until it has had plies moves) and return its stored state
+fn random_state<G: Game>(seed: u64, plies: usize) -> Result<String, Error> {
+    let mut rng = seed.wrapping_mul(0x9e37_79b9_7f4a_7c15) | 1;
+    let mut game = G::new_with_players(crate::TOURNAMENT_GAME_PLAYERS);
+    let mut moves = Vec::new();
+    for _ in 0..plies {
+        if game.finished() {
+            break;
+        }
+        let player = match (0..crate::TOURNAMENT_GAME_PLAYERS as u32).find(|p| game.waiting_on(*p))
+        {
+            Some(p) => p,
+            None => break,
+        };
+        moves.clear();
+        game.legal_moves(player, &mut moves);
+        if moves.is_empty() {
+            break;
+        }
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        let m = moves[(rng % moves.len() as u64) as usize].clone();
+        game.make_move(player, &m);
+    }
+    Ok(serde_json::to_string(&game.state(0))?)
+}
+
+/// Seed the database with realistic volumes of users, games, tournaments and pages.
+///
+/// Rows are generated by the database itself (with generate_series), so seeding a million games is
+/// a handful of statements instead of a million round trips. Seeding again adds another batch of
+/// games and tournaments, but leaves existing users and pages alone. Games and tournaments only
+/// refer to ids of rows that exist: every fixture user, and the games seeded by the same run.
+pub fn seed(conn: &PgConnection, volumes: Volumes) -> Result<(), Error> {
+    // every fixture user has the password "password"
+    let password_hash = bcrypt::hash("password", bcrypt::DEFAULT_COST)?;
+    diesel::sql_query(
+        "INSERT INTO users (username, display_name, password_hash, api_key_hash, is_admin) \
+         SELECT $1 || i, 'Fixture User ' || i, $2, md5(i::text) || md5((-i)::text), false \
+         FROM generate_series(1, $3) AS i \
+         ON CONFLICT (username) DO NOTHING",
+    )
+    .bind::<Text, _>(USERNAME_PREFIX)
+    .bind::<Text, _>(&password_hash)
+    .bind::<Integer, _>(volumes.users)
+    .execute(conn)?;
+
+    // games are at every stage: unstarted, in progress and finished
+    let states = (0..DISTINCT_STATES)
+        .map(|i| random_state::<crate::GameType>(i as u64 + 1, i * 4))
+        .collect::<Result<Vec<_>, _>>()?;
+    // ids of the games this run inserts, for tournaments to refer to
+    diesel::sql_query("CREATE TEMPORARY TABLE fixture_games (id int NOT NULL)").execute(conn)?;
+    // players are picked from every fixture user's id with a stride (in bigint, since i * stride
+    // overflows an int), so owners and opponents are spread across all of them. Ids aren't
+    // assumed to be contiguous, since earlier seeds and other users take ids from the sequence.
+    // about 1% of games are active, and 10% are private
+    diesel::sql_query(
+        "WITH fixture_users AS ( \
+             SELECT array_agg(id ORDER BY id) AS ids FROM users \
+             WHERE left(username, length($3)) = $3 \
+         ), inserted AS ( \
+             INSERT INTO db_games (title, state, owner_id, players, active, is_public) \
+             SELECT 'Fixture Game ' || i, \
+                    CASE WHEN i % 20 = 0 THEN NULL ELSE ($1::text[])[(1 + i % $2)::int] END, \
+                    u.ids[(1 + (i * 7919) % cardinality(u.ids))::int], \
+                    CASE WHEN i % 20 = 0 THEN '[]' \
+                         ELSE '[' || u.ids[(1 + (i * 7919) % cardinality(u.ids))::int] || ',' \
+                              || u.ids[(1 + (i * 104729 + 1) % cardinality(u.ids))::int] || ']' END, \
+                    CASE WHEN i % 100 = 0 THEN 1 ELSE 0 END, \
+                    i % 10 <> 0 \
+             FROM generate_series(1::bigint, $4) AS i, fixture_users AS u \
+             RETURNING id \
+         ) \
+         INSERT INTO fixture_games SELECT id FROM inserted",
+    )
+    .bind::<Array<Text>, _>(&states)
+    .bind::<Integer, _>(DISTINCT_STATES as i32)
+    .bind::<Text, _>(USERNAME_PREFIX)
+    .bind::<Integer, _>(volumes.games)
+    .execute(conn)?;
+
+    // tournaments of 8 to 32 players, half with their games created
+    diesel::sql_query(
+        "WITH fixture_users AS ( \
+             SELECT array_agg(id ORDER BY id) AS ids FROM users \
+             WHERE left(username, length($1)) = $1 \
+         ), games AS ( \
+             SELECT array_agg(id ORDER BY id) AS ids FROM fixture_games \
+         ) \
+         INSERT INTO tournaments (name, players, games, owner_id) \
+         SELECT 'Fixture Tournament ' || i, \
+                ARRAY(SELECT u.ids[1 + (i * 31 + p * 7919) % cardinality(u.ids)] \
+                      FROM generate_series(1, 8 + i % 25) AS p), \
+                CASE WHEN i % 2 = 0 OR g.ids IS NULL THEN NULL \
+                     ELSE ARRAY(SELECT g.ids[1 + (i * 131 + p * 104729) % cardinality(g.ids)] \
+                                FROM generate_series(1, 8 + i % 25) AS p) END, \
+                u.ids[1 + i % cardinality(u.ids)] \
+         FROM generate_series(1, $2) AS i, fixture_users AS u, games AS g",
+    )
+    .bind::<Text, _>(USERNAME_PREFIX)
+    .bind::<Integer, _>(volumes.tournaments)
+    .execute(conn)?;
+    diesel::sql_query("DROP TABLE fixture_games").execute(conn)?;
+
+    diesel::sql_query(
+        "INSERT INTO pages (url, content) \
+         SELECT $1 || 'page/' || i, repeat('Fixture page ' || i || '. ', 200) \
+         FROM generate_series(1, $2) AS i \
+         WHERE NOT EXISTS (SELECT 1 FROM pages WHERE url = $1 || 'page/' || i)",
+    )
+    .bind::<Text, _>(PAGE_PREFIX)
+    .bind::<Integer, _>(volumes.pages)
+    .execute(conn)?;
+
+    // refresh planner statistics, so plans reflect the new volumes
+    diesel::sql_query("ANALYZE").execute(conn)?;
+
+    Ok(())
+}
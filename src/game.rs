@@ -1,5 +1,4 @@
-use core::fmt::Display;
-use rocket::request::FromForm;
+use core::fmt::{Debug, Display};
 use serde::de::DeserializeOwned;
 use serde::Serialize;
 use std::ops::Add;
@@ -13,9 +12,20 @@ pub enum GameOutcome {
     None,
 }
 
+/// A move that can be packed into a fixed number of bytes
+pub trait BinaryMove: Sized {
+    /// Number of bytes in an encoded move
+    const ENCODED_LEN: usize;
+
+    /// Write the move into out, which is ENCODED_LEN bytes long
+    fn encode(&self, out: &mut [u8]);
+    /// Read a move from bytes, which are ENCODED_LEN bytes long. Returns None if the bytes aren't a valid move
+    fn decode(bytes: &[u8]) -> Option<Self>;
+}
+
 /// Some type of game. It is expected to be turn based, and eventually reach an end state.
 pub trait Game: Clone {
-    type Move: for<'f> FromForm<'f>;
+    type Move: Clone + PartialEq + Debug + Serialize + DeserializeOwned + BinaryMove;
     type Score: Add + Serialize + Display;
     type State: Serialize + DeserializeOwned;
 
@@ -34,8 +44,40 @@ pub trait Game: Clone {
     fn waiting_on(&self, player: GamePlayer) -> bool;
     /// Make a move for the given player. If the move is legal, make it and return true. If not, return false.
     fn make_move(&mut self, player: GamePlayer, move_to_make: &Self::Move) -> bool;
+    /// Undo a move, which must be the last move successfully made with make_move by player.
+    fn undo_move(&mut self, player: GamePlayer, move_made: &Self::Move);
+    /// Clear moves and fill it with the legal moves for player. Reusing the buffer between calls avoids allocation.
+    fn legal_moves(&self, player: GamePlayer, moves: &mut Vec<Self::Move>);
+    /// Hash of the position, maintained incrementally by make_move and undo_move
+    fn hash(&self) -> u64;
+    /// Hash that is the same for every position equivalent to this one under the game's board
+    /// symmetries (rotations and reflections), for caches and statistics keyed on positions.
+    /// Games without symmetries can use the default, which is just hash
+    fn canonical_hash(&self) -> u64 {
+        self.hash()
+    }
     /// Get the score for each player. If scores are not available at the current point in the game, return None.
     fn scores(&self) -> Option<Vec<Self::Score>>;
     /// get the game outcome, or None if game doesn't have outcome yet
     fn outcome(&self) -> GameOutcome;
 }
+
+/// A game where players build lines of pieces, which can report the lines each player is close to
+/// completing
+pub trait Threats: Game {
+    type Threat: Serialize;
+    type Counts: Serialize;
+
+    /// Number of each kind of threat player has. This is maintained by make_move and undo_move,
+    /// so it is cheap enough to call from a search
+    fn threat_counts(&self, player: GamePlayer) -> Self::Counts;
+    /// Every threat player has, strongest first
+    fn threats(&self, player: GamePlayer) -> Vec<Self::Threat>;
+}
+
+/// A game with an engine that chooses moves for many positions at once, which is faster than
+/// choosing for each position on its own
+pub trait BatchMoves: Game {
+    /// Choose a move for each (position, player to move)
+    fn choose_moves(positions: &[(&Self, GamePlayer)]) -> Vec<Self::Move>;
+}
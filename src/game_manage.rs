@@ -1,23 +1,40 @@
-use crate::game::{Game, GameOutcome, GamePlayer};
+use crate::broadcast::{
+    self, Feed, FeedSubscriber, Format, Hub, StreamError, Subscriber, STREAM_FRAME,
+};
+use crate::game::{BinaryMove, Game, GameOutcome, GamePlayer, Threats};
+use crate::handoff::{
+    self, read_bytes, read_i32, read_string, read_u32, write_bytes, write_i32, write_u32,
+};
+use crate::journal::{Commit, Journal};
+use crate::metrics;
 use crate::models::{DbGame, InsertDbGame, NewDbGame, NewTournament, Tournament, User};
+use crate::presence::PRESENCE;
 use crate::shared::{DBConn, Error, ErrorResp, IdResp, SuccessResp};
 use crate::users::{ForwardingUser, PlayerId};
 use crate::TOURNAMENT_GAME_PLAYERS;
 use core::fmt::Debug;
+use diesel::pg::PgConnection;
 use diesel::prelude::*;
 use itertools::Itertools;
 use rocket::request::Form;
+use rocket::response::{Content, Stream};
 use rocket::State;
 use rocket_contrib::json::Json;
 use serde::{Deserialize, Serialize};
-use std::collections::HashMap;
+use std::collections::{HashMap, HashSet};
 use std::convert::{From, TryFrom};
-use std::sync::{RwLock, RwLockWriteGuard};
+use std::io::{self, Read, Write};
+use std::sync::{Arc, Mutex, RwLock, RwLockWriteGuard};
+use std::time::Instant;
 
 #[derive(PartialEq, Eq, Copy, Clone, Hash, Serialize, Deserialize, Default, Debug)]
 pub struct GameId(i32);
 
 impl GameId {
+    pub fn new(id: i32) -> GameId {
+        GameId(id)
+    }
+
     fn id(&self) -> i32 {
         self.0
     }
@@ -44,8 +61,47 @@ impl ToString for TournamentId {
     }
 }
 
+/// max number of nodes in a player's premove tree
+const MAX_PREMOVES: usize = 256;
+
+/// A conditional move: if the opponent plays opponent_move, reply with reply, then continue with the premoves in then
+#[derive(Clone, Debug, Serialize, Deserialize)]
+pub struct Premove<M> {
+    opponent_move: M,
+    reply: M,
+    #[serde(default)]
+    then: Vec<Premove<M>>,
+}
+
+impl<M> Premove<M> {
+    /// number of nodes in a premove tree
+    fn count(tree: &[Premove<M>]) -> usize {
+        tree.iter().map(|p| 1 + Premove::count(&p.then)).sum()
+    }
+}
+
+/// A game update streamed to spectators
+#[derive(Serialize)]
+struct WatchFrame<S> {
+    seq: u64,
+    state: Option<S>,
+    player_ids: Vec<i32>,
+    started: bool,
+    active: bool,
+    waiting_on: Vec<bool>,
+}
+
+/// A game in the wall feed, seen from player 0's side
+#[derive(Serialize)]
+struct WallGame<S> {
+    id: i32,
+    state: S,
+    player_ids: Vec<i32>,
+    active: bool,
+}
+
 #[derive(Clone, Debug)]
-struct GameInstance<G: Game> {
+pub struct GameInstance<G: Game> {
     /// If the game has not yet started, game is None
     game: Option<Box<G>>,
     /// Players currently in the game
@@ -55,9 +111,71 @@ struct GameInstance<G: Game> {
     id: GameId,
 
     is_public: bool,
+    /// Premove trees for each player (indexed by GamePlayer). These are only kept in memory
+    premoves: Vec<Vec<Premove<G::Move>>>,
+    /// when the last move was made (if it was made by this process)
+    last_move_at: Option<Instant>,
+    /// every move made, in order, in BinaryMove encoding
+    moves: Vec<u8>,
+}
+
+/// append a move to an encoded move history
+fn record_move<M: BinaryMove>(moves: &mut Vec<u8>, m: &M) {
+    let start = moves.len();
+    moves.resize(start + M::ENCODED_LEN, 0);
+    m.encode(&mut moves[start..]);
 }
 
 impl<G: Game> GameInstance<G> {
+    /// the game's state, if it has started
+    pub fn game(&self) -> Option<&G> {
+        self.game.as_deref()
+    }
+    pub fn players(&self) -> &[PlayerId] {
+        &self.players
+    }
+    /// check if the game has started and finished
+    fn finished(&self) -> bool {
+        self.game.as_ref().map_or(false, |g| g.finished())
+    }
+    /// encode the game as seen by perspective, for streaming to spectators
+    fn watch_frame(&self, seq: u64, perspective: GamePlayer, format: Format) -> Vec<u8> {
+        let frame = WatchFrame {
+            seq,
+            state: self.game.as_ref().map(|g| g.state(perspective)),
+            player_ids: self.players.iter().map(|id| id.id()).collect(),
+            started: self.started(),
+            active: self.active(),
+            waiting_on: (0..self.players.len())
+                .map(|p| {
+                    self.game
+                        .as_ref()
+                        .map_or(false, |g| !g.finished() && g.waiting_on(p as u32))
+                })
+                .collect(),
+        };
+        broadcast::frame(format, &serde_json::to_vec(&frame).unwrap_or_default())
+    }
+    /// whether the game belongs in the wall feed: public and started
+    fn on_wall(&self) -> bool {
+        self.is_public && self.started()
+    }
+    /// the game's (id, version, finished, json) for the wall feed. Its version is the length of
+    /// its move record, which only grows
+    fn wall_entry(&self) -> (i32, u64, bool, String) {
+        let entry = WallGame {
+            id: self.id.0,
+            state: self.game.as_ref().map(|g| g.state(0)),
+            player_ids: self.players.iter().map(|id| id.id()).collect(),
+            active: self.active(),
+        };
+        (
+            self.id.0,
+            self.moves.len() as u64,
+            self.finished(),
+            serde_json::to_string(&entry).unwrap_or_default(),
+        )
+    }
     /// check if the game has been started
     fn started(&self) -> bool {
         match &self.game {
@@ -80,6 +198,104 @@ impl<G: Game> GameInstance<G> {
             .position(|id| *id == player)
             .map_or(Err(Error::NotJoinedGame), |index| Ok(index as u32))?)
     }
+    /// set the premove tree for a player. It will be responded from after the opponent's next move
+    fn set_premoves(&mut self, player: GamePlayer, tree: Vec<Premove<G::Move>>) {
+        if self.premoves.len() < self.players.len() {
+            self.premoves.resize(self.players.len(), vec![]);
+        }
+        self.premoves[player as usize] = tree;
+    }
+    /// play premoves responding to last_move for as long as the players on move have matching ones.
+    /// A player's tree is discarded if their opponent plays a move not in it
+    fn apply_premoves(&mut self, mut last_move: G::Move) {
+        while let Some(game) = self.game.as_mut() {
+            if game.finished() {
+                break;
+            }
+            let player = match (0..self.players.len()).find(|p| game.waiting_on(*p as u32)) {
+                Some(p) => p,
+                None => break,
+            };
+            let tree = match self.premoves.get_mut(player) {
+                Some(tree) => std::mem::replace(tree, vec![]),
+                None => break,
+            };
+            let premove = match tree.into_iter().find(|p| p.opponent_move == last_move) {
+                Some(p) => p,
+                None => break,
+            };
+            if !game.make_move(player as u32, &premove.reply) {
+                break;
+            }
+            record_move(&mut self.moves, &premove.reply);
+            self.premoves[player] = premove.then;
+            last_move = premove.reply;
+        }
+    }
+}
+
+impl<G: Game> GameInstance<G> {
+    /// write the instance in the binary handoff snapshot format
+    fn write_snapshot<W: Write>(&self, w: &mut W) -> io::Result<()> {
+        write_i32(w, self.id.0)?;
+        write_i32(w, self.owner.id())?;
+        w.write_all(&[self.is_public as u8])?;
+        write_bytes(w, self.name.as_bytes())?;
+        write_u32(w, self.players.len() as u32)?;
+        for player in &self.players {
+            write_i32(w, player.id())?;
+        }
+        match &self.game {
+            Some(g) => write_bytes(w, &serde_json::to_vec(&g.state(0))?)?,
+            None => write_bytes(w, &[])?,
+        }
+        write_bytes(w, &serde_json::to_vec(&self.premoves)?)?;
+        write_bytes(w, &self.moves)
+    }
+
+    /// the instance as a journal record (in the snapshot format)
+    fn journal_record(&self) -> Vec<u8> {
+        let mut record = Vec::new();
+        // writing to a vec only fails if the state can't be serialized
+        self.write_snapshot(&mut record).unwrap();
+        record
+    }
+
+    /// read an instance written by write_snapshot
+    fn read_snapshot<R: Read>(r: &mut R) -> io::Result<GameInstance<G>> {
+        let id = GameId(read_i32(r)?);
+        let owner = PlayerId::new(read_i32(r)?);
+        let mut is_public = [0];
+        r.read_exact(&mut is_public)?;
+        let name = read_string(r)?;
+        let num_players = read_u32(r)?;
+        let players = (0..num_players)
+            .map(|_| Ok(PlayerId::new(read_i32(r)?)))
+            .collect::<io::Result<Vec<PlayerId>>>()?;
+        let state = read_bytes(r)?;
+        let game = if state.is_empty() {
+            None
+        } else {
+            Some(Box::new(G::from_state(
+                serde_json::from_slice(&state)?,
+                players.len(),
+            )))
+        };
+        let premoves = serde_json::from_slice(&read_bytes(r)?)?;
+        let moves = read_bytes(r)?;
+
+        Ok(GameInstance {
+            game,
+            players,
+            name,
+            owner,
+            id,
+            is_public: is_public[0] != 0,
+            premoves,
+            last_move_at: None,
+            moves,
+        })
+    }
 }
 
 impl<G: Game> TryFrom<DbGame> for GameInstance<G> {
@@ -103,6 +319,9 @@ impl<G: Game> TryFrom<DbGame> for GameInstance<G> {
             name: entry.title,
             owner: PlayerId::new(entry.owner_id),
             is_public: entry.is_public,
+            premoves: vec![],
+            last_move_at: None,
+            moves: entry.moves,
         })
     }
 }
@@ -125,110 +344,301 @@ impl<'a, G: Game> From<&'a GameInstance<G>> for InsertDbGame<'a> {
             players,
             active: if inst.active() { 1 } else { 0 },
             is_public: inst.is_public,
+            moves: &inst.moves,
         }
     }
 }
 
 pub struct GameManager<G: Game> {
     active_games: HashMap<GameId, GameInstance<G>>,
+    /// spectators watching games
+    hub: Arc<Hub>,
+    /// spectators watching every game at once
+    feed: Arc<Feed>,
+    /// if set, saves of active games are journaled, and written to the db later by the flusher
+    journal: Option<Arc<Journal>>,
+    /// games journaled since they were last written to the db
+    dirty: HashSet<GameId>,
 }
 
 impl<G: Game> Default for GameManager<G> {
     fn default() -> GameManager<G> {
         GameManager {
             active_games: HashMap::new(),
+            hub: Arc::new(Hub::default()),
+            feed: Arc::new(Feed::default()),
+            journal: None,
+            dirty: HashSet::new(),
         }
     }
 }
 
-struct AppState<'a, G: Game> {
-    manager: &'a RwLock<GameManager<G>>,
-    db: DBConn,
-}
+impl<G: Game> GameManager<G> {
+    /// number of games cached in memory (ie -- games in progress)
+    pub fn active_count(&self) -> usize {
+        self.active_games.len()
+    }
 
-impl<'a, G: Game> AppState<'a, G> {
-    #[allow(unused_must_use)]
-    pub fn new(db: DBConn, manager: &'a RwLock<GameManager<G>>) -> Self {
-        AppState { db, manager }
+    /// games cached in memory that are waiting on a move by player. Returns each game's id,
+    /// player's index in it, and a copy of its state
+    pub fn waiting_on(&self, player_id: PlayerId) -> Vec<(GameId, GamePlayer, G)> {
+        self.active_games
+            .values()
+            .filter(|game| game.active())
+            .filter_map(|game| {
+                let index = game.players.iter().position(|p| *p == player_id)? as GamePlayer;
+                match &game.game {
+                    Some(g) if g.waiting_on(index) => Some((game.id, index, (**g).clone())),
+                    _ => None,
+                }
+            })
+            .collect()
     }
 
-    /// load a game from the database (only, not active_games)
-    fn load_game_from_db(&self, game_id: GameId) -> Result<GameInstance<G>, Error> {
+    /// journal saves of active games, instead of writing them to the db
+    pub fn set_journal(&mut self, journal: Arc<Journal>) {
+        self.journal = Some(journal);
+    }
+
+    /// the games journaled since they were last written to the db, which the caller must write
+    pub fn take_dirty(&mut self) -> Vec<GameInstance<G>> {
+        let active_games = &self.active_games;
+        // finished games aren't in active_games, but were written to the db when they finished
+        self.dirty
+            .drain()
+            .filter_map(|id| active_games.get(&id).cloned())
+            .collect()
+    }
+
+    /// mark games taken by take_dirty as still needing to be written
+    pub fn restore_dirty(&mut self, games: &[GameInstance<G>]) {
+        self.dirty.extend(games.iter().map(|game| game.id));
+    }
+
+    /// write active_games for handoff to a new process
+    pub fn write_snapshot<W: Write>(&self, w: &mut W) -> io::Result<()> {
+        write_u32(w, self.active_games.len() as u32)?;
+        for game in self.active_games.values() {
+            game.write_snapshot(w)?;
+        }
+        Ok(())
+    }
+
+    /// load active_games handed off from an old process
+    pub fn read_snapshot<R: Read>(&mut self, r: &mut R) -> io::Result<()> {
+        let num_games = read_u32(r)?;
+        let games = (0..num_games)
+            .map(|_| GameInstance::<G>::read_snapshot(r))
+            .collect::<io::Result<Vec<GameInstance<G>>>>()?;
+        self.active_games
+            .extend(games.into_iter().map(|game| (game.id, game)));
+        Ok(())
+    }
+}
+
+/// Where games are persisted. The app stores games in the database
+pub trait GameStore<G: Game> {
+    fn load_game(&self, game_id: GameId) -> Result<GameInstance<G>, Error>;
+    fn save_game(&self, game: &GameInstance<G>) -> Result<(), Error>;
+}
+
+impl<'c, G: Game> GameStore<G> for &'c PgConnection {
+    fn load_game(&self, game_id: GameId) -> Result<GameInstance<G>, Error> {
         use crate::schema::db_games;
 
         db_games::dsl::db_games
             .find(&game_id.0)
-            .first::<DbGame>(&*self.db)
+            .first::<DbGame>(*self)
             .map_or_else(
                 |err| Err(Error::DBError(err)),
                 |entry| Ok(GameInstance::<G>::try_from(entry)?),
             )
     }
 
-    /// save a game to the database
-    fn save_game_to_db<'l>(
-        &self,
-        game: &GameInstance<G>,
-        manager_lock: RwLockWriteGuard<'l, GameManager<G>>,
-    ) -> Result<RwLockWriteGuard<'l, GameManager<G>>, Error> {
+    fn save_game(&self, game: &GameInstance<G>) -> Result<(), Error> {
         use crate::schema::db_games;
-        let new_entry = InsertDbGame::from(game);
 
-        let res = diesel::update(db_games::dsl::db_games.find(game.id.id()))
+        let new_entry = InsertDbGame::from(game);
+        diesel::update(db_games::dsl::db_games.find(game.id.id()))
             .set(&new_entry)
-            .execute(&*self.db)
-            .map_or_else(|e| Err(Error::DBError(e)), |_| Ok(manager_lock));
+            .execute(*self)?;
+        Ok(())
+    }
+}
+
+/// write games saved in the journal to the db, in one transaction. A game isn't written if its row
+/// has more moves, since the row was saved later (when the game finished)
+pub fn write_back<G: Game>(conn: &PgConnection, games: &[GameInstance<G>]) -> Result<(), Error> {
+    use crate::schema::db_games;
+    use diesel::dsl::sql;
+    use diesel::sql_types::{Bool, Integer};
+
+    conn.transaction::<_, Error, _>(|| {
+        for game in games {
+            let newer =
+                sql::<Bool>("octet_length(moves) <= ").bind::<Integer, _>(game.moves.len() as i32);
+            diesel::update(db_games::dsl::db_games.find(game.id.id()).filter(newer))
+                .set(&InsertDbGame::from(game))
+                .execute(conn)?;
+        }
+        Ok(())
+    })
+}
 
-        res
+/// decode journal records, and write the latest save of each game to the db. Returns the number
+/// of games written
+pub fn replay_journal<G: Game>(conn: &PgConnection, records: &[Vec<u8>]) -> Result<usize, Error> {
+    let mut latest = HashMap::new();
+    for record in records {
+        let game =
+            GameInstance::<G>::read_snapshot(&mut &record[..]).map_err(|_| Error::JournalFailed)?;
+        latest.insert(game.id, game);
     }
+    let games = latest.into_iter().map(|(_, game)| game).collect::<Vec<_>>();
+    write_back(conn, &games)?;
+    Ok(games.len())
+}
 
-    /// create a new game entry in the db and in active_games
-    fn new_game(&self, name: &str, owner: PlayerId) -> Result<GameId, Error> {
-        use crate::schema::db_games;
+impl<G: Game> GameStore<G> for DBConn {
+    fn load_game(&self, game_id: GameId) -> Result<GameInstance<G>, Error> {
+        (&**self as &PgConnection).load_game(game_id)
+    }
 
-        let game = NewDbGame {
-            players: serde_json::to_string(&Vec::<Vec<String>>::new())?,
-            active: 1,
-            owner_id: owner.id(),
-            title: name,
-            state: None,
-            is_public: true,
-        };
+    fn save_game(&self, game: &GameInstance<G>) -> Result<(), Error> {
+        (&**self as &PgConnection).save_game(game)
+    }
+}
 
-        let inserted_game = diesel::insert_into(db_games::table)
-            .values(&game)
-            .get_result::<DbGame>(&*self.db)?;
-        let id = GameId(inserted_game.id);
+/// A GameStore kept in memory, for benchmarking the game manager without a database.
+/// Games are ids 1 to len, and each has its own lock
+pub struct MemoryStore<G: Game> {
+    games: Vec<Mutex<GameInstance<G>>>,
+}
 
-        let mut manager = self.manager.write().unwrap();
-        manager.active_games.insert(
-            id,
-            GameInstance::<G> {
-                game: None,
-                players: vec![],
-                name: name.to_string(),
-                owner,
-                id,
-                is_public: inserted_game.is_public,
-            },
-        );
+impl<G: Game> MemoryStore<G> {
+    /// create a store of len games owned by owner. The first started games are in progress between
+    /// players, and the rest are waiting for players to join
+    pub fn new(len: usize, started: usize, players: &[PlayerId], owner: PlayerId) -> Self {
+        MemoryStore {
+            games: (0..len)
+                .map(|i| {
+                    let mut game = GameInstance {
+                        game: None,
+                        players: vec![],
+                        name: format!("game {}", i + 1),
+                        owner,
+                        id: GameId(i as i32 + 1),
+                        is_public: true,
+                        premoves: vec![],
+                        last_move_at: None,
+                        moves: vec![],
+                    };
+                    if i < started {
+                        game.players = players.to_vec();
+                        game.game = Some(Box::new(G::new_with_players(players.len())));
+                    }
+                    Mutex::new(game)
+                })
+                .collect(),
+        }
+    }
 
-        Ok(id)
+    /// replace a game with a freshly started one
+    pub fn restart(&self, game_id: GameId) {
+        if let Some(slot) = self.games.get((game_id.0 as usize).wrapping_sub(1)) {
+            let mut game = slot.lock().unwrap();
+            game.game = Some(Box::new(G::new_with_players(game.players.len())));
+        }
+    }
+}
+
+impl<'s, G: Game> GameStore<G> for &'s MemoryStore<G> {
+    fn load_game(&self, game_id: GameId) -> Result<GameInstance<G>, Error> {
+        match self.games.get((game_id.0 as usize).wrapping_sub(1)) {
+            Some(game) => Ok(game.lock().unwrap().clone()),
+            None => Err(Error::DBError(diesel::result::Error::NotFound)),
+        }
+    }
+
+    fn save_game(&self, game: &GameInstance<G>) -> Result<(), Error> {
+        match self.games.get((game.id.0 as usize).wrapping_sub(1)) {
+            Some(slot) => {
+                *slot.lock().unwrap() = game.clone();
+                Ok(())
+            }
+            None => Err(Error::DBError(diesel::result::Error::NotFound)),
+        }
+    }
+}
+
+pub struct AppState<'a, G: Game, S = DBConn> {
+    manager: &'a RwLock<GameManager<G>>,
+    db: S,
+}
+
+impl<'a, G: Game, S: GameStore<G>> AppState<'a, G, S> {
+    #[allow(unused_must_use)]
+    pub fn new(db: S, manager: &'a RwLock<GameManager<G>>) -> Self {
+        AppState { db, manager }
+    }
+
+    /// lock the game manager, recording how long it took to get the lock
+    fn lock_manager(&self) -> RwLockWriteGuard<GameManager<G>> {
+        let start = Instant::now();
+        let manager = self.manager.write().unwrap();
+        metrics::LOCK_WAIT.record(start.elapsed());
+        manager
+    }
+
+    /// load a game from the store (only, not active_games)
+    fn load_game_from_db(&self, game_id: GameId) -> Result<GameInstance<G>, Error> {
+        self.db.load_game(game_id)
+    }
+
+    /// save a game to the store. With a journal, saves of active games are journaled and left for
+    /// the flusher to write, and aren't durable until the returned commit is waited on (which
+    /// should be done after releasing the lock). Other saves are written to the store right away
+    fn save_game_to_db<'l>(
+        &self,
+        game: &GameInstance<G>,
+        mut manager_lock: RwLockWriteGuard<'l, GameManager<G>>,
+    ) -> Result<(RwLockWriteGuard<'l, GameManager<G>>, Option<Commit>), Error> {
+        // state has been handed off to a new process, which has its own copy of the game cached
+        if handoff::draining() {
+            return Err(Error::ServerDraining);
+        }
+        let commit = match &manager_lock.journal {
+            Some(journal) if game.active() => {
+                Some(Journal::append(journal, &game.journal_record())?)
+            }
+            _ => None,
+        };
+        if commit.is_some() {
+            manager_lock.dirty.insert(game.id);
+        } else {
+            // replaying older saves from the journal won't undo this, since they have fewer moves
+            self.db.save_game(game)?;
+            manager_lock.dirty.remove(&game.id);
+        }
+
+        Ok((manager_lock, commit))
     }
 
     /// get the game with the given id.
     /// possibly loads it from the database/cache, and may remove or insert it into the cache
-    fn get_game(&self, game_id: GameId) -> Result<GameInstance<G>, Error> {
+    pub fn get_game(&self, game_id: GameId) -> Result<GameInstance<G>, Error> {
         // check active_games for cached game
-        let mut manager = self.manager.write().unwrap();
+        let mut manager = self.lock_manager();
         let cached = manager.active_games.get(&game_id);
         match cached {
             Some(game) => {
                 let res = game.clone();
                 // if game isn't active, remove from active games
                 if !res.active() {
-                    let mut manager = self.save_game_to_db(&res, manager)?;
+                    let (mut manager, commit) = self.save_game_to_db(&res, manager)?;
                     manager.active_games.remove(&game_id);
+                    drop(manager);
+                    Commit::wait(commit)?;
                 }
 
                 Ok(res)
@@ -247,22 +657,126 @@ impl<'a, G: Game> AppState<'a, G> {
 
     /// save a game
     /// possibly saves to the cache or db
-    fn save_game(&self, game: GameInstance<G>) -> Result<(), Error> {
-        let manager = self.manager.write().unwrap();
+    pub fn save_game(&self, game: GameInstance<G>) -> Result<(), Error> {
+        self.save_game_locked(game, self.lock_manager())
+    }
+
+    /// save a game, with the manager already locked. Releases the lock before waiting for the
+    /// save to be durable
+    fn save_game_locked(
+        &self,
+        game: GameInstance<G>,
+        manager: RwLockWriteGuard<GameManager<G>>,
+    ) -> Result<(), Error> {
+        // updates are encoded for spectators after the lock is released
+        let hub = if manager.hub.watched(game.id.0) {
+            Some(manager.hub.clone())
+        } else {
+            None
+        };
+        let feed = if game.on_wall() && manager.feed.active() {
+            Some(manager.feed.clone())
+        } else {
+            None
+        };
+        let watched = if hub.is_some() || feed.is_some() {
+            Some(game.clone())
+        } else {
+            None
+        };
+        let (mut manager, commit) = self.save_game_to_db(&game, manager)?;
         if game.active() {
-            // TODO: this isn't needed, but cache needs to be flushed to db when app is shut down
-            let mut manager = self.save_game_to_db(&game, manager)?;
             manager.active_games.insert(game.id, game);
         } else {
-            let mut manager = self.save_game_to_db(&game, manager)?;
             manager.active_games.remove(&game.id);
         }
+        // other saves can be journaled (and synced in the same batch) while this one waits
+        drop(manager);
+        Commit::wait(commit)?;
+
+        if let Some(game) = watched {
+            if let Some(hub) = hub {
+                let version = game.moves.len() as u64;
+                hub.publish(
+                    game.id.0,
+                    version,
+                    game.finished(),
+                    |seq, (perspective, format)| game.watch_frame(seq, perspective, format),
+                );
+            }
+            if let Some(feed) = feed {
+                let (id, version, finished, json) = game.wall_entry();
+                feed.publish(id, version, finished, json);
+            }
+        }
 
         Ok(())
     }
 
+    /// set a player's premove tree on the cached game, without saving it to the db. It's set in
+    /// place, so a move made meanwhile isn't undone. If moves is given, the game must still be at
+    /// that many moves, the position the tree was made for
+    pub fn set_premoves(
+        &self,
+        game_id: GameId,
+        player_id: PlayerId,
+        tree: Vec<Premove<G::Move>>,
+        moves: Option<usize>,
+    ) -> Result<(), Error> {
+        if Premove::count(&tree) > MAX_PREMOVES {
+            return Err(Error::PremovesTooLarge);
+        }
+        // loads the game into active_games if it's active
+        self.get_game(game_id)?;
+
+        let mut manager = self.lock_manager();
+        if handoff::draining() {
+            return Err(Error::ServerDraining);
+        }
+        // the game may have finished since it was loaded
+        let game = match manager.active_games.get_mut(&game_id) {
+            Some(game) if game.active() => game,
+            _ => return Err(Error::GameNotStarted),
+        };
+        let player_index = game.get_player_index(player_id)?;
+        if moves.map_or(false, |m| m * G::Move::ENCODED_LEN != game.moves.len()) {
+            return Err(Error::StalePremoves);
+        }
+        game.set_premoves(player_index, tree);
+        Ok(())
+    }
+
+    /// start streaming a game to a player, who sees it from their own side (or to a spectator).
+    /// Saves take the manager write lock and publish after releasing it, so holding the lock
+    /// while subscribing means every save after the first frame reaches the subscriber
+    pub fn watch_game(
+        &self,
+        game_id: GameId,
+        player_id: PlayerId,
+        format: Format,
+    ) -> Result<Subscriber, Error> {
+        let manager = self.manager.read().unwrap();
+        let loaded;
+        let game = match manager.active_games.get(&game_id) {
+            Some(game) => game,
+            None => {
+                loaded = self.load_game_from_db(game_id)?;
+                &loaded
+            }
+        };
+        let perspective = game.get_player_index(player_id).unwrap_or(0);
+        Hub::subscribe(
+            &manager.hub,
+            game_id.0,
+            (perspective, format),
+            game.moves.len() as u64,
+            game.started() && !game.active(),
+            |seq| game.watch_frame(seq, perspective, format),
+        )
+    }
+
     /// add a player to the given game
-    fn join_game(&self, game_id: GameId, player_id: PlayerId) -> Result<(), Error> {
+    pub fn join_game(&self, game_id: GameId, player_id: PlayerId) -> Result<(), Error> {
         let mut game = self.get_game(game_id)?;
         if game.active() {
             Err(Error::GameAlreadyStarted)
@@ -279,7 +793,7 @@ impl<'a, G: Game> AppState<'a, G> {
     }
 
     /// remove a player from the given game (if it has not started)
-    fn leave_game(&self, game_id: GameId, player_id: PlayerId) -> Result<(), Error> {
+    pub fn leave_game(&self, game_id: GameId, player_id: PlayerId) -> Result<(), Error> {
         let mut game = self.get_game(game_id)?;
 
         if !game.players.contains(&player_id) {
@@ -298,7 +812,7 @@ impl<'a, G: Game> AppState<'a, G> {
 
     /// start the game with the given id (ie -- give it a state)
     /// player_id must be the owner of the game
-    fn start_game(&self, game_id: GameId, player_id: PlayerId) -> Result<(), Error> {
+    pub fn start_game(&self, game_id: GameId, player_id: PlayerId) -> Result<(), Error> {
         let mut game = self.get_game(game_id)?;
 
         if game.owner != player_id {
@@ -318,17 +832,104 @@ impl<'a, G: Game> AppState<'a, G> {
         }
     }
 
-    /// get a list of all games ids in descending order
-    fn list_games(&self) -> Result<Vec<i32>, Error> {
+    /// make a move in a game for a player, and then any premoves it triggers
+    pub fn play_move(
+        &self,
+        game_id: GameId,
+        player_id: PlayerId,
+        player_move: G::Move,
+    ) -> Result<(), Error> {
+        // loads the game into active_games if it's active
+        self.get_game(game_id)?;
+
+        // the move is made on the cached game and saved under one lock, so a concurrent move or
+        // set_premoves is either seen by this one or sees it
+        let manager = self.lock_manager();
+        let mut game = match manager.active_games.get(&game_id) {
+            Some(game) if game.active() => game.clone(),
+            _ => return Err(Error::WrongTurn),
+        };
+        let player_index = game.get_player_index(player_id)?;
+        match game.game.as_mut() {
+            Some(game_int) => {
+                if !game_int.waiting_on(player_index) {
+                    Err(Error::WrongTurn)
+                } else if game_int.make_move(player_index, &player_move) {
+                    record_move(&mut game.moves, &player_move);
+                    if let Some(last_move_at) = game.last_move_at {
+                        metrics::record_move_time(player_id.id(), last_move_at.elapsed());
+                    }
+                    game.apply_premoves(player_move);
+                    game.last_move_at = Some(Instant::now());
+                    self.save_game_locked(game, manager)
+                } else {
+                    Err(Error::InvalidMove)
+                }
+            }
+            None => Err(Error::GameNotStarted),
+        }
+    }
+}
+
+impl<'a, G: Game> AppState<'a, G, DBConn> {
+    /// create a new game entry in the db and in active_games
+    fn new_game(&self, name: &str, owner: PlayerId) -> Result<GameId, Error> {
+        use crate::schema::db_games;
+
+        if handoff::draining() {
+            return Err(Error::ServerDraining);
+        }
+
+        let game = NewDbGame {
+            players: serde_json::to_string(&Vec::<Vec<String>>::new())?,
+            active: 1,
+            owner_id: owner.id(),
+            title: name,
+            state: None,
+            is_public: true,
+        };
+
+        let inserted_game = diesel::insert_into(db_games::table)
+            .values(&game)
+            .get_result::<DbGame>(&*self.db)?;
+        let id = GameId(inserted_game.id);
+
+        let mut manager = self.lock_manager();
+        manager.active_games.insert(
+            id,
+            GameInstance::<G> {
+                game: None,
+                players: vec![],
+                name: name.to_string(),
+                owner,
+                id,
+                is_public: inserted_game.is_public,
+                premoves: vec![],
+                last_move_at: None,
+                moves: vec![],
+            },
+        );
+
+        Ok(id)
+    }
+
+    /// public game ids, newest first. Only ids below before, and at most limit of them, if given
+    fn list_games(&self, before: Option<i32>, limit: Option<i64>) -> Result<Vec<i32>, Error> {
         use crate::schema::db_games;
 
-        let ids = db_games::dsl::db_games
+        let mut query = db_games::dsl::db_games
             .filter(db_games::dsl::is_public.eq(true))
             .select(db_games::dsl::id)
             .order(db_games::id.desc())
-            .load::<i32>(&*self.db)?;
+            .into_boxed();
+        if let Some(before) = before {
+            query = query.filter(db_games::dsl::id.lt(before));
+        }
+        if let Some(limit) = limit {
+            query = query.limit(limit);
+        }
 
-        Ok(ids)
+        Ok(query.load::<i32>(&*self.db)?)
     }
 
     /// create a new tournament
@@ -411,138 +1012,336 @@ impl<'a, G: Game> AppState<'a, G> {
         }
     }
 
-    /// start a tournament and generate match schedule
+    /// start a tournament and generate match schedule. Games are created for every pairing, and
+    /// pairings of players who are online (see presence) are scheduled first and started right
+    /// away. The rest are left for the owner to start once their players are online, so games
+    /// against offline bots don't sit idle. Every game is created in one transaction with the
+    /// schedule, so a failed start leaves nothing behind and can be retried
     fn start_tournament(&self, id: TournamentId, player_id: PlayerId) -> Result<(), Error> {
-        let mut tournament = self.get_tournament(id)?;
+        use crate::schema::{db_games, tournaments};
 
-        if tournament.owner_id != player_id.id() {
-            Err(Error::NotGameOwner)
-        } else if tournament.games.is_some() {
-            Err(Error::GameAlreadyStarted)
-        } else {
-            for match_players in tournament
+        if handoff::draining() {
+            return Err(Error::ServerDraining);
+        }
+        let conn = &*self.db;
+        conn.transaction::<_, Error, _>(|| {
+            // locked, so a concurrent start waits for this one, then sees its games
+            let mut tournament = tournaments::dsl::tournaments
+                .find(id.0)
+                .for_update()
+                .first::<Tournament>(conn)?;
+            if tournament.owner_id != player_id.id() {
+                return Err(Error::NotGameOwner);
+            } else if tournament.games.is_some() {
+                return Err(Error::GameAlreadyStarted);
+            }
+
+            let mut pairings = tournament
                 .players
                 .iter()
+                .map(|id| PlayerId::new(*id))
                 .combinations(TOURNAMENT_GAME_PLAYERS)
-            {
-                // TODO
-            }
-
-            panic!("todo");
-
-            Ok(())
-        }
+                .map(|players| {
+                    let online = players.iter().all(|p| PRESENCE.is_online(*p));
+                    (online, players)
+                })
+                .collect::<Vec<_>>();
+            // stable, so the round robin order is kept within online and offline pairings
+            pairings.sort_by_key(|(online, _)| !online);
+
+            let start_state =
+                serde_json::to_string(&G::new_with_players(TOURNAMENT_GAME_PLAYERS).state(0))?;
+            let names = (1..=pairings.len())
+                .map(|n| format!("{} #{}", tournament.name, n))
+                .collect::<Vec<_>>();
+            let rows = pairings
+                .iter()
+                .zip(&names)
+                .map(|((online, players), name)| {
+                    Ok(NewDbGame {
+                        players: serde_json::to_string(
+                            &players.iter().map(|p| p.id()).collect::<Vec<_>>(),
+                        )?,
+                        active: 1,
+                        owner_id: player_id.id(),
+                        title: name,
+                        state: if *online {
+                            Some(start_state.clone())
+                        } else {
+                            None
+                        },
+                        is_public: true,
+                    })
+                })
+                .collect::<Result<Vec<_>, Error>>()?;
+            let games = diesel::insert_into(db_games::table)
+                .values(&rows)
+                .returning(db_games::id)
+                .get_results::<i32>(conn)?;
+
+            tournament.games = Some(games);
+            self.save_tournament(&tournament)
+        })
     }
 }
 
-pub type AppReqState<'a> = State<'a, RwLock<GameManager<crate::GameType>>>;
+pub type AppReqState<'a> = State<'a, Arc<RwLock<GameManager<crate::GameType>>>>;
 
 #[derive(Serialize, Debug)]
 pub struct GameResp<G: Game> {
-    name: String,
-    owner_id: i32,
-    state: Option<G::State>,
-    players: Vec<String>,
-    player_ids: Vec<i32>,
+    #[serde(skip_serializing_if = "Option::is_none")]
+    name: Option<String>,
+    #[serde(skip_serializing_if = "Option::is_none")]
+    owner_id: Option<i32>,
+    /// None if not requested, Some(None) if the game hasn't started
+    #[serde(skip_serializing_if = "Option::is_none")]
+    state: Option<Option<G::State>>,
+    #[serde(skip_serializing_if = "Option::is_none")]
+    players: Option<Vec<String>>,
+    #[serde(skip_serializing_if = "Option::is_none")]
+    player_ids: Option<Vec<i32>>,
+    #[serde(skip_serializing_if = "Option::is_none")]
+    active: Option<bool>,
+    #[serde(skip_serializing_if = "Option::is_none")]
+    started: Option<bool>,
+    #[serde(skip_serializing_if = "Option::is_none")]
+    waiting_on: Option<Vec<bool>>,
+    #[serde(skip_serializing_if = "Option::is_none")]
+    outcome: Option<String>,
+}
+
+/// The fields of GameResp a request asked for (with ?fields=a,b,c). Everything by default
+#[derive(Clone, Copy, Debug)]
+struct GameFields {
+    name: bool,
+    owner_id: bool,
+    state: bool,
+    players: bool,
+    player_ids: bool,
     active: bool,
     started: bool,
-    waiting_on: Vec<bool>,
-    outcome: String,
+    waiting_on: bool,
+    outcome: bool,
+}
+
+impl GameFields {
+    fn all(on: bool) -> GameFields {
+        GameFields {
+            name: on,
+            owner_id: on,
+            state: on,
+            players: on,
+            player_ids: on,
+            active: on,
+            started: on,
+            waiting_on: on,
+            outcome: on,
+        }
+    }
+
+    fn parse(fields: Option<&str>) -> Result<GameFields, Error> {
+        let fields = match fields {
+            Some(fields) => fields,
+            None => return Ok(GameFields::all(true)),
+        };
+        let mut res = GameFields::all(false);
+        for field in fields
+            .split(',')
+            .map(|f| f.trim())
+            .filter(|f| !f.is_empty())
+        {
+            match field {
+                "name" => res.name = true,
+                "owner_id" => res.owner_id = true,
+                "state" => res.state = true,
+                "players" => res.players = true,
+                "player_ids" => res.player_ids = true,
+                "active" => res.active = true,
+                "started" => res.started = true,
+                "waiting_on" => res.waiting_on = true,
+                "outcome" => res.outcome = true,
+                _ => return Err(Error::UnknownField),
+            }
+        }
+        Ok(res)
+    }
+}
+
+/// display name of a user
+fn display_name(db: &PgConnection, id: PlayerId) -> Result<String, Error> {
+    use crate::schema::users;
+
+    Ok(users::dsl::users
+        .find(id.id())
+        .select(users::dsl::display_name)
+        .first::<String>(db)?)
 }
 
+/// build the requested fields of a GameResp. Fields that weren't requested aren't computed, so
+/// a request for only the state of a cached game doesn't touch the database
 fn game_get_internal(
     player_id: i32,
     id: i32,
+    fields: Option<String>,
     db: DBConn,
     state: AppReqState,
 ) -> Result<Json<GameResp<crate::GameType>>, Json<ErrorResp>> {
+    let fields = GameFields::parse(fields.as_deref())?;
     let app = AppState::new(db, &*state);
 
     let game = app.get_game(GameId(id))?;
+    let conn: &PgConnection = &*app.db;
 
-    let players = game
-        .players
-        .iter()
-        .map(|id| -> Result<String, Error> {
-            use crate::schema::users;
+    let players = if fields.players {
+        Some(
+            game.players
+                .iter()
+                .map(|id| display_name(conn, *id))
+                .collect::<Result<Vec<String>, Error>>()?,
+        )
+    } else {
+        None
+    };
 
-            Ok(users::dsl::users
-                .find(id.id())
-                .first::<User>(&*app.db)?
-                .display_name)
-        })
-        .collect::<Result<Vec<String>, Error>>()?;
+    let waiting_on = if !fields.waiting_on {
+        None
+    } else if game.active() {
+        Some(
+            game.players
+                .iter()
+                .enumerate()
+                .map(|(index, _)| {
+                    game.game
+                        .as_ref()
+                        .map_or(false, |g| g.waiting_on(index as u32))
+                })
+                .collect::<Vec<bool>>(),
+        )
+    } else {
+        Some(Vec::<bool>::new())
+    };
 
-    let player_ids = game.players.iter().map(|id| id.id()).collect::<Vec<i32>>();
+    let outcome = if fields.outcome {
+        Some(match game.game.as_ref().map(|g| g.outcome()) {
+            Some(GameOutcome::Win(player)) => {
+                let winner = match &players {
+                    Some(players) => players[player as usize].clone(),
+                    None => display_name(conn, game.players[player as usize])?,
+                };
+                format!("{} Wins!", winner)
+            }
+            Some(GameOutcome::Tie) => "Game Tied!".to_string(),
+            Some(GameOutcome::Other(msg)) => msg,
+            Some(GameOutcome::None) | None => "No Outcome Yet".to_string(),
+        })
+    } else {
+        None
+    };
 
-    let waiting_on = if game.active() {
-        game.players
+    let state = if fields.state {
+        let game_player_display_for = game
+            .players
             .iter()
-            .enumerate()
-            .map(|(index, _)| {
-                game.game
-                    .as_ref()
-                    .map_or(false, |g| g.waiting_on(index as u32))
-            })
-            .collect::<Vec<bool>>()
+            .position(|id| id.id() == player_id)
+            .map_or(0, |index| index);
+        Some(
+            game.game
+                .as_ref()
+                .map(|game| game.state(game_player_display_for as u32)),
+        )
     } else {
-        Vec::<bool>::new()
+        None
     };
 
-    let game_player_display_for = player_ids
-        .iter()
-        .position(|id| *id == player_id)
-        .map_or(0, |index| index);
-
-    let outcome = game
-        .game
-        .as_ref()
-        .map_or(format!("No Outcome Yet"), |g| match g.outcome() {
-            GameOutcome::Win(player) => format!("{} Wins!", &players[player as usize]),
-            GameOutcome::Tie => format!("Game Tied!"),
-            GameOutcome::Other(msg) => msg,
-            GameOutcome::None => format!("No Outcome Yet"),
-        });
-
     Ok(Json(GameResp {
-        owner_id: game.owner.id(),
-        state: game
-            .game
-            .as_ref()
-            .and_then(|game| Some(game.state(game_player_display_for as u32))),
+        owner_id: if fields.owner_id {
+            Some(game.owner.id())
+        } else {
+            None
+        },
+        state,
         players,
-        player_ids,
-        active: game.active(),
-        started: game.started(),
+        player_ids: if fields.player_ids {
+            Some(game.players.iter().map(|id| id.id()).collect::<Vec<i32>>())
+        } else {
+            None
+        },
+        active: if fields.active {
+            Some(game.active())
+        } else {
+            None
+        },
+        started: if fields.started {
+            Some(game.started())
+        } else {
+            None
+        },
         waiting_on,
-        name: game.name,
+        name: if fields.name { Some(game.name) } else { None },
         outcome,
     }))
 }
 
-#[get("/game/<id>?<dont_invert>")]
+#[get("/game/<id>?<dont_invert>&<fields>")]
 pub fn game_get_user_authd(
     id: i32,
     db: DBConn,
     state: AppReqState,
     user: ForwardingUser,
     dont_invert: Option<bool>,
+    fields: Option<String>,
 ) -> Result<Json<GameResp<crate::GameType>>, Json<ErrorResp>> {
     let player_id = match dont_invert {
         None | Some(false) => user.0.id,
         Some(true) => 0,
     };
-    game_get_internal(player_id, id, db, state)
+    game_get_internal(player_id, id, fields, db, state)
 }
 
-#[get("/game/<id>?<dont_invert>", rank = 2)]
+#[get("/game/<id>?<dont_invert>&<fields>", rank = 2)]
 pub fn game_get(
     id: i32,
     db: DBConn,
     state: AppReqState,
     dont_invert: Option<bool>,
+    fields: Option<String>,
 ) -> Result<Json<GameResp<crate::GameType>>, Json<ErrorResp>> {
-    game_get_internal(0, id, db, state)
+    game_get_internal(0, id, fields, db, state)
+}
+
+#[derive(Serialize)]
+pub struct PlayerThreats<G: Threats> {
+    player_id: i32,
+    counts: G::Counts,
+    threats: Vec<G::Threat>,
+}
+
+#[derive(Serialize)]
+pub struct ThreatsResp<G: Threats> {
+    players: Vec<PlayerThreats<G>>,
+}
+
+#[get("/game/<id>/threats")]
+pub fn game_threats(
+    id: i32,
+    db: DBConn,
+    state: AppReqState,
+) -> Result<Json<ThreatsResp<crate::GameType>>, Json<ErrorResp>> {
+    let app = AppState::new(db, &*state);
+    let game = app.get_game(GameId(id))?;
+    let board = game.game.as_ref().ok_or(Error::GameNotStarted)?;
+
+    let players = game
+        .players
+        .iter()
+        .enumerate()
+        .map(|(index, id)| PlayerThreats {
+            player_id: id.id(),
+            counts: board.threat_counts(index as GamePlayer),
+            threats: board.threats(index as GamePlayer),
+        })
+        .collect();
+    Ok(Json(ThreatsResp { players }))
 }
 
 #[derive(Serialize)]
@@ -558,7 +1357,8 @@ pub fn game_move_needed(
     user: User,
 ) -> Result<Json<NeededResp>, Json<ErrorResp>> {
     let app = AppState::new(db, &*state);
-    let game = app.load_game_from_db(GameId(id))?;
+    // cached first, since saves of active games may not be in the db yet
+    let game = app.get_game(GameId(id))?;
     if !game.active() {
         Ok(Json(NeededResp { needed: false }))
     } else {
@@ -580,27 +1380,83 @@ pub fn game_move(
     user: User,
 ) -> Result<Json<SuccessResp>, Json<ErrorResp>> {
     let app = AppState::new(db, &*state);
-    let mut game = app.get_game(GameId(id))?;
-    if !game.active() {
-        Err(Json(ErrorResp::from(Error::WrongTurn)))
-    } else {
-        let player_index = game.get_player_index(PlayerId::new(user.id))?;
-        match game.game.as_mut() {
-            Some(game_int) => {
-                if game_int.waiting_on(player_index) {
-                    if game_int.make_move(player_index, &*player_move) {
-                        app.save_game(game)?;
-                        Ok(Json(SuccessResp { success: true }))
-                    } else {
-                        Err(Json(ErrorResp::from(Error::InvalidMove)))
-                    }
-                } else {
-                    Err(Json(ErrorResp::from(Error::WrongTurn)))
-                }
-            }
-            None => Err(Json(ErrorResp::from(Error::GameNotStarted))),
-        }
-    }
+    app.play_move(GameId(id), PlayerId::new(user.id), player_move.into_inner())?;
+    Ok(Json(SuccessResp { success: true }))
+}
+
+#[post("/game/<id>/premoves?<moves>", data = "<premoves>")]
+pub fn game_premoves(
+    id: i32,
+    moves: Option<usize>,
+    premoves: Json<Vec<Premove<<crate::GameType as Game>::Move>>>,
+    db: DBConn,
+    state: AppReqState,
+    user: User,
+) -> Result<Json<SuccessResp>, Json<ErrorResp>> {
+    let app = AppState::new(db, &*state);
+    app.set_premoves(
+        GameId(id),
+        PlayerId::new(user.id),
+        premoves.into_inner(),
+        moves,
+    )?;
+    Ok(Json(SuccessResp { success: true }))
+}
+
+/// stream a game's state every time it changes, until it finishes. Players see the game from their
+/// own perspective. format is sse (default) or ndjson
+#[get("/game/<id>/watch?<format>")]
+pub fn game_watch(
+    id: i32,
+    format: Option<String>,
+    db: DBConn,
+    state: AppReqState,
+    user: User,
+) -> Result<Content<Stream<Subscriber>>, StreamError> {
+    let format = Format::from_param(format.as_deref()).ok_or(Error::UnknownFormat)?;
+    let app = AppState::new(db, &*state);
+    let subscriber = app.watch_game(GameId(id), PlayerId::new(user.id), format)?;
+    Ok(Content(
+        format.content_type(),
+        Stream::chunked(subscriber, STREAM_FRAME as u64),
+    ))
+}
+
+/// stream every public game in progress on this server (or only the games in a comma separated
+/// list of ids), for showing many games at once. Each frame holds the games that changed since the
+/// last frame. format is sse (default) or ndjson
+#[get("/game/wall?<games>&<format>")]
+pub fn game_wall(
+    games: Option<String>,
+    format: Option<String>,
+    state: AppReqState,
+    _user: User,
+) -> Result<Content<Stream<FeedSubscriber>>, StreamError> {
+    let format = Format::from_param(format.as_deref()).ok_or(Error::UnknownFormat)?;
+    let filter = match games {
+        Some(ids) => Some(
+            ids.split(',')
+                .map(|id| id.trim().parse::<i32>().map_err(|_| Error::InvalidGameId))
+                .collect::<Result<HashSet<_>, Error>>()?,
+        ),
+        None => None,
+    };
+
+    // games are saved under the manager lock, so none can change while the feed starts
+    let manager = state.read().unwrap();
+    let subscriber = Feed::subscribe(&manager.feed, format, filter, || {
+        manager
+            .active_games
+            .values()
+            .filter(|game| game.on_wall())
+            .map(|game| game.wall_entry())
+            .collect()
+    })?;
+    drop(manager);
+    Ok(Content(
+        format.content_type(),
+        Stream::chunked(subscriber, STREAM_FRAME as u64),
+    ))
 }
 
 #[derive(FromForm)]
@@ -660,15 +1516,86 @@ pub fn game_start(
     Ok(Json(SuccessResp { success: true }))
 }
 
+#[derive(FromForm)]
+pub struct NewTournamentForm {
+    name: String,
+}
+
+#[post("/tournament/new", data = "<new_tournament>")]
+pub fn tournament_new(
+    new_tournament: Form<NewTournamentForm>,
+    db: DBConn,
+    state: AppReqState,
+    user: User,
+) -> Result<Json<IdResp>, Json<ErrorResp>> {
+    let app = AppState::new(db, &*state);
+    let id = app.new_tournament(&new_tournament.name, PlayerId::new(user.id))?;
+    Ok(Json(IdResp { id: id.to_string() }))
+}
+
+#[post("/tournament/<id>/join")]
+pub fn tournament_join(
+    id: i32,
+    db: DBConn,
+    state: AppReqState,
+    user: User,
+) -> Result<Json<SuccessResp>, Json<ErrorResp>> {
+    let app = AppState::new(db, &*state);
+    app.join_tournament(TournamentId(id), PlayerId::new(user.id))?;
+    Ok(Json(SuccessResp { success: true }))
+}
+
+#[post("/tournament/<id>/leave")]
+pub fn tournament_leave(
+    id: i32,
+    db: DBConn,
+    state: AppReqState,
+    user: User,
+) -> Result<Json<SuccessResp>, Json<ErrorResp>> {
+    let app = AppState::new(db, &*state);
+    app.leave_tournament(TournamentId(id), PlayerId::new(user.id))?;
+    Ok(Json(SuccessResp { success: true }))
+}
+
+/// create the tournament's games (the owner only). See start_tournament
+#[post("/tournament/<id>/start")]
+pub fn tournament_start(
+    id: i32,
+    db: DBConn,
+    state: AppReqState,
+    user: User,
+) -> Result<Json<SuccessResp>, Json<ErrorResp>> {
+    let app = AppState::new(db, &*state);
+    app.start_tournament(TournamentId(id), PlayerId::new(user.id))?;
+    Ok(Json(SuccessResp { success: true }))
+}
+
+/// most games in one page of the game index
+const MAX_INDEX_LIMIT: u32 = 100;
+
 #[derive(Serialize)]
 pub struct IndexResp {
     games: Vec<i32>,
+    /// pass as before to get the next page. None on the last page, or if the index isn't paged
+    next: Option<i32>,
 }
 
-#[get("/game/index")]
-pub fn game_index(db: DBConn, state: AppReqState) -> Result<Json<IndexResp>, Json<ErrorResp>> {
+/// public game ids, newest first. With limit, returns a page of at most limit games below before
+/// (a cursor: the previous page's next), instead of every game
+#[get("/game/index?<before>&<limit>")]
+pub fn game_index(
+    before: Option<i32>,
+    limit: Option<u32>,
+    db: DBConn,
+    state: AppReqState,
+) -> Result<Json<IndexResp>, Json<ErrorResp>> {
     let app = AppState::new(db, &*state);
-    let games = app.list_games()?;
+    let limit = limit.map(|limit| limit.max(1).min(MAX_INDEX_LIMIT));
+    let games = app.list_games(before, limit.map(i64::from))?;
+    let next = match limit {
+        Some(limit) if games.len() == limit as usize => games.last().cloned(),
+        _ => None,
+    };
 
-    Ok(Json(IndexResp { games }))
+    Ok(Json(IndexResp { games, next }))
 }
@@ -1,32 +1,192 @@
-use crate::game::{Game, GameOutcome, GamePlayer};
+use crate::game::{BatchMoves, BinaryMove, Game, GameOutcome, GamePlayer, Threats};
 use serde::{Deserialize, Serialize};
 
+mod batch;
+mod threats;
+pub use threats::{Threat, ThreatCounts, ThreatKind};
+
 const BOARD_SIZE: usize = 15;
 const WIN_LEN: usize = 5;
 
+/// directions a line of stones can run in
+const DIRECTIONS: [(i32, i32); 4] = [(1, 0), (0, 1), (1, 1), (1, -1)];
+
+/// generate zobrist keys for each (x, y, player) with splitmix64
+const fn zobrist_keys() -> [[[u64; 2]; BOARD_SIZE]; BOARD_SIZE] {
+    let mut keys = [[[0; 2]; BOARD_SIZE]; BOARD_SIZE];
+    let mut seed: u64 = 0x2545_f491_4f6c_dd1d;
+    let mut x = 0;
+    while x < BOARD_SIZE {
+        let mut y = 0;
+        while y < BOARD_SIZE {
+            let mut p = 0;
+            while p < 2 {
+                seed = seed.wrapping_add(0x9e37_79b9_7f4a_7c15);
+                let mut z = seed;
+                z = (z ^ (z >> 30)).wrapping_mul(0xbf58_476d_1ce4_e5b9);
+                z = (z ^ (z >> 27)).wrapping_mul(0x94d0_49bb_1331_11eb);
+                keys[x][y][p] = z ^ (z >> 31);
+                p += 1;
+            }
+            y += 1;
+        }
+        x += 1;
+    }
+    keys
+}
+
+/// number of symmetries of the board (rotations and reflections)
+const SYMMETRIES: usize = 8;
+
+/// where each symmetry takes (x, y). Symmetry 0 is the identity
+const fn transform(sym: usize, x: usize, y: usize) -> (usize, usize) {
+    let n = BOARD_SIZE - 1;
+    match sym {
+        0 => (x, y),
+        1 => (y, n - x),
+        2 => (n - x, n - y),
+        3 => (n - y, x),
+        4 => (n - x, y),
+        5 => (x, n - y),
+        6 => (y, x),
+        _ => (n - y, n - x),
+    }
+}
+
+/// zobrist keys for each (symmetry, x, y, player): the key of the cell the symmetry takes (x, y) to
+const fn symmetric_zobrist_keys() -> [[[[u64; 2]; BOARD_SIZE]; BOARD_SIZE]; SYMMETRIES] {
+    let keys = zobrist_keys();
+    let mut sym_keys = [[[[0; 2]; BOARD_SIZE]; BOARD_SIZE]; SYMMETRIES];
+    let mut sym = 0;
+    while sym < SYMMETRIES {
+        let mut x = 0;
+        while x < BOARD_SIZE {
+            let mut y = 0;
+            while y < BOARD_SIZE {
+                let (tx, ty) = transform(sym, x, y);
+                sym_keys[sym][x][y] = keys[tx][ty];
+                y += 1;
+            }
+            x += 1;
+        }
+        sym += 1;
+    }
+    sym_keys
+}
+
+static SYM_ZOBRIST: [[[[u64; 2]; BOARD_SIZE]; BOARD_SIZE]; SYMMETRIES] = symmetric_zobrist_keys();
+/// hashed in when player 1 is on move
+const ZOBRIST_TURN: u64 = 0x6a09_e667_f3bc_c909;
+
 #[derive(Clone, Debug, Serialize, Deserialize)]
 pub struct Gomoku {
     board: [[i8; BOARD_SIZE]; BOARD_SIZE],
     turn: i8,
+    // the following are derived from board and kept up to date by make_move + undo_move
+    /// number of stones on the board
+    #[serde(skip)]
+    stones: u16,
+    /// player who has five in a row, or -1
+    #[serde(skip)]
+    winner: i8,
+    /// hash of the board under each symmetry. hashes[0] is the hash of the board itself
+    #[serde(skip)]
+    hashes: [u64; SYMMETRIES],
+    /// stones on each line, and the threats they make
+    #[serde(skip)]
+    lines: threats::Lines,
 }
 
-#[derive(FromForm)]
+#[derive(FromForm, Clone, Copy, PartialEq, Debug, Serialize, Deserialize)]
 pub struct Move {
     x: i32,
     y: i32,
 }
 
+impl BinaryMove for Move {
+    const ENCODED_LEN: usize = 1;
+
+    fn encode(&self, out: &mut [u8]) {
+        out[0] = (self.x as usize * BOARD_SIZE + self.y as usize) as u8;
+    }
+
+    fn decode(bytes: &[u8]) -> Option<Move> {
+        let cell = bytes[0] as usize;
+        if cell < BOARD_SIZE * BOARD_SIZE {
+            Some(Move {
+                x: (cell / BOARD_SIZE) as i32,
+                y: (cell % BOARD_SIZE) as i32,
+            })
+        } else {
+            None
+        }
+    }
+}
+
 impl Gomoku {
     fn full(&self) -> bool {
-        for row in &self.board {
-            for cell in row {
-                if *cell == -1 {
-                    return false;
+        self.stones as usize == BOARD_SIZE * BOARD_SIZE
+    }
+
+    /// recompute the fields derived from board
+    fn recompute(&mut self) {
+        self.stones = 0;
+        self.hashes = [if self.turn == 1 { ZOBRIST_TURN } else { 0 }; SYMMETRIES];
+        self.lines = threats::Lines::default();
+        for x in 0..BOARD_SIZE {
+            for y in 0..BOARD_SIZE {
+                let cell = self.board[x][y];
+                if cell == 0 || cell == 1 {
+                    self.stones += 1;
+                    self.toggle_stone(x, y, cell as usize);
+                    self.lines.toggle(x, y, cell as usize);
                 }
             }
         }
+        self.winner = if self.check_win(0) {
+            0
+        } else if self.check_win(1) {
+            1
+        } else {
+            -1
+        };
+    }
+
+    /// add or remove player's stone at (x, y) from the hashes
+    fn toggle_stone(&mut self, x: usize, y: usize, player: usize) {
+        for (hash, keys) in self.hashes.iter_mut().zip(SYM_ZOBRIST.iter()) {
+            *hash ^= keys[x][y][player];
+        }
+    }
 
-        true
+    fn toggle_turn(&mut self) {
+        for hash in self.hashes.iter_mut() {
+            *hash ^= ZOBRIST_TURN;
+        }
+    }
+
+    /// check if the stone at (x, y) is part of a line of WIN_LEN or more
+    fn wins_at(&self, x: usize, y: usize) -> bool {
+        let player = self.board[x][y];
+        let in_dir = |dx: i32, dy: i32| -> usize {
+            let mut count = 0;
+            let (mut cx, mut cy) = (x as i32 + dx, y as i32 + dy);
+            while cx >= 0
+                && cy >= 0
+                && cx < BOARD_SIZE as i32
+                && cy < BOARD_SIZE as i32
+                && self.board[cx as usize][cy as usize] == player
+            {
+                count += 1;
+                cx += dx;
+                cy += dy;
+            }
+            count
+        };
+
+        DIRECTIONS
+            .iter()
+            .any(|(dx, dy)| 1 + in_dir(*dx, *dy) + in_dir(-*dx, -*dy) >= WIN_LEN)
     }
 
     fn check_row(&self, player: GamePlayer, row_i: usize) -> bool {
@@ -146,11 +306,17 @@ impl Game for Gomoku {
         Gomoku {
             board: [[-1; BOARD_SIZE]; BOARD_SIZE],
             turn: 0,
+            stones: 0,
+            winner: -1,
+            hashes: [0; SYMMETRIES],
+            lines: threats::Lines::default(),
         }
     }
 
     fn from_state(state: Self::State, _players: usize) -> Self {
-        state
+        let mut game = state;
+        game.recompute();
+        game
     }
 
     fn state(&self, for_player: GamePlayer) -> Self::State {
@@ -173,7 +339,7 @@ impl Game for Gomoku {
     }
 
     fn finished(&self) -> bool {
-        self.full() || self.check_win(0) || self.check_win(1)
+        self.full() || self.winner != -1
     }
 
     fn waiting_on(&self, player: u32) -> bool {
@@ -181,7 +347,7 @@ impl Game for Gomoku {
     }
 
     fn make_move(&mut self, player: u32, move_to_make: &Self::Move) -> bool {
-        if player as i8 != self.turn {
+        if player as i8 != self.turn || self.finished() {
             return false;
         } else if move_to_make.x >= BOARD_SIZE as i32
             || move_to_make.y >= BOARD_SIZE as i32
@@ -193,7 +359,15 @@ impl Game for Gomoku {
             if self.board[move_to_make.x as usize][move_to_make.y as usize] != -1 {
                 return false;
             }
-            self.board[move_to_make.x as usize][move_to_make.y as usize] = player as i8;
+            let (x, y) = (move_to_make.x as usize, move_to_make.y as usize);
+            self.board[x][y] = player as i8;
+            self.stones += 1;
+            self.toggle_stone(x, y, player as usize);
+            self.toggle_turn();
+            self.lines.toggle(x, y, player as usize);
+            if self.wins_at(x, y) {
+                self.winner = player as i8;
+            }
         }
 
         self.turn = if self.turn == 0 {
@@ -207,10 +381,47 @@ impl Game for Gomoku {
         true
     }
 
+    fn undo_move(&mut self, player: u32, move_made: &Self::Move) {
+        let (x, y) = (move_made.x as usize, move_made.y as usize);
+        self.board[x][y] = -1;
+        self.stones -= 1;
+        self.toggle_stone(x, y, player as usize);
+        self.toggle_turn();
+        self.lines.toggle(x, y, player as usize);
+        // moves can't be made once the game is won, so the position before this move had no winner
+        self.winner = -1;
+        self.turn = player as i8;
+    }
+
+    fn legal_moves(&self, player: u32, moves: &mut Vec<Self::Move>) {
+        moves.clear();
+        if player as i8 != self.turn || self.finished() {
+            return;
+        }
+        for x in 0..BOARD_SIZE {
+            for y in 0..BOARD_SIZE {
+                if self.board[x][y] == -1 {
+                    moves.push(Move {
+                        x: x as i32,
+                        y: y as i32,
+                    });
+                }
+            }
+        }
+    }
+
+    fn hash(&self) -> u64 {
+        self.hashes[0]
+    }
+
+    fn canonical_hash(&self) -> u64 {
+        *self.hashes.iter().min().unwrap()
+    }
+
     fn scores(&self) -> Option<Vec<Self::Score>> {
-        if self.check_win(0) {
+        if self.winner == 0 {
             Some(vec![1.0, 0.0])
-        } else if self.check_win(1) {
+        } else if self.winner == 1 {
             Some(vec![0.0, 1.0])
         } else if self.full() {
             Some(vec![0.5, 0.5])
@@ -220,9 +431,9 @@ impl Game for Gomoku {
     }
 
     fn outcome(&self) -> GameOutcome {
-        if self.check_win(0) {
+        if self.winner == 0 {
             GameOutcome::Win(0)
-        } else if self.check_win(1) {
+        } else if self.winner == 1 {
             GameOutcome::Win(1)
         } else if self.full() {
             GameOutcome::Tie
@@ -231,3 +442,22 @@ impl Game for Gomoku {
         }
     }
 }
+
+impl Threats for Gomoku {
+    type Threat = Threat;
+    type Counts = ThreatCounts;
+
+    fn threat_counts(&self, player: GamePlayer) -> ThreatCounts {
+        self.lines.counts(player as usize)
+    }
+
+    fn threats(&self, player: GamePlayer) -> Vec<Threat> {
+        self.lines.threats(player as usize)
+    }
+}
+
+impl BatchMoves for Gomoku {
+    fn choose_moves(positions: &[(&Gomoku, GamePlayer)]) -> Vec<Move> {
+        batch::choose_moves(positions)
+    }
+}
@@ -0,0 +1,180 @@
+//! Choosing moves for many positions at once.
+//!
+//! Moves are scored by counting windows: every line of 5 cells on the board is a window, and a
+//! window is worth more the more stones one player has in it (as long as the other player has none).
+//! A cell's score is the total of the windows it is in.
+//!
+//! The positions are laid out cell-major (structure of arrays), so each pass runs the same
+//! arithmetic over one cell or window of every position, in loops the compiler can vectorize.
+
+use super::{Gomoku, Move, BOARD_SIZE, WIN_LEN};
+use crate::game::GamePlayer;
+
+const CELLS: usize = BOARD_SIZE * BOARD_SIZE;
+/// windows of WIN_LEN cells in a row (rows, columns, then both diagonals)
+const NUM_WINDOWS: usize =
+    BOARD_SIZE * (BOARD_SIZE - WIN_LEN + 1) * 2 + (BOARD_SIZE - WIN_LEN + 1).pow(2) * 2;
+/// most windows a cell can be in
+const MAX_CELL_WINDOWS: usize = WIN_LEN * 4;
+
+/// cells in each window
+const fn windows() -> [[u8; WIN_LEN]; NUM_WINDOWS] {
+    let mut windows = [[0; WIN_LEN]; NUM_WINDOWS];
+    let starts = BOARD_SIZE - WIN_LEN + 1;
+    // range of start cells in each direction
+    let dirs = [
+        (starts, BOARD_SIZE),
+        (BOARD_SIZE, starts),
+        (starts, starts),
+        (starts, starts),
+    ];
+    let mut w = 0;
+    let mut d = 0;
+    while d < dirs.len() {
+        let (xs, ys) = dirs[d];
+        let mut x = 0;
+        while x < xs {
+            let mut y = 0;
+            while y < ys {
+                let mut i = 0;
+                while i < WIN_LEN {
+                    let (cx, cy) = match d {
+                        0 => (x + i, y),
+                        1 => (x, y + i),
+                        2 => (x + i, y + i),
+                        _ => (x + i, y + WIN_LEN - 1 - i),
+                    };
+                    windows[w][i] = (cx * BOARD_SIZE + cy) as u8;
+                    i += 1;
+                }
+                w += 1;
+                y += 1;
+            }
+            x += 1;
+        }
+        d += 1;
+    }
+    windows
+}
+
+/// the windows each cell is in, and how many there are
+const fn cell_windows() -> ([[u16; MAX_CELL_WINDOWS]; CELLS], [u8; CELLS]) {
+    let mut cell_windows = [[0; MAX_CELL_WINDOWS]; CELLS];
+    let mut counts = [0; CELLS];
+    let windows = windows();
+    let mut w = 0;
+    while w < NUM_WINDOWS {
+        let mut i = 0;
+        while i < WIN_LEN {
+            let cell = windows[w][i] as usize;
+            cell_windows[cell][counts[cell] as usize] = w as u16;
+            counts[cell] += 1;
+            i += 1;
+        }
+        w += 1;
+    }
+    (cell_windows, counts)
+}
+
+/// tie breaker for cells with the same score, favoring the center. At least 1, so every empty
+/// cell beats an occupied one
+const fn center_bonus() -> [u32; CELLS] {
+    let mut bonus = [0; CELLS];
+    let mid = BOARD_SIZE / 2;
+    let mut cell = 0;
+    while cell < CELLS {
+        let (x, y) = (cell / BOARD_SIZE, cell % BOARD_SIZE);
+        let dx = if x > mid { x - mid } else { mid - x };
+        let dy = if y > mid { y - mid } else { mid - y };
+        bonus[cell] = (BOARD_SIZE - dx - dy) as u32;
+        cell += 1;
+    }
+    bonus
+}
+
+static WINDOWS: [[u8; WIN_LEN]; NUM_WINDOWS] = windows();
+static CELL_WINDOWS: ([[u16; MAX_CELL_WINDOWS]; CELLS], [u8; CELLS]) = cell_windows();
+static CENTER_BONUS: [u32; CELLS] = center_bonus();
+
+/// worth of a window with own of the mover's stones and opp of the opponent's. Completing our own
+/// line is worth more than blocking the opponent's, and windows with both players' stones are
+/// worth nothing. Branch free, so it vectorizes
+#[inline(always)]
+fn window_value(own: u32, opp: u32) -> u32 {
+    let attack = 1 << (3 * own);
+    let defend = (1 << (3 * opp)) >> 1;
+    (attack + defend) * ((own == 0) | (opp == 0)) as u32
+}
+
+/// choose a move for each (position, player to move)
+pub fn choose_moves(positions: &[(&Gomoku, GamePlayer)]) -> Vec<Move> {
+    let n = positions.len();
+    if n == 0 {
+        return vec![];
+    }
+    // own[cell * n + i] is 1 if position i has the mover's stone on cell
+    let mut own = vec![0u8; CELLS * n];
+    let mut opp = vec![0u8; CELLS * n];
+    for (i, (game, player)) in positions.iter().enumerate() {
+        for x in 0..BOARD_SIZE {
+            for y in 0..BOARD_SIZE {
+                let cell = game.board[x][y];
+                let at = (x * BOARD_SIZE + y) * n + i;
+                if cell == *player as i8 {
+                    own[at] = 1;
+                } else if cell != -1 {
+                    opp[at] = 1;
+                }
+            }
+        }
+    }
+
+    // value of every window in every position
+    let mut values = vec![0u32; NUM_WINDOWS * n];
+    for (window, out) in WINDOWS.iter().zip(values.chunks_exact_mut(n)) {
+        let own_cells = window.map(|c| &own[c as usize * n..(c as usize + 1) * n]);
+        let opp_cells = window.map(|c| &opp[c as usize * n..(c as usize + 1) * n]);
+        for (i, value) in out.iter_mut().enumerate() {
+            let mut own_count = 0;
+            let mut opp_count = 0;
+            for c in 0..WIN_LEN {
+                own_count += own_cells[c][i] as u32;
+                opp_count += opp_cells[c][i] as u32;
+            }
+            *value = window_value(own_count, opp_count);
+        }
+    }
+
+    // score each cell in every position, keeping the best empty cell
+    let mut best = vec![0u32; n];
+    let mut best_cell = vec![0u8; n];
+    let mut score = vec![0u32; n];
+    let (cell_windows, counts) = &CELL_WINDOWS;
+    for cell in 0..CELLS {
+        score.iter_mut().for_each(|s| *s = 0);
+        for w in &cell_windows[cell][..counts[cell] as usize] {
+            let w = *w as usize;
+            for (s, v) in score.iter_mut().zip(&values[w * n..(w + 1) * n]) {
+                *s += v;
+            }
+        }
+        let own_cell = &own[cell * n..(cell + 1) * n];
+        let opp_cell = &opp[cell * n..(cell + 1) * n];
+        let bonus = CENTER_BONUS[cell];
+        for i in 0..n {
+            let empty = 1 - (own_cell[i] | opp_cell[i]) as u32;
+            let s = (score[i] * BOARD_SIZE as u32 * 2 + bonus) * empty;
+            let better = s > best[i];
+            best[i] = if better { s } else { best[i] };
+            best_cell[i] = if better { cell as u8 } else { best_cell[i] };
+        }
+    }
+
+    best_cell
+        .iter()
+        .map(|cell| Move {
+            x: (*cell as usize / BOARD_SIZE) as i32,
+            y: (*cell as usize % BOARD_SIZE) as i32,
+        })
+        .collect()
+}
@@ -0,0 +1,406 @@
+//! Threats (lines a player is close to completing), kept up to date incrementally.
+//!
+//! Every row, column and diagonal on the board is a line, stored as a bitmask of each player's
+//! stones. Placing or removing a stone touches the 4 lines through it, and only those lines are
+//! rescanned. A scan slides windows of 5 and 6 cells along the line and looks each window up in a
+//! table indexed by which of its cells are the player's and which are empty.
+
+use super::{Move, BOARD_SIZE, DIRECTIONS, WIN_LEN};
+use serde::Serialize;
+
+/// rows, columns, then both directions of diagonals
+const NUM_LINES: usize = BOARD_SIZE * 2 + (BOARD_SIZE * 2 - 1) * 2;
+/// first line of each direction
+const LINE_OFFSETS: [usize; 4] = [
+    0,
+    BOARD_SIZE,
+    BOARD_SIZE * 2,
+    BOARD_SIZE * 2 + BOARD_SIZE * 2 - 1,
+];
+
+/// Kinds of threats, weakest first
+#[derive(Clone, Copy, PartialEq, Eq, PartialOrd, Ord, Debug, Serialize)]
+#[serde(rename_all = "snake_case")]
+pub enum ThreatKind {
+    /// three stones with room to become an open four (ie -- _XXX_ or _XX_X_)
+    OpenThree,
+    /// four stones in a window of five, one move from five
+    Four,
+    /// four stones in a row with both ends empty, which can't be blocked
+    OpenFour,
+    Five,
+}
+
+const KINDS: [ThreatKind; 4] = [
+    ThreatKind::OpenThree,
+    ThreatKind::Four,
+    ThreatKind::OpenFour,
+    ThreatKind::Five,
+];
+/// table entry for windows that aren't a threat
+const NO_THREAT: u8 = 0xff;
+
+/// kind of threat a window of 5 cells is, indexed by own | empty << 5
+const fn window5_table() -> [u8; 1 << 10] {
+    let mut table = [NO_THREAT; 1 << 10];
+    let mut i = 0;
+    while i < table.len() {
+        let own = (i & 0x1f) as u32;
+        let empty = (i >> 5) as u32;
+        if own & empty == 0 {
+            if own.count_ones() == 5 {
+                table[i] = ThreatKind::Five as u8;
+            } else if own.count_ones() == 4 && empty.count_ones() == 1 {
+                table[i] = ThreatKind::Four as u8;
+            }
+        }
+        i += 1;
+    }
+    table
+}
+
+/// kind of open threat a window of 6 cells is, indexed by own | empty << 6. Open threats have
+/// both end cells empty
+const fn window6_table() -> [u8; 1 << 12] {
+    let mut table = [NO_THREAT; 1 << 12];
+    let mut i = 0;
+    while i < table.len() {
+        let own = (i & 0x3f) as u32;
+        let empty = (i >> 6) as u32;
+        let ends = 0b10_0001;
+        if own & empty == 0 && empty & ends == ends {
+            let inner_own = own & 0b01_1110;
+            let inner_empty = empty & 0b01_1110;
+            if inner_own.count_ones() == 4 {
+                table[i] = ThreatKind::OpenFour as u8;
+            } else if inner_own.count_ones() == 3 && inner_empty.count_ones() == 1 {
+                table[i] = ThreatKind::OpenThree as u8;
+            }
+        }
+        i += 1;
+    }
+    table
+}
+
+static WINDOW5: [u8; 1 << 10] = window5_table();
+static WINDOW6: [u8; 1 << 12] = window6_table();
+
+/// start cell and length of each line
+const fn line_starts() -> [(u8, u8, u8); NUM_LINES] {
+    let mut starts = [(0, 0, 0); NUM_LINES];
+    let n = BOARD_SIZE;
+    let mut i = 0;
+    while i < n {
+        starts[LINE_OFFSETS[0] + i] = (0, i as u8, n as u8);
+        starts[LINE_OFFSETS[1] + i] = (i as u8, 0, n as u8);
+        i += 1;
+    }
+    let mut k = 0;
+    while k < n * 2 - 1 {
+        // down right diagonals have constant x - y, up right diagonals have constant x + y
+        let len = if k < n { k + 1 } else { n * 2 - 1 - k };
+        starts[LINE_OFFSETS[2] + k] = if k < n {
+            (0, (n - 1 - k) as u8, len as u8)
+        } else {
+            ((k + 1 - n) as u8, 0, len as u8)
+        };
+        starts[LINE_OFFSETS[3] + k] = if k < n {
+            (0, k as u8, len as u8)
+        } else {
+            ((k + 1 - n) as u8, (n - 1) as u8, len as u8)
+        };
+        k += 1;
+    }
+    starts
+}
+
+/// the line and position along it of each cell in each direction
+const fn cell_lines() -> [[[(u8, u8); 4]; BOARD_SIZE]; BOARD_SIZE] {
+    let mut lines = [[[(0, 0); 4]; BOARD_SIZE]; BOARD_SIZE];
+    let n = BOARD_SIZE;
+    let mut x = 0;
+    while x < n {
+        let mut y = 0;
+        while y < n {
+            lines[x][y][0] = ((LINE_OFFSETS[0] + y) as u8, x as u8);
+            lines[x][y][1] = ((LINE_OFFSETS[1] + x) as u8, y as u8);
+            let down = x + n - 1 - y;
+            lines[x][y][2] = (
+                (LINE_OFFSETS[2] + down) as u8,
+                if x < y { x } else { y } as u8,
+            );
+            let up = x + y;
+            lines[x][y][3] = (
+                (LINE_OFFSETS[3] + up) as u8,
+                if up < n { x } else { x + n - 1 - up } as u8,
+            );
+            y += 1;
+        }
+        x += 1;
+    }
+    lines
+}
+
+static LINE_STARTS: [(u8, u8, u8); NUM_LINES] = line_starts();
+static CELL_LINES: [[[(u8, u8); 4]; BOARD_SIZE]; BOARD_SIZE] = cell_lines();
+
+/// A threat on a single line, as bitmasks of positions along the line
+#[derive(Clone, Copy, Default)]
+struct LineThreat {
+    kind: u8,
+    stones: u16,
+    /// empty cells in the threat, which are where it can be extended or blocked
+    gaps: u16,
+}
+
+/// most windows a line has, which bounds the threats on it
+const MAX_LINE_THREATS: usize = BOARD_SIZE * 2;
+
+/// find own's threats on a line of len cells. Windows describing the same stones are merged, as are
+/// overlapping fives (an overline wins like a five, so it is one five), and threats whose stones
+/// are part of a stronger threat are dropped (an open four isn't also two fours). Returns the
+/// number of threats written to out
+fn scan_line(own: u16, other: u16, len: usize, out: &mut [LineThreat; MAX_LINE_THREATS]) -> usize {
+    if len < WIN_LEN || own == 0 {
+        return 0;
+    }
+    let empty = !(own | other) & ((1 << len) - 1);
+    let mut found = 0;
+    let mut add = |kind: u8, stones: u16, gaps: u16| {
+        for threat in out[..found].iter_mut() {
+            let overline = kind == ThreatKind::Five as u8 && threat.stones & stones != 0;
+            if threat.kind == kind && (threat.stones == stones || overline) {
+                threat.stones |= stones;
+                threat.gaps |= gaps;
+                return;
+            }
+        }
+        out[found] = LineThreat { kind, stones, gaps };
+        found += 1;
+    };
+
+    for s in 0..=len - 5 {
+        let (w_own, w_empty) = ((own >> s) & 0x1f, (empty >> s) & 0x1f);
+        let kind = WINDOW5[(w_own | w_empty << 5) as usize];
+        if kind != NO_THREAT {
+            add(kind, w_own << s, w_empty << s);
+        }
+    }
+    // pad the line with a blocked cell at each end, so windows can overhang it
+    let (own_ext, empty_ext) = ((own as u32) << 1, (empty as u32) << 1);
+    for s in 0..=len - 4 {
+        let (w_own, w_empty) = ((own_ext >> s) & 0x3f, (empty_ext >> s) & 0x3f);
+        let kind = WINDOW6[(w_own | w_empty << 6) as usize];
+        if kind != NO_THREAT {
+            add(
+                kind,
+                ((w_own << s) >> 1) as u16,
+                ((w_empty << s) >> 1) as u16,
+            );
+        }
+    }
+
+    let mut kept = 0;
+    for i in 0..found {
+        let threat = out[i];
+        let covered = out[..found]
+            .iter()
+            .any(|t| t.kind > threat.kind && t.stones & threat.stones == threat.stones);
+        if !covered {
+            out[kept] = threat;
+            kept += 1;
+        }
+    }
+    kept
+}
+
+/// Number of each kind of threat a player has
+#[derive(Clone, Copy, Default, Debug, PartialEq, Eq, Serialize)]
+pub struct ThreatCounts {
+    pub open_threes: u16,
+    pub fours: u16,
+    pub open_fours: u16,
+    pub fives: u16,
+}
+
+impl ThreatCounts {
+    fn from_counts(counts: &[u16; 4]) -> ThreatCounts {
+        ThreatCounts {
+            open_threes: counts[ThreatKind::OpenThree as usize],
+            fours: counts[ThreatKind::Four as usize],
+            open_fours: counts[ThreatKind::OpenFour as usize],
+            fives: counts[ThreatKind::Five as usize],
+        }
+    }
+}
+
+/// A threat on the board
+#[derive(Clone, Debug, Serialize)]
+pub struct Threat {
+    pub kind: ThreatKind,
+    /// the stones making up the threat
+    pub stones: Vec<Move>,
+    /// empty cells in the threat. Playing in one extends the threat (or blocks it)
+    pub gaps: Vec<Move>,
+}
+
+/// Each player's stones on every line, and the number of threats on each line
+#[derive(Clone, Debug)]
+pub struct Lines {
+    stones: [[u16; 2]; NUM_LINES],
+    counts: [[[u8; 4]; 2]; NUM_LINES],
+    totals: [[u16; 4]; 2],
+}
+
+impl Default for Lines {
+    fn default() -> Lines {
+        Lines {
+            stones: [[0; 2]; NUM_LINES],
+            counts: [[[0; 4]; 2]; NUM_LINES],
+            totals: [[0; 4]; 2],
+        }
+    }
+}
+
+impl Lines {
+    /// add or remove player's stone at (x, y), and rescan the lines through it
+    pub fn toggle(&mut self, x: usize, y: usize, player: usize) {
+        for (line, pos) in CELL_LINES[x][y].iter() {
+            let line = *line as usize;
+            self.stones[line][player] ^= 1 << pos;
+            self.rescan(line);
+        }
+    }
+
+    fn rescan(&mut self, line: usize) {
+        let len = LINE_STARTS[line].2 as usize;
+        let mut threats = [LineThreat::default(); MAX_LINE_THREATS];
+        for player in 0..2 {
+            let (own, other) = (self.stones[line][player], self.stones[line][1 - player]);
+            let found = scan_line(own, other, len, &mut threats);
+            let mut counts = [0; 4];
+            for threat in &threats[..found] {
+                counts[threat.kind as usize] += 1;
+            }
+            for kind in 0..KINDS.len() {
+                self.totals[player][kind] -= self.counts[line][player][kind] as u16;
+                self.totals[player][kind] += counts[kind] as u16;
+            }
+            self.counts[line][player] = counts;
+        }
+    }
+
+    /// player's threat counts, without scanning anything
+    pub fn counts(&self, player: usize) -> ThreatCounts {
+        ThreatCounts::from_counts(&self.totals[player])
+    }
+
+    /// every threat player has, strongest first
+    pub fn threats(&self, player: usize) -> Vec<Threat> {
+        let mut res = Vec::new();
+        let mut threats = [LineThreat::default(); MAX_LINE_THREATS];
+        for line in 0..NUM_LINES {
+            if self.counts[line][player] == [0; 4] {
+                continue;
+            }
+            let (x, y, len) = LINE_STARTS[line];
+            let (own, other) = (self.stones[line][player], self.stones[line][1 - player]);
+            let (dx, dy) = DIRECTIONS[LINE_OFFSETS.iter().rposition(|o| *o <= line).unwrap()];
+            let cells = |mask: u16| {
+                (0..len as i32)
+                    .filter(|pos| mask & (1 << pos) != 0)
+                    .map(|pos| Move {
+                        x: x as i32 + dx * pos,
+                        y: y as i32 + dy * pos,
+                    })
+                    .collect::<Vec<_>>()
+            };
+            let found = scan_line(own, other, len as usize, &mut threats);
+            for threat in &threats[..found] {
+                res.push(Threat {
+                    kind: KINDS[threat.kind as usize],
+                    stones: cells(threat.stones),
+                    gaps: cells(threat.gaps),
+                });
+            }
+        }
+        res.sort_by(|a, b| b.kind.cmp(&a.kind));
+        res
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// place a row of stones on the middle row, X for player 0 and O for player 1 (anything else
+    /// is empty), and return player 0's counts
+    fn row_counts(pattern: &str) -> ThreatCounts {
+        let mut lines = Lines::default();
+        for (x, cell) in pattern.chars().enumerate() {
+            match cell {
+                'X' => lines.toggle(x + 2, BOARD_SIZE / 2, 0),
+                'O' => lines.toggle(x + 2, BOARD_SIZE / 2, 1),
+                _ => (),
+            }
+        }
+        lines.counts(0)
+    }
+
+    fn counts(open_threes: u16, fours: u16, open_fours: u16, fives: u16) -> ThreatCounts {
+        ThreatCounts {
+            open_threes,
+            fours,
+            open_fours,
+            fives,
+        }
+    }
+
+    #[test]
+    fn open_threes() {
+        assert_eq!(row_counts("_XXX_"), counts(1, 0, 0, 0));
+        assert_eq!(row_counts("_XX_X_"), counts(1, 0, 0, 0));
+        // blocked on one side, so it can't become an open four
+        assert_eq!(row_counts("OXXX_"), counts(0, 0, 0, 0));
+    }
+
+    #[test]
+    fn split_four_is_one_four() {
+        assert_eq!(row_counts("_XX_XX_"), counts(0, 1, 0, 0));
+        assert_eq!(row_counts("OXXXX_"), counts(0, 1, 0, 0));
+    }
+
+    #[test]
+    fn open_four_suppresses_its_fours() {
+        assert_eq!(row_counts("_XXXX_"), counts(0, 0, 1, 0));
+    }
+
+    #[test]
+    fn overline_is_one_five() {
+        assert_eq!(row_counts("XXXXX"), counts(0, 0, 0, 1));
+        assert_eq!(row_counts("XXXXXX"), counts(0, 0, 0, 1));
+        assert_eq!(row_counts("XXXXXXX"), counts(0, 0, 0, 1));
+
+        let mut lines = Lines::default();
+        for x in 0..6 {
+            lines.toggle(x, 0, 0);
+        }
+        let threats = lines.threats(0);
+        assert_eq!(threats.len(), 1);
+        assert_eq!(threats[0].kind, ThreatKind::Five);
+        assert_eq!(threats[0].stones.len(), 6);
+    }
+
+    #[test]
+    fn removing_stones_clears_counts() {
+        let mut lines = Lines::default();
+        for x in 3..7 {
+            lines.toggle(x, 4, 0);
+        }
+        assert_eq!(lines.counts(0), counts(0, 0, 1, 0));
+        for x in 3..7 {
+            lines.toggle(x, 4, 0);
+        }
+        assert_eq!(lines.counts(0), ThreatCounts::default());
+    }
+}
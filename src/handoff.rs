@@ -0,0 +1,175 @@
+use crate::game::Game;
+use crate::game_manage::GameManager;
+use crate::users::PlayerId;
+use std::collections::HashMap;
+use std::io::{self, BufReader, BufWriter, Read, Write};
+use std::os::unix::net::{UnixListener, UnixStream};
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::{Arc, RwLock};
+use std::time::Duration;
+use std::{env, fs, process, thread};
+
+const SNAPSHOT_MAGIC: &[u8; 4] = b"CKHO";
+/// also the version of journal records, which are game instances in the same format
+pub const SNAPSHOT_VERSION: u8 = 2;
+/// how long the old process keeps serving in flight requests after handing off
+const DEFAULT_DRAIN_SECS: u64 = 10;
+
+/// Set once this process has handed its state off to a new process.
+/// After that, it must not change active games or sessions, since the new process wouldn't see the changes
+static DRAINING: AtomicBool = AtomicBool::new(false);
+
+/// check if this process has handed off its state and is draining
+pub fn draining() -> bool {
+    DRAINING.load(Ordering::SeqCst)
+}
+
+pub fn write_u32<W: Write>(w: &mut W, v: u32) -> io::Result<()> {
+    w.write_all(&v.to_le_bytes())
+}
+
+pub fn read_u32<R: Read>(r: &mut R) -> io::Result<u32> {
+    let mut buf = [0; 4];
+    r.read_exact(&mut buf)?;
+    Ok(u32::from_le_bytes(buf))
+}
+
+pub fn write_i32<W: Write>(w: &mut W, v: i32) -> io::Result<()> {
+    w.write_all(&v.to_le_bytes())
+}
+
+pub fn read_i32<R: Read>(r: &mut R) -> io::Result<i32> {
+    let mut buf = [0; 4];
+    r.read_exact(&mut buf)?;
+    Ok(i32::from_le_bytes(buf))
+}
+
+/// write a length prefixed byte string
+pub fn write_bytes<W: Write>(w: &mut W, bytes: &[u8]) -> io::Result<()> {
+    write_u32(w, bytes.len() as u32)?;
+    w.write_all(bytes)
+}
+
+/// read a length prefixed byte string
+pub fn read_bytes<R: Read>(r: &mut R) -> io::Result<Vec<u8>> {
+    let len = read_u32(r)? as usize;
+    let mut buf = vec![0; len];
+    r.read_exact(&mut buf)?;
+    Ok(buf)
+}
+
+pub fn read_string<R: Read>(r: &mut R) -> io::Result<String> {
+    String::from_utf8(read_bytes(r)?).map_err(|e| io::Error::new(io::ErrorKind::InvalidData, e))
+}
+
+fn write_snapshot<G: Game, W: Write>(
+    w: &mut W,
+    manager: &RwLock<GameManager<G>>,
+    sessions: &RwLock<HashMap<String, PlayerId>>,
+) -> io::Result<()> {
+    w.write_all(SNAPSHOT_MAGIC)?;
+    w.write_all(&[SNAPSHOT_VERSION])?;
+
+    {
+        let sessions = sessions.read().unwrap();
+        write_u32(w, sessions.len() as u32)?;
+        for (key, player) in sessions.iter() {
+            write_bytes(w, key.as_bytes())?;
+            write_i32(w, player.id())?;
+        }
+    }
+
+    manager.read().unwrap().write_snapshot(w)
+}
+
+fn read_snapshot<G: Game, R: Read>(
+    r: &mut R,
+    manager: &RwLock<GameManager<G>>,
+    sessions: &RwLock<HashMap<String, PlayerId>>,
+) -> io::Result<()> {
+    let mut header = [0; 5];
+    r.read_exact(&mut header)?;
+    if &header[0..4] != SNAPSHOT_MAGIC || header[4] != SNAPSHOT_VERSION {
+        return Err(io::Error::new(
+            io::ErrorKind::InvalidData,
+            "invalid handoff snapshot header",
+        ));
+    }
+
+    let num_sessions = read_u32(r)?;
+    let mut restored = HashMap::with_capacity(num_sessions as usize);
+    for _ in 0..num_sessions {
+        let key = read_string(r)?;
+        restored.insert(key, PlayerId::new(read_i32(r)?));
+    }
+
+    manager.write().unwrap().read_snapshot(r)?;
+    sessions.write().unwrap().extend(restored);
+    Ok(())
+}
+
+/// If an old process is listening on socket_path, take over its active games and sessions.
+/// Returns false if there was no process to take over from
+pub fn receive<G: Game>(
+    socket_path: &str,
+    manager: &RwLock<GameManager<G>>,
+    sessions: &RwLock<HashMap<String, PlayerId>>,
+) -> io::Result<bool> {
+    let stream = match UnixStream::connect(socket_path) {
+        Ok(s) => s,
+        Err(e)
+            if e.kind() == io::ErrorKind::NotFound
+                || e.kind() == io::ErrorKind::ConnectionRefused =>
+        {
+            return Ok(false)
+        }
+        Err(e) => return Err(e),
+    };
+
+    read_snapshot(&mut BufReader::new(stream), manager, sessions)?;
+    Ok(true)
+}
+
+/// Listen on socket_path for a new process to hand state off to. Once the state is sent, this
+/// process stops changing state, serves in flight requests for HANDOFF_DRAIN_SECS, and exits.
+pub fn serve<G: Game + Send + Sync + 'static>(
+    socket_path: &str,
+    manager: Arc<RwLock<GameManager<G>>>,
+    sessions: Arc<RwLock<HashMap<String, PlayerId>>>,
+) -> io::Result<()>
+where
+    G::Move: Send + Sync,
+{
+    // a previous process's socket may still exist (it's unreachable once we bind, and will exit soon)
+    let _ = fs::remove_file(socket_path);
+    let listener = UnixListener::bind(socket_path)?;
+    let drain_secs = env::var("HANDOFF_DRAIN_SECS")
+        .ok()
+        .and_then(|s| s.parse::<u64>().ok())
+        .unwrap_or(DEFAULT_DRAIN_SECS);
+
+    thread::spawn(move || {
+        for stream in listener.incoming() {
+            let stream = match stream {
+                Ok(s) => s,
+                Err(_) => continue,
+            };
+
+            // stop changing state before taking the snapshot, so nothing is left out of it
+            DRAINING.store(true, Ordering::SeqCst);
+            let mut writer = BufWriter::new(stream);
+            match write_snapshot(&mut writer, &*manager, &*sessions).and_then(|_| writer.flush()) {
+                Ok(()) => {
+                    thread::sleep(Duration::from_secs(drain_secs));
+                    process::exit(0);
+                }
+                Err(e) => {
+                    eprintln!("state handoff failed: {}", e);
+                    DRAINING.store(false, Ordering::SeqCst);
+                }
+            }
+        }
+    });
+
+    Ok(())
+}
@@ -0,0 +1,86 @@
+//! The house bot: a user account played by the server itself, so participants always have an
+//! opponent to test against.
+//!
+//! Set HOUSE_BOT_USER_ID to the id of the bot's account. Every POLL_INTERVAL, the bot gathers
+//! every game it is on move in, chooses all of their moves in one batch (see BatchMoves), and
+//! plays them. It plays the games held in this server's game manager, which are the games being
+//! played through this server.
+
+use crate::game::{BatchMoves, GamePlayer};
+use crate::game_manage::{AppState, GameId, GameManager};
+use crate::run_migrations;
+use crate::shared::Error;
+use crate::users::PlayerId;
+use std::env;
+use std::sync::{Arc, RwLock};
+use std::thread;
+use std::time::{Duration, Instant};
+
+/// how often the bot looks for games it is on move in
+const POLL_INTERVAL: Duration = Duration::from_millis(50);
+/// report throughput this often
+const REPORT_INTERVAL: Duration = Duration::from_secs(60);
+
+/// start the house bot (if HOUSE_BOT_USER_ID is set)
+pub fn start<G: BatchMoves + Send + Sync + 'static>(manager: Arc<RwLock<GameManager<G>>>) {
+    let user = match env::var("HOUSE_BOT_USER_ID")
+        .ok()
+        .and_then(|id| id.parse::<i32>().ok())
+    {
+        Some(id) => PlayerId::new(id),
+        None => return,
+    };
+    thread::spawn(move || run(user, &manager));
+}
+
+fn run<G: BatchMoves>(user: PlayerId, manager: &RwLock<GameManager<G>>) {
+    let conn = run_migrations::open_db();
+    let mut moves = 0;
+    let mut batches = 0;
+    let mut last_report = Instant::now();
+
+    loop {
+        let pending = manager.read().unwrap().waiting_on(user);
+        if !pending.is_empty() {
+            play(user, manager, &conn, &pending);
+            moves += pending.len();
+            batches += 1;
+        }
+
+        if last_report.elapsed() >= REPORT_INTERVAL {
+            if batches > 0 {
+                eprintln!(
+                    "house bot: {} moves in {} batches over the last {:?}",
+                    moves, batches, REPORT_INTERVAL
+                );
+            }
+            moves = 0;
+            batches = 0;
+            last_report = Instant::now();
+        }
+        thread::sleep(POLL_INTERVAL);
+    }
+}
+
+/// choose moves for every pending game at once, and play them
+fn play<G: BatchMoves>(
+    user: PlayerId,
+    manager: &RwLock<GameManager<G>>,
+    conn: &diesel::pg::PgConnection,
+    pending: &[(GameId, GamePlayer, G)],
+) {
+    let positions = pending
+        .iter()
+        .map(|(_, player, game)| (game, *player))
+        .collect::<Vec<_>>();
+    let moves = G::choose_moves(&positions);
+
+    let app = AppState::new(conn, manager);
+    for ((game_id, _, _), m) in pending.iter().zip(moves) {
+        match app.play_move(*game_id, user, m) {
+            // the opponent left, or another server moved first
+            Ok(()) | Err(Error::WrongTurn) | Err(Error::NotJoinedGame) => (),
+            Err(e) => eprintln!("house bot couldn't move in game {:?}: {:?}", game_id, e),
+        }
+    }
+}
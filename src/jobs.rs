@@ -0,0 +1,195 @@
+use crate::game::Game;
+use crate::shared::Error;
+use diesel::connection::SimpleConnection;
+use diesel::pg::PgConnection;
+use diesel::prelude::*;
+use diesel::sql_types::{BigInt, Bool};
+use std::env;
+use std::thread;
+use std::time::Duration;
+
+/// how often a node that isn't leading a job checks if it can take over
+const FOLLOWER_RETRY: Duration = Duration::from_secs(2);
+/// how long the database waits on an idle connection before probing it (and releasing a dead leader's locks)
+const TCP_KEEPALIVE_SECS: u32 = 2;
+
+/// A periodic background task that runs on only one node at a time
+pub struct Job {
+    pub name: &'static str,
+    pub interval: Duration,
+    /// run the job. This is called in a transaction, after checking that the lease is still held
+    pub run: fn(&PgConnection, &Lease) -> Result<(), Error>,
+}
+
+/// The right to run a job, identified by a fencing token that increases every time leadership changes hands
+pub struct Lease {
+    name: &'static str,
+    token: i64,
+}
+
+impl Lease {
+    pub fn token(&self) -> i64 {
+        self.token
+    }
+
+    /// check that no other node has taken over the job, and lock the lease row until the end of the
+    /// current transaction, so that no other node can take over until the transaction commits
+    fn check(&self, conn: &PgConnection) -> Result<(), Error> {
+        use crate::schema::job_leases;
+
+        let current = job_leases::dsl::job_leases
+            .find(self.name)
+            .select(job_leases::dsl::token)
+            .for_update()
+            .first::<i64>(conn)?;
+        if current == self.token {
+            Ok(())
+        } else {
+            Err(Error::LeaseLost)
+        }
+    }
+}
+
+/// the background jobs run by the server
+pub const JOBS: &[Job] = &[Job {
+    name: "reconcile_active_flags",
+    interval: Duration::from_secs(60),
+    run: reconcile_active_flags,
+}];
+
+/// advisory lock key for a job (fnv-1a hash of its name)
+fn lock_key(name: &str) -> i64 {
+    let mut hash: u64 = 0xcbf2_9ce4_8422_2325;
+    for b in name.bytes() {
+        hash ^= b as u64;
+        hash = hash.wrapping_mul(0x0100_0000_01b3);
+    }
+    hash as i64
+}
+
+#[derive(QueryableByName)]
+struct Locked {
+    #[sql_type = "Bool"]
+    locked: bool,
+}
+
+/// try to take the advisory lock for a job. If it is taken, bump the job's fencing token and return the lease
+fn try_acquire(conn: &PgConnection, job: &Job) -> Result<Option<Lease>, Error> {
+    use crate::schema::job_leases::dsl::*;
+
+    let lock = diesel::sql_query("SELECT pg_try_advisory_lock($1) AS locked")
+        .bind::<BigInt, _>(lock_key(job.name))
+        .get_result::<Locked>(conn)?;
+    if !lock.locked {
+        return Ok(None);
+    }
+
+    let new_token = diesel::insert_into(job_leases)
+        .values((name.eq(job.name), token.eq(1i64)))
+        .on_conflict(name)
+        .do_update()
+        .set(token.eq(token + 1i64))
+        .returning(token)
+        .get_result::<i64>(conn)?;
+    Ok(Some(Lease {
+        name: job.name,
+        token: new_token,
+    }))
+}
+
+/// open a dedicated connection for a job. Advisory locks belong to a session, so this can't be a pooled connection
+fn connect() -> Option<PgConnection> {
+    let url = env::var("DATABASE_URL").ok()?;
+    let conn = PgConnection::establish(&url).ok()?;
+    // have the database notice quickly if this node dies, so its locks are released
+    conn.batch_execute(&format!(
+        "SET tcp_keepalives_idle = {0}; SET tcp_keepalives_interval = {0}; SET tcp_keepalives_count = 2",
+        TCP_KEEPALIVE_SECS
+    ))
+    .ok()?;
+    Some(conn)
+}
+
+/// run a job forever, whenever this node holds its lock
+fn run_job(job: &'static Job) {
+    let mut conn: Option<PgConnection> = None;
+    let mut lease: Option<Lease> = None;
+
+    loop {
+        if conn.is_none() {
+            conn = connect();
+            lease = None;
+        }
+
+        let wait = match (&conn, &lease) {
+            (None, _) => FOLLOWER_RETRY,
+            (Some(c), None) => match try_acquire(c, job) {
+                Ok(Some(l)) => {
+                    lease = Some(l);
+                    Duration::from_secs(0)
+                }
+                Ok(None) => FOLLOWER_RETRY,
+                Err(_) => {
+                    // dropping the connection releases the lock (if the session still exists)
+                    conn = None;
+                    FOLLOWER_RETRY
+                }
+            },
+            (Some(c), Some(l)) => {
+                match c.transaction(|| {
+                    l.check(c)?;
+                    (job.run)(c, l)
+                }) {
+                    Ok(()) => (),
+                    Err(Error::LeaseLost) => {
+                        eprintln!("job {}: lost lease to another node", job.name);
+                        conn = None;
+                    }
+                    Err(e) => {
+                        eprintln!("job {} failed: {:?}", job.name, e);
+                        // connection errors mean the lock may be gone with the session
+                        if c.batch_execute("SELECT 1").is_err() {
+                            conn = None;
+                        }
+                    }
+                }
+                job.interval
+            }
+        };
+
+        thread::sleep(wait);
+    }
+}
+
+/// start a thread for each job. Each node runs the threads, but a job only runs on the node holding its lock
+pub fn start(jobs: &'static [Job]) {
+    for job in jobs {
+        thread::spawn(move || run_job(job));
+    }
+}
+
+/// mark games that are finished but still flagged active in the db as inactive
+fn reconcile_active_flags(conn: &PgConnection, _lease: &Lease) -> Result<(), Error> {
+    use crate::schema::db_games::dsl::*;
+
+    let candidates = db_games
+        .filter(active.eq(1))
+        .filter(state.is_not_null())
+        .select((id, state, players))
+        .load::<(i32, Option<String>, String)>(conn)?;
+
+    for (game_id, game_state, game_players) in candidates {
+        let num_players = serde_json::from_str::<Vec<i32>>(&game_players)?.len();
+        let game = crate::GameType::from_state(
+            serde_json::from_str(&game_state.unwrap_or_default())?,
+            num_players,
+        );
+        if game.finished() {
+            diesel::update(db_games.find(game_id))
+                .set(active.eq(0))
+                .execute(conn)?;
+        }
+    }
+
+    Ok(())
+}
@@ -0,0 +1,585 @@
+//! A local, append-only journal of game saves, so moves can be written to the database in the
+//! background (write-behind) without being lost in a crash.
+//!
+//! With the journal on, a save of an active game is appended to the journal and synced to disk
+//! before the move is acknowledged, and the game is only written to db_games later, in batches,
+//! by the flusher. Syncs are group committed: the first save to wait becomes the leader, and
+//! writes and syncs everything appended so far in one go. Saves made while it syncs wait for the
+//! next leader, so under load one fsync covers many moves.
+//!
+//! The journal is split into segments. Each flush starts a new segment, and deletes the older ones
+//! once their games are in the database. A segment starts with the version of the game snapshot
+//! format its records are in, and segments of another version are set aside rather than replayed.
+//!
+//! Each process holds a lock on a lock file named like its segments for as long as it runs. On
+//! startup, the segments of processes that no longer hold their lock (ones that crashed) are
+//! replayed into the database (the latest save of each game wins) before the app serves any
+//! requests. Segments of a process that is still draining after a handoff are left to it.
+//!
+//! Set JOURNAL_DIR to a local directory to turn the journal on. Without it, every save goes
+//! straight to the database.
+
+use crate::game::Game;
+use crate::game_manage::{self, GameManager};
+use crate::handoff::SNAPSHOT_VERSION;
+use crate::run_migrations;
+use crate::shared::Error;
+use std::collections::HashMap;
+use std::env;
+use std::fs::{self, File, OpenOptions};
+use std::io::{self, Write};
+use std::mem;
+use std::os::unix::io::AsRawFd;
+use std::path::{Path, PathBuf};
+use std::sync::{Arc, Condvar, Mutex, RwLock};
+use std::thread;
+use std::time::{Duration, SystemTime, UNIX_EPOCH};
+
+/// how often dirty games are written to the database
+const FLUSH_INTERVAL: Duration = Duration::from_millis(200);
+const SEGMENT_EXTENSION: &str = "journal";
+const LOCK_EXTENSION: &str = "lock";
+/// extension given to segments that can't be replayed, so they are kept but not read again
+const REJECTED_EXTENSION: &str = "rejected";
+const SEGMENT_MAGIC: &[u8; 4] = b"CKJN";
+/// bytes at the start of each segment: its magic and snapshot version
+const SEGMENT_HEADER_LEN: usize = 5;
+/// bytes before each record's payload: its length (u32) and checksum (u64)
+const HEADER_LEN: usize = 12;
+
+/// FNV-1a, to find records torn by a crash
+fn checksum(bytes: &[u8]) -> u64 {
+    bytes.iter().fold(0xcbf2_9ce4_8422_2325, |hash, b| {
+        (hash ^ *b as u64).wrapping_mul(0x100_0000_01b3)
+    })
+}
+
+/// the records in a segment, up to the first torn or corrupt one
+fn read_records(bytes: &[u8]) -> (Vec<Vec<u8>>, usize) {
+    let mut records = Vec::new();
+    let mut pos = 0;
+    while bytes.len() - pos >= HEADER_LEN {
+        let mut len = [0; 4];
+        let mut sum = [0; 8];
+        len.copy_from_slice(&bytes[pos..pos + 4]);
+        sum.copy_from_slice(&bytes[pos + 4..pos + HEADER_LEN]);
+        let start = pos + HEADER_LEN;
+        let end = start + u32::from_le_bytes(len) as usize;
+        if end > bytes.len() || checksum(&bytes[start..end]) != u64::from_le_bytes(sum) {
+            break;
+        }
+        records.push(bytes[start..end].to_vec());
+        pos = end;
+    }
+    (records, pos)
+}
+
+/// every file in dir with the given extension, sorted by name
+fn files_with_extension(dir: &Path, extension: &str) -> io::Result<Vec<PathBuf>> {
+    let mut paths = fs::read_dir(dir)?
+        .map(|entry| entry.map(|e| e.path()))
+        .collect::<io::Result<Vec<_>>>()?
+        .into_iter()
+        .filter(|path| path.extension().map_or(false, |ext| ext == extension))
+        .collect::<Vec<_>>();
+    paths.sort();
+    Ok(paths)
+}
+
+/// every segment in dir, oldest first. Names sort in the order the segments were written
+fn segments(dir: &Path) -> io::Result<Vec<PathBuf>> {
+    files_with_extension(dir, SEGMENT_EXTENSION)
+}
+
+/// the prefix of the process that wrote a segment or lock file
+fn owner(path: &Path) -> Option<String> {
+    let stem = path.file_stem()?.to_str()?;
+    if path.extension().map_or(false, |ext| ext == LOCK_EXTENSION) {
+        Some(stem.to_string())
+    } else {
+        stem.rsplitn(2, '-').nth(1).map(|prefix| prefix.to_string())
+    }
+}
+
+/// take the lock on a process's lock file, which is held until the file is closed (or the process
+/// exits). Returns None if another process holds it
+fn try_lock(dir: &Path, prefix: &str) -> io::Result<Option<File>> {
+    let file = OpenOptions::new()
+        .create(true)
+        .write(true)
+        .open(dir.join(format!("{}.{}", prefix, LOCK_EXTENSION)))?;
+    if unsafe { libc::flock(file.as_raw_fd(), libc::LOCK_EX | libc::LOCK_NB) } == 0 {
+        return Ok(Some(file));
+    }
+    match io::Error::last_os_error() {
+        e if e.kind() == io::ErrorKind::WouldBlock => Ok(None),
+        e => Err(e),
+    }
+}
+
+struct JournalState {
+    /// number of the segment being appended to
+    segment: u64,
+    file: Arc<File>,
+    /// records appended to older segments but not yet written, with the segment files they go to
+    sealed: Vec<(Arc<File>, Vec<u8>)>,
+    /// records appended but not yet written
+    pending: Vec<u8>,
+    /// number of records appended
+    appended: u64,
+    /// number of records written and synced
+    durable: u64,
+    /// set while a leader is writing and syncing
+    syncing: bool,
+    /// set once a write fails. Nothing can be made durable after that
+    failed: bool,
+}
+
+/// The journal of this process. Its segments are named by when the process started, so they
+/// don't clash with another process's during a handoff
+pub struct Journal {
+    dir: PathBuf,
+    prefix: String,
+    /// this process's lock file, locked so other processes don't replay its segments
+    _lock: File,
+    /// the segment to rotate to, opened ahead so rotating doesn't wait on the disk
+    next: Mutex<Option<(u64, File)>>,
+    state: Mutex<JournalState>,
+    synced: Condvar,
+}
+
+/// A journaled record, which is durable once waited on
+pub struct Commit {
+    journal: Arc<Journal>,
+    seq: u64,
+}
+
+impl Commit {
+    /// wait for a commit to be durable (if there is one)
+    pub fn wait(commit: Option<Commit>) -> Result<(), Error> {
+        match commit {
+            Some(commit) => commit.journal.sync(commit.seq),
+            None => Ok(()),
+        }
+    }
+}
+
+impl Journal {
+    /// start a journal in dir, which must not have any segments of this process yet
+    fn create(dir: &Path) -> io::Result<Journal> {
+        let started_ms = SystemTime::now()
+            .duration_since(UNIX_EPOCH)
+            .map_or(0, |d| d.as_millis());
+        let prefix = format!("{:013}-{}", started_ms, std::process::id());
+        let lock = try_lock(dir, &prefix)?
+            .ok_or_else(|| io::Error::new(io::ErrorKind::AlreadyExists, "journal prefix in use"))?;
+        let file = Journal::open_segment(dir, &prefix, 0)?;
+        Ok(Journal {
+            dir: dir.to_path_buf(),
+            prefix,
+            _lock: lock,
+            next: Mutex::new(None),
+            state: Mutex::new(JournalState {
+                segment: 0,
+                file: Arc::new(file),
+                sealed: Vec::new(),
+                pending: Vec::new(),
+                appended: 0,
+                durable: 0,
+                syncing: false,
+                failed: false,
+            }),
+            synced: Condvar::new(),
+        })
+    }
+
+    fn segment_path(dir: &Path, prefix: &str, segment: u64) -> PathBuf {
+        dir.join(format!("{}-{:010}.{}", prefix, segment, SEGMENT_EXTENSION))
+    }
+
+    fn open_segment(dir: &Path, prefix: &str, segment: u64) -> io::Result<File> {
+        let mut file = OpenOptions::new()
+            .create_new(true)
+            .append(true)
+            .open(Journal::segment_path(dir, prefix, segment))?;
+        file.write_all(SEGMENT_MAGIC)?;
+        file.write_all(&[SNAPSHOT_VERSION])?;
+        file.sync_data()?;
+        // sync the directory, so the new segment is found after a crash
+        File::open(dir)?.sync_all()?;
+        Ok(file)
+    }
+
+    /// add a record to the journal. It isn't durable until the returned commit is waited on
+    pub fn append(journal: &Arc<Journal>, record: &[u8]) -> Result<Commit, Error> {
+        let mut state = journal.state.lock().unwrap();
+        if state.failed {
+            return Err(Error::JournalFailed);
+        }
+        state
+            .pending
+            .extend_from_slice(&(record.len() as u32).to_le_bytes());
+        state
+            .pending
+            .extend_from_slice(&checksum(record).to_le_bytes());
+        state.pending.extend_from_slice(record);
+        state.appended += 1;
+        Ok(Commit {
+            journal: journal.clone(),
+            seq: state.appended,
+        })
+    }
+
+    /// wait until record seq is durable, leading a sync if no other save is
+    fn sync(&self, seq: u64) -> Result<(), Error> {
+        let mut state = self.state.lock().unwrap();
+        loop {
+            if state.durable >= seq {
+                return Ok(());
+            }
+            if state.failed {
+                return Err(Error::JournalFailed);
+            }
+            if state.syncing {
+                state = self.synced.wait(state).unwrap();
+                continue;
+            }
+
+            // lead: write and sync every record appended so far, without holding the lock.
+            // Records of older segments go first, so segments are written in order
+            state.syncing = true;
+            let mut batches = mem::take(&mut state.sealed);
+            batches.push((state.file.clone(), mem::take(&mut state.pending)));
+            let through = state.appended;
+            drop(state);
+            let result = batches
+                .iter()
+                .filter(|(_, batch)| !batch.is_empty())
+                .try_for_each(|(file, batch)| {
+                    (&**file).write_all(batch).and_then(|_| file.sync_data())
+                });
+
+            state = self.state.lock().unwrap();
+            state.syncing = false;
+            match result {
+                Ok(()) => state.durable = state.durable.max(through),
+                Err(e) => {
+                    eprintln!("journal write failed, moves can't be saved: {}", e);
+                    state.failed = true;
+                }
+            }
+            self.synced.notify_all();
+        }
+    }
+
+    /// open the segment the next rotation switches to, if it isn't open yet
+    fn prepare_rotation(&self) -> Result<(), Error> {
+        let mut next = self.next.lock().unwrap();
+        if next.is_none() {
+            let segment = self.state.lock().unwrap().segment + 1;
+            let file = Journal::open_segment(&self.dir, &self.prefix, segment).map_err(|e| {
+                eprintln!("couldn't start a journal segment: {}", e);
+                Error::JournalFailed
+            })?;
+            *next = Some((segment, file));
+        }
+        Ok(())
+    }
+
+    /// switch to the segment opened by prepare_rotation, and return the number of the old one and
+    /// the number of records appended to it and the segments before it. Called with the game
+    /// manager locked, so the dirty games taken with it are the games journaled in them. Doesn't
+    /// write anything: the old segment's unwritten records go out with the next sync
+    fn rotate(&self) -> Result<(u64, u64), Error> {
+        let (segment, file) = self
+            .next
+            .lock()
+            .unwrap()
+            .take()
+            .ok_or(Error::JournalFailed)?;
+        let mut state = self.state.lock().unwrap();
+        if state.failed {
+            return Err(Error::JournalFailed);
+        }
+        let old = mem::replace(&mut state.file, Arc::new(file));
+        let batch = mem::take(&mut state.pending);
+        state.sealed.push((old, batch));
+        let old_segment = mem::replace(&mut state.segment, segment);
+        Ok((old_segment, state.appended))
+    }
+
+    /// delete this process's segments up to and including segment, whose games are in the db
+    fn remove_through(&self, segment: u64) {
+        for s in (0..=segment).rev() {
+            match fs::remove_file(Journal::segment_path(&self.dir, &self.prefix, s)) {
+                Ok(()) => (),
+                // earlier segments were already removed
+                Err(e) if e.kind() == io::ErrorKind::NotFound => break,
+                Err(e) => eprintln!("couldn't remove journal segment {}: {}", s, e),
+            }
+        }
+    }
+}
+
+/// replay the segments in dir into the db, and delete them
+fn recover<G: Game>(dir: &Path) -> Result<(), Error> {
+    let list_error = |e: io::Error| {
+        eprintln!("couldn't list journal segments in {}: {}", dir.display(), e);
+        Error::JournalFailed
+    };
+    // lock every process that left files behind. The ones that can't be locked are still running
+    let mut owners = HashMap::new();
+    for path in files_with_extension(dir, LOCK_EXTENSION).map_err(list_error)? {
+        let prefix = match owner(&path) {
+            Some(prefix) => prefix,
+            None => continue,
+        };
+        let lock = try_lock(dir, &prefix).map_err(list_error)?;
+        if lock.is_none() {
+            println!(
+                "journal: leaving segments of running process {} to it",
+                prefix
+            );
+        }
+        owners.insert(prefix, lock);
+    }
+    // listed after locking, so a process that exited meanwhile has all its segments listed
+    let mut paths = Vec::new();
+    for path in segments(dir).map_err(list_error)? {
+        let prefix = match owner(&path) {
+            Some(prefix) => prefix,
+            None => continue,
+        };
+        if !owners.contains_key(&prefix) {
+            // written before segments had lock files
+            owners.insert(prefix.clone(), try_lock(dir, &prefix).map_err(list_error)?);
+        }
+        if owners[&prefix].is_some() {
+            paths.push(path);
+        }
+    }
+
+    let mut records = Vec::new();
+    let mut replayed = Vec::new();
+    for path in paths {
+        let bytes = fs::read(&path).map_err(|_| Error::JournalFailed)?;
+        if bytes.len() < SEGMENT_HEADER_LEN {
+            // created just before the crash, so none of its saves were acknowledged
+            replayed.push(path);
+            continue;
+        }
+        let (header, body) = bytes.split_at(SEGMENT_HEADER_LEN);
+        if &header[0..4] != SEGMENT_MAGIC || header[4] != SNAPSHOT_VERSION {
+            // written by a build with another game format, which this one would decode as garbage
+            let rejected = path.with_extension(REJECTED_EXTENSION);
+            eprintln!(
+                "journal: {} isn't a version {} segment, its games must be replayed by the build \
+                 that wrote it. Moved it to {}",
+                path.display(),
+                SNAPSHOT_VERSION,
+                rejected.display()
+            );
+            fs::rename(&path, &rejected).map_err(|_| Error::JournalFailed)?;
+            continue;
+        }
+        let (segment_records, read) = read_records(body);
+        if read < body.len() {
+            // the end of the last write before the crash. Its saves were never acknowledged
+            eprintln!(
+                "journal: ignoring {} torn bytes at the end of {}",
+                body.len() - read,
+                path.display()
+            );
+        }
+        records.extend(segment_records);
+        replayed.push(path);
+    }
+    if !records.is_empty() {
+        let conn = run_migrations::open_db();
+        let games = game_manage::replay_journal::<G>(&conn, &records)?;
+        println!(
+            "journal: replayed {} saves of {} games from {} segments",
+            records.len(),
+            games,
+            replayed.len()
+        );
+    }
+
+    for path in &replayed {
+        fs::remove_file(path).map_err(|_| Error::JournalFailed)?;
+    }
+    for (prefix, lock) in &owners {
+        if lock.is_some() {
+            let path = dir.join(format!("{}.{}", prefix, LOCK_EXTENSION));
+            fs::remove_file(path).map_err(|_| Error::JournalFailed)?;
+        }
+    }
+    Ok(())
+}
+
+/// write the games journaled since the last flush to the db, then drop the segments they were in
+fn flush<G: Game>(
+    journal: &Journal,
+    manager: &RwLock<GameManager<G>>,
+    conn: &diesel::pg::PgConnection,
+) -> Result<(), Error> {
+    // open the next segment before locking the manager, so saves don't wait on the disk
+    journal.prepare_rotation()?;
+    let mut locked = manager.write().unwrap();
+    let games = locked.take_dirty();
+    if games.is_empty() {
+        return Ok(());
+    }
+    let rotated = journal.rotate();
+    drop(locked);
+
+    let result = rotated.and_then(|(segment, through)| {
+        // the old segments are kept if the write back fails, so they must hold every save of
+        // the games first
+        journal.sync(through)?;
+        game_manage::write_back(conn, &games)?;
+        journal.remove_through(segment);
+        Ok(())
+    });
+    if result.is_err() {
+        // keep the segments, and try the games again next flush
+        manager.write().unwrap().restore_dirty(&games);
+    }
+    result
+}
+
+/// replay the journal in JOURNAL_DIR (if it's set) into the db, then journal saves of active games
+/// and write them to the db in the background. Must be called before serving requests
+pub fn start<G: Game + Send + Sync + 'static>(manager: Arc<RwLock<GameManager<G>>>) {
+    let dir = match env::var("JOURNAL_DIR") {
+        Ok(dir) => PathBuf::from(dir),
+        Err(_) => return,
+    };
+    fs::create_dir_all(&dir).expect("couldn't create JOURNAL_DIR");
+    recover::<G>(&dir).expect("couldn't replay the journal into the database");
+    let journal = Arc::new(Journal::create(&dir).expect("couldn't start the journal"));
+    manager.write().unwrap().set_journal(journal.clone());
+
+    thread::spawn(move || {
+        let conn = run_migrations::open_db();
+        loop {
+            thread::sleep(FLUSH_INTERVAL);
+            if let Err(e) = flush(&journal, &manager, &conn) {
+                eprintln!("journal: couldn't flush games to the database: {:?}", e);
+            }
+        }
+    });
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn frame(record: &[u8]) -> Vec<u8> {
+        let mut bytes = (record.len() as u32).to_le_bytes().to_vec();
+        bytes.extend_from_slice(&checksum(record).to_le_bytes());
+        bytes.extend_from_slice(record);
+        bytes
+    }
+
+    fn temp_dir(name: &str) -> PathBuf {
+        let dir = env::temp_dir().join(format!("journal-{}-{}", name, std::process::id()));
+        let _ = fs::remove_dir_all(&dir);
+        fs::create_dir_all(&dir).unwrap();
+        dir
+    }
+
+    fn read_segment(path: &Path) -> Vec<Vec<u8>> {
+        let bytes = fs::read(path).unwrap();
+        assert_eq!(&bytes[0..4], SEGMENT_MAGIC);
+        assert_eq!(bytes[4], SNAPSHOT_VERSION);
+        let (records, read) = read_records(&bytes[SEGMENT_HEADER_LEN..]);
+        assert_eq!(read, bytes.len() - SEGMENT_HEADER_LEN);
+        records
+    }
+
+    #[test]
+    fn read_records_stops_at_torn_tail() {
+        let records = vec![b"first".to_vec(), Vec::new(), b"third record".to_vec()];
+        let bytes = records.iter().flat_map(|r| frame(r)).collect::<Vec<_>>();
+        assert_eq!(read_records(&bytes), (records.clone(), bytes.len()));
+
+        // cut anywhere in the last record, only the records before it are read
+        let last = bytes.len() - frame(&records[2]).len();
+        for len in last..bytes.len() {
+            assert_eq!(read_records(&bytes[..len]), (records[..2].to_vec(), last));
+        }
+
+        // a record that was only partly overwritten fails its checksum
+        let mut corrupt = bytes.clone();
+        *corrupt.last_mut().unwrap() ^= 1;
+        assert_eq!(read_records(&corrupt), (records[..2].to_vec(), last));
+
+        // so does a length that runs past the end
+        let mut long = bytes[..last].to_vec();
+        long.extend_from_slice(&u32::max_value().to_le_bytes());
+        long.extend_from_slice(&[0; 8]);
+        assert_eq!(read_records(&long), (records[..2].to_vec(), last));
+    }
+
+    #[test]
+    fn group_commit_makes_every_append_durable() {
+        let dir = temp_dir("sync");
+        let journal = Arc::new(Journal::create(&dir).unwrap());
+        let threads = (0..8)
+            .map(|t| {
+                let journal = journal.clone();
+                thread::spawn(move || {
+                    for i in 0..50 {
+                        let record = format!("{}-{}", t, i).into_bytes();
+                        let commit = Journal::append(&journal, &record).unwrap();
+                        let seq = commit.seq;
+                        Commit::wait(Some(commit)).unwrap();
+                        assert!(journal.state.lock().unwrap().durable >= seq);
+                    }
+                })
+            })
+            .collect::<Vec<_>>();
+        for thread in threads {
+            thread.join().unwrap();
+        }
+
+        let state = journal.state.lock().unwrap();
+        assert_eq!((state.appended, state.durable), (400, 400));
+        assert!(state.pending.is_empty());
+        drop(state);
+        let mut records = read_segment(&segments(&dir).unwrap()[0]);
+        records.sort();
+        let mut expected = (0..8)
+            .flat_map(|t| (0..50).map(move |i| format!("{}-{}", t, i).into_bytes()))
+            .collect::<Vec<_>>();
+        expected.sort();
+        assert_eq!(records, expected);
+        fs::remove_dir_all(&dir).unwrap();
+    }
+
+    #[test]
+    fn rotate_leaves_old_records_to_the_next_sync() {
+        let dir = temp_dir("rotate");
+        let journal = Arc::new(Journal::create(&dir).unwrap());
+        Journal::append(&journal, b"old 1").unwrap();
+        Journal::append(&journal, b"old 2").unwrap();
+        journal.prepare_rotation().unwrap();
+        assert_eq!(journal.rotate().unwrap(), (0, 2));
+        let commit = Journal::append(&journal, b"new").unwrap();
+        assert_eq!(journal.state.lock().unwrap().durable, 0);
+
+        journal.sync(2).unwrap();
+        let paths = segments(&dir).unwrap();
+        assert_eq!(
+            read_segment(&paths[0]),
+            vec![b"old 1".to_vec(), b"old 2".to_vec()]
+        );
+        Commit::wait(Some(commit)).unwrap();
+        assert_eq!(read_segment(&paths[1]), vec![b"new".to_vec()]);
+
+        journal.remove_through(0);
+        assert_eq!(segments(&dir).unwrap(), paths[1..].to_vec());
+        fs::remove_dir_all(&dir).unwrap();
+    }
+}
@@ -0,0 +1,165 @@
+#![feature(proc_macro_hygiene, decl_macro)]
+
+#[macro_use]
+extern crate rocket;
+#[macro_use]
+extern crate rocket_contrib;
+#[macro_use]
+extern crate diesel;
+#[macro_use]
+extern crate diesel_migrations;
+
+extern crate dotenv;
+
+use rocket::fairing::AdHoc;
+use rocket::http::Method;
+use rocket_cors::{AllowedHeaders, AllowedOrigins};
+use std::collections::HashMap;
+use std::sync::{Arc, RwLock};
+
+pub mod access_log;
+pub mod admission;
+pub mod broadcast;
+pub mod capture;
+pub mod contention;
+pub mod corpus;
+pub mod fixtures;
+pub mod game;
+pub mod game_manage;
+pub mod handoff;
+pub mod house_bot;
+pub mod jobs;
+pub mod journal;
+pub mod metrics;
+pub mod models;
+pub mod pages;
+pub mod presence;
+pub mod query_plans;
+pub mod ring;
+pub mod run_migrations;
+pub mod schema;
+pub mod shared;
+pub mod tournament_sim;
+pub mod users;
+
+use rocket::response::NamedFile;
+use std::path::{Path, PathBuf};
+
+pub mod gomoku;
+pub mod othello;
+use gomoku::Gomoku;
+
+pub type GameType = Gomoku;
+pub const TOURNAMENT_GAME_PLAYERS: usize = 2;
+
+/// routes to serve frontend
+#[get("/", rank = 9)]
+fn frontend_root() -> Option<NamedFile> {
+    NamedFile::open(Path::new("frontend/build/index.html")).ok()
+}
+
+#[get("/<file..>", rank = 10)]
+fn frontend_route(file: PathBuf) -> Option<NamedFile> {
+    let file = NamedFile::open(Path::new("frontend/build/").join(file));
+
+    match file {
+        Ok(file) => Some(file),
+        Err(_) => {
+            // serve index.html
+            NamedFile::open(Path::new("frontend/build/index.html")).ok()
+        }
+    }
+}
+
+/// build the app, serving the given game manager and sessions
+pub fn rocket(
+    manager: Arc<RwLock<game_manage::GameManager<GameType>>>,
+    sessions: Arc<RwLock<HashMap<String, users::PlayerId>>>,
+) -> rocket::Rocket {
+    // setup cors
+    let cors = rocket_cors::CorsOptions {
+        allowed_origins: AllowedOrigins::all(),
+        allowed_methods: vec![Method::Get, Method::Post, Method::Put]
+            .into_iter()
+            .map(From::from)
+            .collect(),
+        allowed_headers: AllowedHeaders::all(),
+        allow_credentials: true,
+        ..Default::default()
+    }
+    .to_cors()
+    .unwrap();
+
+    let mut app = rocket::ignite();
+    // first, so the fairings after it see shed requests already sent to the overloaded route
+    if let Some(admission) = admission::Admission::from_env() {
+        app = app.attach(admission);
+    }
+    if let Some(access_log) = access_log::AccessLog::from_env() {
+        app = app.attach(access_log);
+    }
+    if let Some(capture) = capture::Capture::from_env() {
+        app = app.attach(capture);
+    }
+    let metrics = Arc::new(metrics::Metrics::default());
+    let metrics_manager = manager.clone();
+
+    app.attach(cors)
+        .attach(metrics::MetricsFairing(metrics.clone()))
+        .attach(shared::DBConn::fairing())
+        .attach(AdHoc::on_attach("Stream Limit", |rocket| {
+            broadcast::set_workers(rocket.config().workers as usize);
+            Ok(rocket)
+        }))
+        .attach(AdHoc::on_attach("Metrics Publisher", {
+            let metrics = metrics.clone();
+            move |rocket| {
+                // after the database fairing, so the pool can be watched
+                let db_usage = shared::db_pool_usage(&rocket);
+                metrics::Metrics::start(metrics, metrics_manager, db_usage);
+                Ok(rocket)
+            }
+        }))
+        .manage(metrics)
+        .manage(manager)
+        .manage(sessions)
+        .mount(
+            "/api",
+            routes![
+                game_manage::game_get_user_authd,
+                game_manage::game_get,
+                game_manage::game_move_needed,
+                game_manage::game_move,
+                game_manage::game_premoves,
+                game_manage::game_watch,
+                game_manage::game_wall,
+                game_manage::game_threats,
+                game_manage::game_new,
+                game_manage::game_join,
+                game_manage::game_leave,
+                game_manage::game_start,
+                game_manage::game_index,
+                game_manage::tournament_new,
+                game_manage::tournament_join,
+                game_manage::tournament_leave,
+                game_manage::tournament_start,
+                users::user_new,
+                users::user_get,
+                users::user_edit,
+                users::session_new,
+                users::session_delete,
+                users::user_generate_api_key,
+                users::admin_users_bulk,
+                users::admin_users_bulk_csv,
+                presence::presence,
+                pages::page_new,
+                pages::page_get,
+                pages::page_edit,
+                tournament_sim::tournament_simulate,
+                metrics::admin_metrics,
+                metrics::admin_metrics_stream,
+            ],
+        )
+        .mount("/", routes![frontend_route, frontend_root])
+        .register(catchers![users::unauthorized])
+}
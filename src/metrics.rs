@@ -0,0 +1,398 @@
+use crate::access_log::RequestStart;
+use crate::broadcast::{self, Format, StreamError, StreamSlot, STREAM_FRAME};
+use crate::game::Game;
+use crate::game_manage::GameManager;
+use crate::models::User;
+use crate::shared::{Error, ErrorResp};
+use rocket::fairing::{Fairing, Info, Kind};
+use rocket::http::ContentType;
+use rocket::response::{Content, Stream};
+use rocket::{Data, Request, Response, State};
+use rocket_contrib::json::Json;
+use serde::Serialize;
+use std::collections::{HashMap, VecDeque};
+use std::io::{self, Read};
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::{Arc, Condvar, Mutex, RwLock};
+use std::thread;
+use std::time::{Duration, Instant, SystemTime, UNIX_EPOCH};
+
+/// histogram bucket i counts durations in [2^i, 2^(i+1)) microseconds
+const BUCKETS: usize = 32;
+/// how often a new snapshot is published
+const TICK: Duration = Duration::from_secs(1);
+/// rates and percentiles are over this many ticks
+const WINDOW_TICKS: usize = 10;
+/// number of bots listed in the snapshot
+const SLOWEST_BOTS: usize = 10;
+/// weight of the newest move in a bot's average move time
+const BOT_EWMA_WEIGHT: f64 = 0.1;
+
+/// time spent waiting for the game manager lock
+pub static LOCK_WAIT: Histogram = Histogram::new();
+/// average time each bot takes to move after its opponent
+static BOT_MOVE_TIMES: Mutex<Option<HashMap<i32, BotStats>>> = Mutex::new(None);
+
+/// A lock-free histogram of durations with power of two buckets
+pub struct Histogram {
+    buckets: [AtomicU64; BUCKETS],
+}
+
+impl Histogram {
+    pub const fn new() -> Histogram {
+        const ZERO: AtomicU64 = AtomicU64::new(0);
+        Histogram {
+            buckets: [ZERO; BUCKETS],
+        }
+    }
+
+    pub fn record(&self, duration: Duration) {
+        let us = duration.as_micros().max(1) as u64;
+        let bucket = (63 - us.leading_zeros() as usize).min(BUCKETS - 1);
+        self.buckets[bucket].fetch_add(1, Ordering::Relaxed);
+    }
+
+    fn counts(&self) -> [u64; BUCKETS] {
+        let mut counts = [0; BUCKETS];
+        for (count, bucket) in counts.iter_mut().zip(self.buckets.iter()) {
+            *count = bucket.load(Ordering::Relaxed);
+        }
+        counts
+    }
+}
+
+/// the upper bound (in ms) of the bucket containing the p'th percentile of counts
+fn percentile_ms(counts: &[u64; BUCKETS], p: f64) -> f64 {
+    let total = counts.iter().sum::<u64>();
+    if total == 0 {
+        return 0.0;
+    }
+    let target = (total as f64 * p).ceil() as u64;
+    let mut seen = 0;
+    for (i, count) in counts.iter().enumerate() {
+        seen += count;
+        if seen >= target {
+            return (1u64 << (i + 1)) as f64 / 1000.0;
+        }
+    }
+    (1u64 << BUCKETS) as f64 / 1000.0
+}
+
+fn diff(now: &[u64; BUCKETS], then: &[u64; BUCKETS]) -> [u64; BUCKETS] {
+    let mut res = [0; BUCKETS];
+    for i in 0..BUCKETS {
+        res[i] = now[i] - then[i];
+    }
+    res
+}
+
+/// cumulative route error counts and latencies, and lock wait times, at a tick
+type Tick = (
+    Instant,
+    HashMap<&'static str, (u64, [u64; BUCKETS])>,
+    [u64; BUCKETS],
+);
+
+#[derive(Clone, Copy)]
+struct BotStats {
+    mean_ms: f64,
+    moves: u64,
+}
+
+/// record how long a bot took to move after its opponent's move
+pub fn record_move_time(user_id: i32, duration: Duration) {
+    let ms = duration.as_secs_f64() * 1000.0;
+    let mut bots = BOT_MOVE_TIMES.lock().unwrap();
+    let stats = bots
+        .get_or_insert_with(HashMap::new)
+        .entry(user_id)
+        .or_insert(BotStats {
+            mean_ms: ms,
+            moves: 0,
+        });
+    stats.mean_ms += (ms - stats.mean_ms) * BOT_EWMA_WEIGHT;
+    stats.moves += 1;
+}
+
+/// Request counts and latencies for a route
+#[derive(Default)]
+struct RouteStats {
+    errors: AtomicU64,
+    latency: Histogram,
+}
+
+impl Default for Histogram {
+    fn default() -> Histogram {
+        Histogram::new()
+    }
+}
+
+#[derive(Serialize, Clone, Debug)]
+pub struct RouteSnapshot {
+    route: &'static str,
+    requests_per_sec: f64,
+    errors_per_sec: f64,
+    p99_ms: f64,
+}
+
+#[derive(Serialize, Clone, Debug)]
+pub struct BotSnapshot {
+    user_id: i32,
+    mean_move_ms: f64,
+    moves: u64,
+}
+
+/// Server health over the last few seconds
+#[derive(Serialize, Clone, Debug, Default)]
+pub struct Snapshot {
+    ts_ms: u64,
+    window_secs: f64,
+    requests_per_sec: f64,
+    p99_ms: f64,
+    routes: Vec<RouteSnapshot>,
+    active_games: usize,
+    db_connections_in_use: u32,
+    db_pool_size: u32,
+    lock_wait_p99_ms: f64,
+    slowest_bots: Vec<BotSnapshot>,
+}
+
+/// Live server metrics. Requests are recorded by the fairing, and a background thread
+/// publishes a snapshot of them every second
+#[derive(Default)]
+pub struct Metrics {
+    routes: RwLock<HashMap<&'static str, Arc<RouteStats>>>,
+    /// latest snapshot, serialized once for every subscriber, and its sequence number
+    latest: Mutex<(u64, Arc<String>)>,
+    published: Condvar,
+}
+
+impl Metrics {
+    fn route(&self, name: &'static str) -> Arc<RouteStats> {
+        if let Some(stats) = self.routes.read().unwrap().get(name) {
+            return stats.clone();
+        }
+        self.routes
+            .write()
+            .unwrap()
+            .entry(name)
+            .or_insert_with(Default::default)
+            .clone()
+    }
+
+    /// the latest snapshot, as json
+    fn latest(&self) -> Arc<String> {
+        self.latest.lock().unwrap().1.clone()
+    }
+
+    /// wait for a snapshot newer than seq
+    fn next_after(&self, seq: u64) -> (u64, Arc<String>) {
+        let mut latest = self.latest.lock().unwrap();
+        while latest.0 <= seq {
+            latest = self.published.wait(latest).unwrap();
+        }
+        latest.clone()
+    }
+
+    fn publish(&self, snapshot: &Snapshot) {
+        let json = Arc::new(serde_json::to_string(snapshot).unwrap_or_default());
+        let mut latest = self.latest.lock().unwrap();
+        *latest = (latest.0 + 1, json);
+        self.published.notify_all();
+    }
+
+    /// start the thread that publishes snapshots. db_usage returns the connections in use and
+    /// the size of the database pool
+    pub fn start<G: Game + Send + Sync + 'static>(
+        metrics: Arc<Metrics>,
+        manager: Arc<RwLock<GameManager<G>>>,
+        db_usage: Option<Box<dyn Fn() -> (u32, u32) + Send>>,
+    ) where
+        G::Move: Send + Sync,
+    {
+        thread::spawn(move || {
+            let mut history: VecDeque<Tick> = VecDeque::new();
+            loop {
+                let now = Instant::now();
+                let routes = metrics
+                    .routes
+                    .read()
+                    .unwrap()
+                    .iter()
+                    .map(|(name, stats)| {
+                        (
+                            *name,
+                            (stats.errors.load(Ordering::Relaxed), stats.latency.counts()),
+                        )
+                    })
+                    .collect::<HashMap<_, _>>();
+                history.push_back((now, routes, LOCK_WAIT.counts()));
+                if history.len() > WINDOW_TICKS + 1 {
+                    history.pop_front();
+                }
+
+                let snapshot = snapshot(&history, &*manager, db_usage.as_deref());
+                metrics.publish(&snapshot);
+                thread::sleep(TICK);
+            }
+        });
+    }
+}
+
+fn snapshot<G: Game>(
+    history: &VecDeque<Tick>,
+    manager: &RwLock<GameManager<G>>,
+    db_usage: Option<&(dyn Fn() -> (u32, u32) + Send)>,
+) -> Snapshot {
+    let (then, old_routes, old_lock) = history.front().unwrap();
+    let (now, routes, lock) = history.back().unwrap();
+    let secs = now.duration_since(*then).as_secs_f64().max(1e-3);
+    let empty = [0; BUCKETS];
+
+    let mut all = [0; BUCKETS];
+    let mut route_snapshots = routes
+        .iter()
+        .map(|(name, (errors, latency))| {
+            let (old_errors, old_latency) =
+                old_routes.get(name).map_or((0, &empty), |(e, l)| (*e, l));
+            let latency = diff(latency, old_latency);
+            for i in 0..BUCKETS {
+                all[i] += latency[i];
+            }
+            RouteSnapshot {
+                route: *name,
+                requests_per_sec: latency.iter().sum::<u64>() as f64 / secs,
+                errors_per_sec: (errors - old_errors) as f64 / secs,
+                p99_ms: percentile_ms(&latency, 0.99),
+            }
+        })
+        .filter(|r| r.requests_per_sec > 0.0)
+        .collect::<Vec<_>>();
+    route_snapshots.sort_by(|a, b| b.requests_per_sec.partial_cmp(&a.requests_per_sec).unwrap());
+
+    let mut slowest_bots = BOT_MOVE_TIMES
+        .lock()
+        .unwrap()
+        .iter()
+        .flat_map(|bots| bots.iter())
+        .map(|(user_id, stats)| BotSnapshot {
+            user_id: *user_id,
+            mean_move_ms: stats.mean_ms,
+            moves: stats.moves,
+        })
+        .collect::<Vec<_>>();
+    slowest_bots.sort_by(|a, b| b.mean_move_ms.partial_cmp(&a.mean_move_ms).unwrap());
+    slowest_bots.truncate(SLOWEST_BOTS);
+
+    let (db_connections_in_use, db_pool_size) = db_usage.map_or((0, 0), |usage| usage());
+
+    Snapshot {
+        ts_ms: SystemTime::now()
+            .duration_since(UNIX_EPOCH)
+            .map_or(0, |d| d.as_millis() as u64),
+        window_secs: secs,
+        requests_per_sec: all.iter().sum::<u64>() as f64 / secs,
+        p99_ms: percentile_ms(&all, 0.99),
+        routes: route_snapshots,
+        active_games: manager.read().unwrap().active_count(),
+        db_connections_in_use,
+        db_pool_size,
+        lock_wait_p99_ms: percentile_ms(&diff(lock, old_lock), 0.99),
+        slowest_bots,
+    }
+}
+
+/// A fairing that records each request's route, status and latency into Metrics
+pub struct MetricsFairing(pub Arc<Metrics>);
+
+impl Fairing for MetricsFairing {
+    fn info(&self) -> Info {
+        Info {
+            name: "Metrics",
+            kind: Kind::Request | Kind::Response,
+        }
+    }
+
+    fn on_request(&self, request: &mut Request, _: &Data) {
+        request.local_cache(|| RequestStart(Instant::now()));
+    }
+
+    fn on_response(&self, request: &Request, response: &mut Response) {
+        let latency = request
+            .local_cache(|| RequestStart(Instant::now()))
+            .0
+            .elapsed();
+        let route = request.route().and_then(|r| r.name).unwrap_or("unmatched");
+        // the metrics stream is open for as long as the dashboard is
+        if route == "admin_metrics_stream" {
+            return;
+        }
+        let stats = self.0.route(route);
+        stats.latency.record(latency);
+        if response.status().code >= 500 {
+            stats.errors.fetch_add(1, Ordering::Relaxed);
+        }
+    }
+}
+
+/// Sends each snapshot as a server sent event
+pub struct SnapshotStream {
+    metrics: Arc<Metrics>,
+    seq: u64,
+    buf: Vec<u8>,
+    pos: usize,
+    _slot: StreamSlot,
+}
+
+impl Read for SnapshotStream {
+    fn read(&mut self, out: &mut [u8]) -> io::Result<usize> {
+        if self.pos == self.buf.len() {
+            let (seq, json) = self.metrics.next_after(self.seq);
+            self.seq = seq;
+            self.buf = broadcast::frame(Format::Sse, json.as_bytes());
+            self.pos = 0;
+        }
+        let n = out.len().min(self.buf.len() - self.pos);
+        out[..n].copy_from_slice(&self.buf[self.pos..self.pos + n]);
+        self.pos += n;
+        Ok(n)
+    }
+}
+
+pub type MetricsState<'a> = State<'a, Arc<Metrics>>;
+
+#[get("/admin/metrics")]
+pub fn admin_metrics(
+    metrics: MetricsState,
+    user: User,
+) -> Result<Content<String>, Json<ErrorResp>> {
+    if !user.is_admin {
+        Err(Json::from(Error::NotAdmin))
+    } else {
+        Ok(Content(ContentType::JSON, (*metrics.latest()).clone()))
+    }
+}
+
+/// stream a snapshot every second. Each open stream holds a worker thread, so this is only for
+/// the (few) admins watching the dashboard
+#[get("/admin/metrics/stream")]
+pub fn admin_metrics_stream(
+    metrics: MetricsState,
+    user: User,
+) -> Result<Content<Stream<SnapshotStream>>, StreamError> {
+    if !user.is_admin {
+        Err(StreamError::from(Error::NotAdmin))
+    } else {
+        let stream = SnapshotStream {
+            metrics: metrics.inner().clone(),
+            seq: 0,
+            buf: vec![],
+            pos: 0,
+            _slot: StreamSlot::acquire()?,
+        };
+        Ok(Content(
+            Format::Sse.content_type(),
+            Stream::chunked(stream, STREAM_FRAME as u64),
+        ))
+    }
+}
@@ -13,6 +13,7 @@ pub struct DbGame {
     pub players: String,
     pub active: i32,
     pub is_public: bool,
+    pub moves: Vec<u8>,
 }
 
 #[derive(Insertable, AsChangeset)]
@@ -25,6 +26,7 @@ pub struct InsertDbGame<'a> {
     pub players: String,
     pub active: i32,
     pub is_public: bool,
+    pub moves: &'a [u8],
 }
 
 #[derive(Insertable)]
@@ -0,0 +1,399 @@
+//! Othello (reversi) on bitboards.
+//!
+//! Each player's discs are a u64 with bit x * 8 + y set for a disc at (x, y). Legal moves and
+//! flips are generated for all 8 directions at once with Kogge-Stone fills: a fill spreads a set
+//! of discs along runs of the opponent's discs in log2(8) = 3 shift steps, with no loops over
+//! squares. Players with no legal move pass automatically, so every move is a disc placement.
+
+use crate::game::{BinaryMove, Game, GameOutcome, GamePlayer};
+use serde::{Deserialize, Serialize};
+
+const BOARD_SIZE: usize = 8;
+/// most moves a game can have, since each move fills an empty square
+const MAX_MOVES: usize = BOARD_SIZE * BOARD_SIZE;
+
+/// squares with y == 0 and y == 7, which a shift along y wraps onto
+const Y_FIRST: u64 = 0x0101_0101_0101_0101;
+const Y_LAST: u64 = 0x8080_8080_8080_8080;
+
+/// shift amount and the mask of squares a shift can reach without wrapping, for each direction
+const SHIFTS: [(i32, u64); 8] = [
+    (1, !Y_FIRST),  // y + 1
+    (-1, !Y_LAST),  // y - 1
+    (8, !0),        // x + 1
+    (-8, !0),       // x - 1
+    (9, !Y_FIRST),  // x + 1, y + 1
+    (7, !Y_LAST),   // x + 1, y - 1
+    (-7, !Y_FIRST), // x - 1, y + 1
+    (-9, !Y_LAST),  // x - 1, y - 1
+];
+
+#[inline(always)]
+fn shift(bits: u64, amount: i32) -> u64 {
+    if amount > 0 {
+        bits << amount
+    } else {
+        bits >> -amount
+    }
+}
+
+/// gen, extended along runs of pro in direction (amount, mask)
+#[inline(always)]
+fn fill(mut gen: u64, pro: u64, amount: i32, mask: u64) -> u64 {
+    let mut pro = pro & mask;
+    gen |= pro & shift(gen, amount);
+    pro &= shift(pro, amount);
+    gen |= pro & shift(gen, amount * 2);
+    pro &= shift(pro, amount * 2);
+    gen |= pro & shift(gen, amount * 4);
+    gen
+}
+
+/// empty squares own can move to: squares at the end of a run of opp's discs that starts at one
+/// of own's discs
+fn moves_for(own: u64, opp: u64) -> u64 {
+    let empty = !(own | opp);
+    let mut moves = 0;
+    for (amount, mask) in SHIFTS.iter() {
+        let run = fill(own, opp, *amount, *mask) & opp;
+        moves |= shift(run, *amount) & mask & empty;
+    }
+    moves
+}
+
+/// discs of opp that own flips by moving to square
+fn flips_for(own: u64, opp: u64, square: u64) -> u64 {
+    let mut flips = 0;
+    for (amount, mask) in SHIFTS.iter() {
+        let run = fill(square, opp, *amount, *mask) & opp;
+        if shift(run, *amount) & mask & own != 0 {
+            flips |= run;
+        }
+    }
+    flips
+}
+
+/// generate zobrist keys for each (square, player) with splitmix64
+const fn zobrist_keys() -> [[u64; 2]; BOARD_SIZE * BOARD_SIZE] {
+    let mut keys = [[0; 2]; BOARD_SIZE * BOARD_SIZE];
+    let mut seed: u64 = 0x3c6e_f372_fe94_f82b;
+    let mut square = 0;
+    while square < BOARD_SIZE * BOARD_SIZE {
+        let mut p = 0;
+        while p < 2 {
+            seed = seed.wrapping_add(0x9e37_79b9_7f4a_7c15);
+            let mut z = seed;
+            z = (z ^ (z >> 30)).wrapping_mul(0xbf58_476d_1ce4_e5b9);
+            z = (z ^ (z >> 27)).wrapping_mul(0x94d0_49bb_1331_11eb);
+            keys[square][p] = z ^ (z >> 31);
+            p += 1;
+        }
+        square += 1;
+    }
+    keys
+}
+
+static ZOBRIST: [[u64; 2]; BOARD_SIZE * BOARD_SIZE] = zobrist_keys();
+/// hashed in when player 1 is on move
+const ZOBRIST_TURN: u64 = 0xbb67_ae85_84ca_a73b;
+
+/// The board as sent to clients. board is indexed [x][y], with -1 for empty squares and the
+/// player's number for discs
+#[derive(Clone, Debug, Serialize, Deserialize)]
+pub struct OthelloState {
+    board: [[i8; BOARD_SIZE]; BOARD_SIZE],
+    turn: i8,
+}
+
+#[derive(Clone, Debug)]
+pub struct Othello {
+    /// each player's discs
+    discs: [u64; 2],
+    /// player on move, or -1 once neither player can move
+    turn: i8,
+    // the following are kept up to date by make_move + undo_move
+    hash: u64,
+    /// discs flipped by each move made since the game was created or loaded, for undo_move. It's
+    /// inline, so cloning a game doesn't allocate
+    flipped: [u64; MAX_MOVES],
+    /// number of moves in flipped
+    made: usize,
+}
+
+#[derive(FromForm, Clone, Copy, PartialEq, Debug, Serialize, Deserialize)]
+pub struct Move {
+    x: i32,
+    y: i32,
+}
+
+impl Move {
+    fn square(&self) -> Option<u32> {
+        let size = BOARD_SIZE as i32;
+        if self.x >= 0 && self.x < size && self.y >= 0 && self.y < size {
+            Some((self.x * size + self.y) as u32)
+        } else {
+            None
+        }
+    }
+}
+
+impl BinaryMove for Move {
+    const ENCODED_LEN: usize = 1;
+
+    fn encode(&self, out: &mut [u8]) {
+        out[0] = (self.x as usize * BOARD_SIZE + self.y as usize) as u8;
+    }
+
+    fn decode(bytes: &[u8]) -> Option<Move> {
+        let square = bytes[0] as usize;
+        if square < BOARD_SIZE * BOARD_SIZE {
+            Some(Move {
+                x: (square / BOARD_SIZE) as i32,
+                y: (square % BOARD_SIZE) as i32,
+            })
+        } else {
+            None
+        }
+    }
+}
+
+impl Othello {
+    /// bitboard of the squares player can move to
+    fn move_mask(&self, player: usize) -> u64 {
+        moves_for(self.discs[player], self.discs[1 - player])
+    }
+
+    /// flip the discs in flips between the players in the hash
+    fn toggle_flips(&mut self, mut flips: u64) {
+        while flips != 0 {
+            let square = flips.trailing_zeros() as usize;
+            self.hash ^= ZOBRIST[square][0] ^ ZOBRIST[square][1];
+            flips &= flips - 1;
+        }
+    }
+
+    fn set_turn(&mut self, turn: i8) {
+        if (self.turn == 1) != (turn == 1) {
+            self.hash ^= ZOBRIST_TURN;
+        }
+        self.turn = turn;
+    }
+
+    /// recompute the hash from discs and turn
+    fn recompute(&mut self) {
+        self.hash = if self.turn == 1 { ZOBRIST_TURN } else { 0 };
+        for player in 0..2 {
+            let mut discs = self.discs[player];
+            while discs != 0 {
+                self.hash ^= ZOBRIST[discs.trailing_zeros() as usize][player];
+                discs &= discs - 1;
+            }
+        }
+    }
+
+    /// disc difference, from player 0's side
+    fn disc_difference(&self) -> i32 {
+        self.discs[0].count_ones() as i32 - self.discs[1].count_ones() as i32
+    }
+}
+
+impl Game for Othello {
+    type Move = Move;
+    type Score = i32;
+    type State = OthelloState;
+
+    fn check_num_players(players: usize) -> bool {
+        players == 2
+    }
+
+    fn new_with_players(players: usize) -> Self {
+        assert_eq!(players, 2);
+        let square = |x: usize, y: usize| 1u64 << (x * BOARD_SIZE + y);
+        let mut game = Othello {
+            discs: [square(3, 4) | square(4, 3), square(3, 3) | square(4, 4)],
+            turn: 0,
+            hash: 0,
+            flipped: [0; MAX_MOVES],
+            made: 0,
+        };
+        game.recompute();
+        game
+    }
+
+    fn from_state(state: Self::State, _players: usize) -> Self {
+        let mut discs = [0; 2];
+        for x in 0..BOARD_SIZE {
+            for y in 0..BOARD_SIZE {
+                let cell = state.board[x][y];
+                if cell == 0 || cell == 1 {
+                    discs[cell as usize] |= 1 << (x * BOARD_SIZE + y);
+                }
+            }
+        }
+        let mut game = Othello {
+            discs,
+            turn: state.turn,
+            hash: 0,
+            flipped: [0; MAX_MOVES],
+            made: 0,
+        };
+        game.recompute();
+        game
+    }
+
+    fn state(&self, for_player: GamePlayer) -> Self::State {
+        // show the board from for_player's side, with their discs as 0
+        let (own, other) = if for_player == 1 { (1, 0) } else { (0, 1) };
+        let mut board = [[-1; BOARD_SIZE]; BOARD_SIZE];
+        for x in 0..BOARD_SIZE {
+            for y in 0..BOARD_SIZE {
+                let bit = 1 << (x * BOARD_SIZE + y);
+                if self.discs[own] & bit != 0 {
+                    board[x][y] = 0;
+                } else if self.discs[other] & bit != 0 {
+                    board[x][y] = 1;
+                }
+            }
+        }
+        OthelloState {
+            board,
+            turn: self.turn,
+        }
+    }
+
+    fn finished(&self) -> bool {
+        self.turn == -1
+    }
+
+    fn waiting_on(&self, player: u32) -> bool {
+        player as i8 == self.turn
+    }
+
+    fn make_move(&mut self, player: u32, move_to_make: &Self::Move) -> bool {
+        if player as i8 != self.turn {
+            return false;
+        }
+        let square = match move_to_make.square() {
+            Some(square) => square,
+            None => return false,
+        };
+        let (p, o) = (player as usize, 1 - player as usize);
+        let bit = 1 << square;
+        if (self.discs[0] | self.discs[1]) & bit != 0 {
+            return false;
+        }
+        let flips = flips_for(self.discs[p], self.discs[o], bit);
+        if flips == 0 {
+            return false;
+        }
+
+        self.discs[p] |= bit | flips;
+        self.discs[o] &= !flips;
+        self.hash ^= ZOBRIST[square as usize][p];
+        self.toggle_flips(flips);
+        self.flipped[self.made] = flips;
+        self.made += 1;
+
+        // a player with no moves passes, and the game ends when neither can move
+        let next = if self.move_mask(o) != 0 {
+            o as i8
+        } else if self.move_mask(p) != 0 {
+            p as i8
+        } else {
+            -1
+        };
+        self.set_turn(next);
+        true
+    }
+
+    fn undo_move(&mut self, player: u32, move_made: &Self::Move) {
+        let (p, o) = (player as usize, 1 - player as usize);
+        let square = move_made.square().unwrap();
+        self.made -= 1;
+        let flips = self.flipped[self.made];
+        self.discs[p] &= !(1 << square | flips);
+        self.discs[o] |= flips;
+        self.hash ^= ZOBRIST[square as usize][p];
+        self.toggle_flips(flips);
+        self.set_turn(player as i8);
+    }
+
+    fn legal_moves(&self, player: u32, moves: &mut Vec<Self::Move>) {
+        moves.clear();
+        if player as i8 != self.turn {
+            return;
+        }
+        let mut mask = self.move_mask(player as usize);
+        while mask != 0 {
+            let square = mask.trailing_zeros() as usize;
+            moves.push(Move {
+                x: (square / BOARD_SIZE) as i32,
+                y: (square % BOARD_SIZE) as i32,
+            });
+            mask &= mask - 1;
+        }
+    }
+
+    fn hash(&self) -> u64 {
+        self.hash
+    }
+
+    fn scores(&self) -> Option<Vec<Self::Score>> {
+        if self.finished() {
+            let difference = self.disc_difference();
+            Some(vec![difference, -difference])
+        } else {
+            None
+        }
+    }
+
+    fn outcome(&self) -> GameOutcome {
+        if !self.finished() {
+            GameOutcome::None
+        } else if self.disc_difference() > 0 {
+            GameOutcome::Win(0)
+        } else if self.disc_difference() < 0 {
+            GameOutcome::Win(1)
+        } else {
+            GameOutcome::Tie
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// count the positions depth moves from game (passes aren't moves, the turn just moves on)
+    fn perft(game: &mut Othello, depth: usize) -> u64 {
+        if depth == 0 || game.finished() {
+            return 1;
+        }
+        let player = if game.waiting_on(0) { 0 } else { 1 };
+        let mut moves = Vec::new();
+        game.legal_moves(player, &mut moves);
+        let hash = game.hash();
+        let mut positions = 0;
+        for m in &moves {
+            assert!(game.make_move(player, m));
+            positions += perft(game, depth - 1);
+            game.undo_move(player, m);
+            assert_eq!(game.hash(), hash);
+        }
+        positions
+    }
+
+    #[test]
+    fn start_position_perft() {
+        let mut game = Othello::new_with_players(2);
+        let expected = [4, 12, 56, 244, 1396, 8200, 55092, 390216];
+        for (depth, positions) in expected.iter().enumerate() {
+            assert_eq!(
+                perft(&mut game, depth + 1),
+                *positions,
+                "depth {}",
+                depth + 1
+            );
+        }
+    }
+}
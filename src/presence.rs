@@ -0,0 +1,201 @@
+//! Which users are online, from when each user last made an authenticated request.
+//!
+//! The user guards record every authenticated request here, so this has to be cheap: it's a
+//! fixed size open addressing table of atomics, with no locks and no allocation. Slots are never
+//! emptied, but a slot whose user hasn't been seen for STALE_MS can be taken by another user.
+//! Each server only knows about the requests it served.
+
+use crate::models::User;
+use crate::shared::{Error, ErrorResp};
+use crate::users::PlayerId;
+use rocket_contrib::json::Json;
+use serde::Serialize;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::time::{SystemTime, UNIX_EPOCH};
+
+/// number of slots (users seen in the last STALE_MS)
+const CAPACITY: usize = 1 << 16;
+/// slots looked at before giving up on a user
+const MAX_PROBE: usize = 64;
+/// users seen this recently are online
+pub const ONLINE_MS: u64 = 60_000;
+/// slots of users not seen this long can be reused
+const STALE_MS: u64 = 60 * 60_000;
+/// last seen times are only updated this often, so busy users don't keep writing their slot
+const TOUCH_MS: u64 = 1000;
+
+struct Slot {
+    /// user id + 1, or 0 if the slot has never been used
+    key: AtomicU64,
+    /// ms since the unix epoch
+    last_seen: AtomicU64,
+}
+
+impl Slot {
+    /// take the slot for key, if it still belongs to current. True if the slot is key's
+    fn claim(&self, current: u64, key: u64) -> bool {
+        match self
+            .key
+            .compare_exchange(current, key, Ordering::AcqRel, Ordering::Acquire)
+        {
+            Ok(_) => true,
+            Err(winner) => winner == key,
+        }
+    }
+
+    fn seen(&self, now: u64) {
+        if self.last_seen.load(Ordering::Relaxed) + TOUCH_MS <= now {
+            self.last_seen.store(now, Ordering::Relaxed);
+        }
+    }
+}
+
+/// Last request time of each recently seen user
+pub struct Presence {
+    slots: [Slot; CAPACITY],
+}
+
+pub static PRESENCE: Presence = Presence::new();
+
+pub fn now_ms() -> u64 {
+    SystemTime::now()
+        .duration_since(UNIX_EPOCH)
+        .map_or(0, |d| d.as_millis() as u64)
+}
+
+fn key(user: PlayerId) -> u64 {
+    user.id() as u32 as u64 + 1
+}
+
+/// slots to look in for key, in order
+fn probe(key: u64) -> impl Iterator<Item = usize> {
+    let start = (key.wrapping_mul(0x9e37_79b9_7f4a_7c15) >> 48) as usize;
+    (0..MAX_PROBE).map(move |i| (start + i) % CAPACITY)
+}
+
+impl Presence {
+    const fn new() -> Presence {
+        const EMPTY: Slot = Slot {
+            key: AtomicU64::new(0),
+            last_seen: AtomicU64::new(0),
+        };
+        Presence {
+            slots: [EMPTY; CAPACITY],
+        }
+    }
+
+    /// record that user made a request now
+    pub fn touch(&self, user: PlayerId) {
+        let key = key(user);
+        let now = now_ms();
+        // the user's slot is before the first empty slot. If they don't have one, take the empty
+        // slot, or failing that, a stale one
+        let mut stale = None;
+        for i in probe(key) {
+            let slot = &self.slots[i];
+            let current = slot.key.load(Ordering::Acquire);
+            if current == key || current == 0 && slot.claim(0, key) {
+                slot.seen(now);
+                return;
+            } else if stale.is_none() && slot.last_seen.load(Ordering::Relaxed) + STALE_MS < now {
+                stale = Some((slot, current));
+            }
+        }
+        match stale {
+            Some((slot, current)) if slot.claim(current, key) => slot.seen(now),
+            // the table is full around this user, who will show as offline
+            _ => (),
+        }
+    }
+
+    /// when user last made a request (ms since the unix epoch), if they have been seen recently
+    pub fn last_seen(&self, user: PlayerId) -> Option<u64> {
+        let key = key(user);
+        for i in probe(key) {
+            let slot = &self.slots[i];
+            match slot.key.load(Ordering::Acquire) {
+                0 => return None,
+                k if k == key => return Some(slot.last_seen.load(Ordering::Relaxed)),
+                _ => (),
+            }
+        }
+        None
+    }
+
+    pub fn is_online(&self, user: PlayerId) -> bool {
+        self.last_seen(user)
+            .map_or(false, |seen| seen + ONLINE_MS > now_ms())
+    }
+
+    /// every online user, and when they were last seen
+    pub fn online(&self) -> Vec<(PlayerId, u64)> {
+        let now = now_ms();
+        self.slots
+            .iter()
+            .filter_map(|slot| {
+                let key = slot.key.load(Ordering::Acquire);
+                let seen = slot.last_seen.load(Ordering::Relaxed);
+                if key != 0 && seen + ONLINE_MS > now {
+                    Some((PlayerId::new((key - 1) as u32 as i32), seen))
+                } else {
+                    None
+                }
+            })
+            .collect()
+    }
+}
+
+#[derive(Serialize)]
+pub struct UserPresence {
+    user_id: i32,
+    online: bool,
+    /// seconds since the user's last request, if they have been seen recently
+    last_seen_secs_ago: Option<u64>,
+}
+
+#[derive(Serialize)]
+pub struct PresenceResp {
+    online_window_secs: u64,
+    users: Vec<UserPresence>,
+}
+
+/// presence of the given users (a comma separated list of ids), or of every online user (admins
+/// only)
+#[get("/presence?<user_ids>")]
+pub fn presence(
+    user_ids: Option<String>,
+    user: User,
+) -> Result<Json<PresenceResp>, Json<ErrorResp>> {
+    if user_ids.is_none() && !user.is_admin {
+        return Err(Json::from(Error::NotAdmin));
+    }
+    let now = now_ms();
+    let seen = match user_ids {
+        Some(ids) => ids
+            .split(',')
+            .map(|id| {
+                let user =
+                    PlayerId::new(id.trim().parse::<i32>().map_err(|_| Error::InvalidUserId)?);
+                Ok((user, PRESENCE.last_seen(user)))
+            })
+            .collect::<Result<Vec<_>, Error>>()?,
+        None => PRESENCE
+            .online()
+            .into_iter()
+            .map(|(user, seen)| (user, Some(seen)))
+            .collect(),
+    };
+
+    let users = seen
+        .into_iter()
+        .map(|(user, seen)| UserPresence {
+            user_id: user.id(),
+            online: seen.map_or(false, |seen| seen + ONLINE_MS > now),
+            last_seen_secs_ago: seen.map(|seen| now.saturating_sub(seen) / 1000),
+        })
+        .collect();
+    Ok(Json(PresenceResp {
+        online_window_secs: ONLINE_MS / 1000,
+        users,
+    }))
+}
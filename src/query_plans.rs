@@ -0,0 +1,267 @@
+use crate::fixtures::{PAGE_PREFIX, USERNAME_PREFIX};
+use crate::shared::Error;
+use diesel::connection::SimpleConnection;
+use diesel::dsl::max;
+use diesel::pg::PgConnection;
+use diesel::prelude::*;
+use diesel::sql_types::Text;
+use serde_json::Value;
+
+/// tables that grow with usage. A sequential scan on one of these is a full scan in production
+const LARGE_TABLES: &[&str] = &["db_games", "users", "tournaments", "pages"];
+/// how far (as a factor) the planner's row estimate may be from the actual row count
+const MAX_ESTIMATE_ERROR: f64 = 10.0;
+/// each query is run this many times, and the fastest run is checked against the budget
+const RUNS: usize = 3;
+
+/// A query the app issues, and what its plan is expected to look like
+pub struct QueryCheck {
+    /// where the app issues the query
+    pub name: &'static str,
+    pub sql: String,
+    /// whether the query must avoid sequential scans of large tables
+    pub require_index: bool,
+    pub budget_ms: f64,
+}
+
+/// The outcome of checking a query's plan
+pub struct PlanReport {
+    pub name: &'static str,
+    pub execution_ms: f64,
+    pub budget_ms: f64,
+    /// why the plan failed its check. Empty if it passed
+    pub problems: Vec<String>,
+    pub plan: Value,
+}
+
+#[derive(QueryableByName)]
+struct Explained {
+    #[sql_type = "Text"]
+    plan: String,
+}
+
+/// quote a string for use as a literal in the checked queries
+fn quote(s: &str) -> String {
+    format!("'{}'", s.replace('\'', "''"))
+}
+
+/// the queries the app issues, filled in with keys of seeded rows
+pub fn app_queries(conn: &PgConnection) -> Result<Vec<QueryCheck>, Error> {
+    use crate::schema::{db_games, tournaments, users};
+
+    let game = db_games::table
+        .select(max(db_games::id))
+        .first::<Option<i32>>(conn)?
+        .unwrap_or(1);
+    let tournament = tournaments::table
+        .select(max(tournaments::id))
+        .first::<Option<i32>>(conn)?
+        .unwrap_or(1);
+    let username = format!("{}1", USERNAME_PREFIX);
+    let (user, api_key_hash) = users::table
+        .filter(users::username.eq(&username))
+        .select((users::id, users::api_key_hash))
+        .first::<(i32, Option<String>)>(conn)?;
+    let api_key_hash = quote(&api_key_hash.unwrap_or_default());
+    let username = quote(&username);
+    let url = quote(&format!("{}page/1", PAGE_PREFIX));
+
+    let point = |name, sql: String| QueryCheck {
+        name,
+        sql,
+        require_index: true,
+        budget_ms: 5.0,
+    };
+
+    Ok(vec![
+        point(
+            "game_manage::load_game_from_db",
+            format!(
+                "SELECT id, title, state, owner_id, players, active, is_public, moves FROM db_games WHERE id = {} LIMIT 1",
+                game
+            ),
+        ),
+        point(
+            "game_manage::save_game_to_db",
+            format!(
+                "UPDATE db_games SET title = title, state = state, players = players, active = active, moves = moves WHERE id = {}",
+                game
+            ),
+        ),
+        point(
+            "game_manage::new_game",
+            format!(
+                "INSERT INTO db_games (title, state, owner_id, players, active, is_public) \
+                 VALUES ('plan check', NULL, {}, '[]', 1, true) RETURNING id",
+                user
+            ),
+        ),
+        QueryCheck {
+            name: "game_manage::list_games",
+            sql: "SELECT id FROM db_games WHERE is_public = true ORDER BY id DESC".to_string(),
+            // lists every public game, so it reads most of the table no matter the plan
+            require_index: false,
+            budget_ms: 1000.0,
+        },
+        point(
+            "game_manage::list_games (paged)",
+            format!(
+                "SELECT id FROM db_games WHERE is_public = true AND id < {} ORDER BY id DESC LIMIT 10",
+                game
+            ),
+        ),
+        point(
+            "game_manage::get_tournament",
+            format!(
+                "SELECT id, name, players, games, owner_id FROM tournaments WHERE id = {} LIMIT 1",
+                tournament
+            ),
+        ),
+        point(
+            "game_manage::save_tournament",
+            format!(
+                "UPDATE tournaments SET name = name, players = players, games = games WHERE id = {}",
+                tournament
+            ),
+        ),
+        point(
+            "users::load_user",
+            format!(
+                "SELECT id, username, display_name, password_hash, api_key_hash, is_admin FROM users WHERE id = {} LIMIT 1",
+                user
+            ),
+        ),
+        point(
+            "users::find_user",
+            format!(
+                "SELECT id, username, display_name, password_hash, api_key_hash, is_admin FROM users WHERE username = {}",
+                username
+            ),
+        ),
+        point(
+            "users::find_user_by_api_key",
+            format!(
+                "SELECT id, username, display_name, password_hash, api_key_hash, is_admin FROM users WHERE api_key_hash = {}",
+                api_key_hash
+            ),
+        ),
+        point(
+            "users::generate_api_key",
+            format!(
+                "UPDATE users SET api_key_hash = {} WHERE id = {}",
+                api_key_hash, user
+            ),
+        ),
+        point(
+            "pages::page_get",
+            format!(
+                "SELECT id, url, content FROM pages WHERE url = {} LIMIT 1",
+                url
+            ),
+        ),
+        QueryCheck {
+            name: "jobs::reconcile_active_flags",
+            sql: "SELECT id, state, players FROM db_games WHERE active = 1 AND state IS NOT NULL"
+                .to_string(),
+            require_index: true,
+            budget_ms: 100.0,
+        },
+    ])
+}
+
+/// check a plan node and its children, adding any problems found
+fn check_node(node: &Value, check: &QueryCheck, under_limit: bool, problems: &mut Vec<String>) {
+    let node_type = node["Node Type"].as_str().unwrap_or("");
+    let relation = node["Relation Name"].as_str().unwrap_or("");
+
+    if check.require_index && node_type == "Seq Scan" && LARGE_TABLES.contains(&relation) {
+        problems.push(format!("sequential scan on {}", relation));
+    }
+
+    // nodes under a limit stop early, so their actual rows don't reflect the estimate
+    if !under_limit {
+        let estimate = node["Plan Rows"].as_f64().unwrap_or(0.0).max(1.0);
+        let actual = node["Actual Rows"].as_f64().unwrap_or(0.0).max(1.0);
+        if estimate / actual > MAX_ESTIMATE_ERROR || actual / estimate > MAX_ESTIMATE_ERROR {
+            problems.push(format!(
+                "{} estimated {} rows, got {}",
+                node_type, estimate, actual
+            ));
+        }
+    }
+
+    if let Some(children) = node["Plans"].as_array() {
+        for child in children {
+            check_node(child, check, under_limit || node_type == "Limit", problems);
+        }
+    }
+}
+
+/// EXPLAIN ANALYZE a query (rolling back anything it changes) and return its json plan
+fn explain(conn: &PgConnection, sql: &str) -> Result<Value, Error> {
+    let mut plan = None;
+    let res = conn.transaction::<(), diesel::result::Error, _>(|| {
+        plan = Some(
+            diesel::sql_query("SELECT pg_temp.explain_json($1) AS plan")
+                .bind::<Text, _>(sql)
+                .get_result::<Explained>(conn)?
+                .plan,
+        );
+        Err(diesel::result::Error::RollbackTransaction)
+    });
+    match (res, plan) {
+        (Err(diesel::result::Error::RollbackTransaction), Some(plan)) => {
+            let plan = serde_json::from_str::<Value>(&plan)?;
+            Ok(plan[0].clone())
+        }
+        (Err(e), _) => Err(Error::DBError(e)),
+        (Ok(()), _) => Err(Error::DBError(diesel::result::Error::NotFound)),
+    }
+}
+
+/// run each query and check its plan and timing
+pub fn check(conn: &PgConnection, checks: &[QueryCheck]) -> Result<Vec<PlanReport>, Error> {
+    // EXPLAIN's output column is named "QUERY PLAN", so wrap it in a function with a usable name
+    conn.batch_execute(
+        "CREATE OR REPLACE FUNCTION pg_temp.explain_json(query text) RETURNS text AS $$ \
+         DECLARE plan text := ''; line text; \
+         BEGIN \
+           FOR line IN EXECUTE 'EXPLAIN (ANALYZE, FORMAT JSON) ' || query LOOP \
+             plan := plan || line; \
+           END LOOP; \
+           RETURN plan; \
+         END $$ LANGUAGE plpgsql",
+    )?;
+
+    let mut reports = Vec::with_capacity(checks.len());
+    for check in checks {
+        let mut best: Option<(f64, Value)> = None;
+        for _ in 0..RUNS {
+            let plan = explain(conn, &check.sql)?;
+            let ms = plan["Execution Time"].as_f64().unwrap_or(0.0);
+            if best.as_ref().map_or(true, |(b, _)| ms < *b) {
+                best = Some((ms, plan));
+            }
+        }
+        let (execution_ms, plan) = best.unwrap();
+
+        let mut problems = Vec::new();
+        check_node(&plan["Plan"], check, false, &mut problems);
+        if execution_ms > check.budget_ms {
+            problems.push(format!(
+                "took {:.2}ms, budget is {:.2}ms",
+                execution_ms, check.budget_ms
+            ));
+        }
+
+        reports.push(PlanReport {
+            name: check.name,
+            execution_ms,
+            budget_ms: check.budget_ms,
+            problems,
+            plan,
+        });
+    }
+
+    Ok(reports)
+}
@@ -0,0 +1,92 @@
+use std::cell::UnsafeCell;
+use std::sync::atomic::{AtomicUsize, Ordering};
+
+struct Slot<T> {
+    /// equal to the slot's position when it is free to write, and position + 1 when it holds a value to read
+    seq: AtomicUsize,
+    value: UnsafeCell<T>,
+}
+
+/// A bounded, lock-free queue for many producers and a single consumer.
+/// Pushing never blocks: if the queue is full, the push fails.
+pub struct Ring<T: Copy> {
+    slots: Box<[Slot<T>]>,
+    mask: usize,
+    /// next position to write
+    head: AtomicUsize,
+    /// next position to read
+    tail: AtomicUsize,
+}
+
+unsafe impl<T: Copy + Send> Sync for Ring<T> {}
+unsafe impl<T: Copy + Send> Send for Ring<T> {}
+
+impl<T: Copy + Default> Ring<T> {
+    /// create a ring with room for capacity values (rounded up to a power of two)
+    pub fn new(capacity: usize) -> Ring<T> {
+        let capacity = capacity.next_power_of_two();
+        Ring {
+            slots: (0..capacity)
+                .map(|i| Slot {
+                    seq: AtomicUsize::new(i),
+                    value: UnsafeCell::new(T::default()),
+                })
+                .collect(),
+            mask: capacity - 1,
+            head: AtomicUsize::new(0),
+            tail: AtomicUsize::new(0),
+        }
+    }
+}
+
+impl<T: Copy> Ring<T> {
+    /// add a value to the queue. Returns false if the queue is full
+    pub fn push(&self, value: T) -> bool {
+        let mut pos = self.head.load(Ordering::Relaxed);
+        loop {
+            let slot = &self.slots[pos & self.mask];
+            let seq = slot.seq.load(Ordering::Acquire);
+            let diff = seq as isize - pos as isize;
+            if diff == 0 {
+                // slot is free, try to claim it
+                match self.head.compare_exchange_weak(
+                    pos,
+                    pos.wrapping_add(1),
+                    Ordering::Relaxed,
+                    Ordering::Relaxed,
+                ) {
+                    Ok(_) => {
+                        unsafe {
+                            *slot.value.get() = value;
+                        }
+                        slot.seq.store(pos.wrapping_add(1), Ordering::Release);
+                        return true;
+                    }
+                    Err(current) => pos = current,
+                }
+            } else if diff < 0 {
+                // slot still holds a value from one lap ago, so the queue is full
+                return false;
+            } else {
+                // another producer claimed the slot
+                pos = self.head.load(Ordering::Relaxed);
+            }
+        }
+    }
+
+    /// remove a value from the queue, if there is one.
+    /// Must only be called from a single consumer thread at a time
+    pub fn pop(&self) -> Option<T> {
+        let pos = self.tail.load(Ordering::Relaxed);
+        let slot = &self.slots[pos & self.mask];
+        if slot.seq.load(Ordering::Acquire) == pos.wrapping_add(1) {
+            let value = unsafe { *slot.value.get() };
+            slot.seq
+                .store(pos.wrapping_add(self.mask + 1), Ordering::Release);
+            self.tail.store(pos.wrapping_add(1), Ordering::Relaxed);
+            Some(value)
+        } else {
+            None
+        }
+    }
+}
@@ -3,7 +3,7 @@ use diesel::prelude::*;
 use dotenv::dotenv;
 use std::env;
 
-fn open_db() -> PgConnection {
+pub fn open_db() -> PgConnection {
     dotenv().ok();
 
     let database_url = env::var("DATABASE_URL").expect("DATABASE_URL must be set");
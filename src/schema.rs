@@ -7,6 +7,14 @@ table! {
         players -> Varchar,
         active -> Int4,
         is_public -> Bool,
+        moves -> Bytea,
+    }
+}
+
+table! {
+    job_leases (name) {
+        name -> Text,
+        token -> Int8,
     }
 }
 
@@ -39,4 +47,4 @@ table! {
     }
 }
 
-allow_tables_to_appear_in_same_query!(db_games, pages, tournaments, users,);
+allow_tables_to_appear_in_same_query!(db_games, job_leases, pages, tournaments, users,);
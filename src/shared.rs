@@ -1,9 +1,19 @@
 use rocket_contrib::json::Json;
-use serde::Serialize;
+use serde::{Deserialize, Serialize};
 
 #[database("db")]
 pub struct DBConn(diesel::PgConnection);
 
+/// a function returning the number of connections in use and the size of the DBConn pool.
+/// None if the pool's fairing hasn't been attached
+pub fn db_pool_usage(rocket: &rocket::Rocket) -> Option<Box<dyn Fn() -> (u32, u32) + Send>> {
+    let pool = rocket.state::<DBConnPool>()?.0.clone();
+    Some(Box::new(move || {
+        let state = pool.state();
+        (state.connections - state.idle_connections, pool.max_size())
+    }))
+}
+
 #[derive(Debug)]
 pub enum Error {
     InvalidGameId,
@@ -27,6 +37,17 @@ pub enum Error {
     WrongTurn,
     InvalidMove,
     NotAdmin,
+    InvalidSimulation,
+    PremovesTooLarge,
+    ServerDraining,
+    LeaseLost,
+    MalformedCsv,
+    UnknownFormat,
+    UnknownField,
+    Overloaded,
+    InvalidUserId,
+    JournalFailed,
+    StalePremoves,
 }
 
 impl From<serde_json::Error> for Error {
@@ -78,6 +99,19 @@ impl From<Error> for ErrorResp {
                 Error::WrongTurn => "player played out of turn".to_string(),
                 Error::InvalidMove => "invalid move".to_string(),
                 Error::NotAdmin => "player does not have admin authorization".to_string(),
+                Error::InvalidSimulation => "invalid tournament simulation parameters".to_string(),
+                Error::PremovesTooLarge => "too many premoves".to_string(),
+                Error::ServerDraining => "server is restarting, retry the request".to_string(),
+                Error::LeaseLost => "job lease was taken over by another node".to_string(),
+                Error::MalformedCsv => "malformed csv".to_string(),
+                Error::UnknownFormat => "unknown format".to_string(),
+                Error::UnknownField => "unknown field".to_string(),
+                Error::Overloaded => "server is overloaded, retry the request later".to_string(),
+                Error::InvalidUserId => "invalid user id".to_string(),
+                Error::JournalFailed => "couldn't write the move journal".to_string(),
+                Error::StalePremoves => {
+                    "the game has moved on since the premoves were made".to_string()
+                }
             },
             success: false,
         }
@@ -90,7 +124,7 @@ impl From<Error> for rocket_contrib::json::Json<ErrorResp> {
     }
 }
 
-#[derive(Serialize, Debug)]
+#[derive(Serialize, Deserialize, Debug)]
 pub struct IdResp {
     pub id: String,
 }
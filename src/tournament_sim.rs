@@ -0,0 +1,485 @@
+use crate::models::User;
+use crate::shared::{Error, ErrorResp};
+use rocket::request::Form;
+use rocket_contrib::json::Json;
+use serde::Serialize;
+use std::cmp::Reverse;
+use std::collections::{BinaryHeap, VecDeque};
+use std::time::Instant;
+
+const MAX_SIM_PLAYERS: usize = 1024;
+const MAX_SIM_SCENARIOS: u32 = 10000;
+/// upper bound on simulated plies per request (scenarios * games * moves), to keep a request bounded
+const MAX_SIM_PLIES: u64 = 200_000_000;
+/// upper bound on games started or parked per request (scenarios * games * players). A game is
+/// parked again at most once per player freeing up, so this bounds the dispatch work
+const MAX_SIM_DISPATCH: u64 = 200_000_000;
+/// bounds on the latency parameters, so a ply's time and request count stay finite
+const MAX_SIM_LATENCY_MS: f64 = 3_600_000.0;
+const MAX_SIM_SIGMA: f64 = 3.0;
+const MIN_SIM_POLL_MS: f64 = 1.0;
+const MAX_SIM_POLL_MS: f64 = 60_000.0;
+/// upper bound on a scenario's simulated time. Load is kept per simulated second, so this bounds
+/// its memory too
+const MAX_SIM_US: u64 = 30 * 24 * 3600 * 1_000_000;
+
+/// Structure of a tournament schedule
+#[derive(Clone, Copy, PartialEq, Eq, Debug)]
+pub enum Format {
+    /// every player plays every other player once (the schedule start_tournament generates)
+    RoundRobin,
+    /// single elimination, pairing winners of the previous round
+    Knockout,
+}
+
+/// Log-normal distribution of a bot's time to choose a move
+#[derive(Clone, Copy, Debug)]
+pub struct LatencyDist {
+    pub median_ms: f64,
+    pub sigma: f64,
+}
+
+/// Inputs to a tournament simulation
+#[derive(Clone, Debug)]
+pub struct SimConfig {
+    pub players: usize,
+    pub format: Format,
+    /// max number of games running at once
+    pub concurrency: usize,
+    /// max number of games a single player is in at once
+    pub per_player: usize,
+    /// move latency for each player. If shorter than players, the last entry is reused
+    pub latencies: Vec<LatencyDist>,
+    /// interval bots poll move_needed at
+    pub poll_ms: f64,
+    /// range of plies a game lasts (inclusive)
+    pub min_moves: u32,
+    pub max_moves: u32,
+    pub scenarios: u32,
+    pub seed: u64,
+}
+
+/// Aggregate results of simulating a tournament over several scenarios
+#[derive(Serialize, Debug)]
+pub struct SimReport {
+    pub scenarios: u32,
+    pub games: u32,
+    pub mean_duration_secs: f64,
+    pub p50_duration_secs: f64,
+    pub p95_duration_secs: f64,
+    pub max_duration_secs: f64,
+    pub mean_requests: f64,
+    pub mean_requests_per_sec: f64,
+    pub peak_requests_per_sec: f64,
+    pub sim_elapsed_ms: f64,
+}
+
+/// xorshift64* generator -- the simulation needs speed and reproducibility, not quality
+pub struct Rng(u64);
+
+impl Rng {
+    pub fn new(seed: u64) -> Rng {
+        Rng(seed ^ 0x9e37_79b9_7f4a_7c15 | 1)
+    }
+
+    pub fn next_u64(&mut self) -> u64 {
+        self.0 ^= self.0 >> 12;
+        self.0 ^= self.0 << 25;
+        self.0 ^= self.0 >> 27;
+        self.0.wrapping_mul(0x2545_f491_4f6c_dd1d)
+    }
+
+    /// uniform in [0, 1)
+    fn unit(&mut self) -> f64 {
+        (self.next_u64() >> 11) as f64 / (1u64 << 53) as f64
+    }
+
+    /// uniform in [lo, hi]
+    pub fn range(&mut self, lo: u32, hi: u32) -> u32 {
+        lo + (self.next_u64() % (hi - lo + 1) as u64) as u32
+    }
+
+    fn normal(&mut self) -> f64 {
+        let u1 = 1.0 - self.unit();
+        let u2 = self.unit();
+        (-2.0 * u1.ln()).sqrt() * (2.0 * std::f64::consts::PI * u2).cos()
+    }
+
+    fn latency_ms(&mut self, dist: &LatencyDist) -> f64 {
+        dist.median_ms * (dist.sigma * self.normal()).exp()
+    }
+}
+
+/// A game that is either waiting to be dispatched or running
+struct SimGame {
+    players: [usize; 2],
+    plies_left: u32,
+    /// player index (0 or 1) on move
+    turn: usize,
+    /// knockout bracket slot the winner advances to
+    bracket_slot: usize,
+}
+
+/// Result of a single scenario
+struct ScenarioResult {
+    duration_ms: f64,
+    requests: u64,
+    peak_rps: u64,
+}
+
+/// Discrete-event simulation of a single tournament run
+struct Scenario<'a> {
+    config: &'a SimConfig,
+    rng: Rng,
+    games: Vec<SimGame>,
+    /// games not looked at since they were queued, in schedule order
+    pending: VecDeque<usize>,
+    /// games that couldn't start because a player was in per_player games, parked on that player
+    blocked: Vec<VecDeque<usize>>,
+    /// players who left a game since the last dispatch
+    freed: Vec<usize>,
+    /// ply completion events, as (time in microseconds, game index)
+    events: BinaryHeap<Reverse<(u64, usize)>>,
+    in_game: Vec<usize>,
+    running: usize,
+    /// requests issued in each second of simulated time
+    load: Vec<u64>,
+    requests: u64,
+    /// knockout players waiting for an opponent in each bracket slot
+    bracket: Vec<Option<usize>>,
+}
+
+impl<'a> Scenario<'a> {
+    fn new(config: &'a SimConfig, seed: u64) -> Scenario<'a> {
+        Scenario {
+            config,
+            rng: Rng::new(seed),
+            games: Vec::new(),
+            pending: VecDeque::new(),
+            blocked: vec![VecDeque::new(); config.players],
+            freed: Vec::new(),
+            events: BinaryHeap::new(),
+            in_game: vec![0; config.players],
+            running: 0,
+            load: Vec::new(),
+            requests: 0,
+            bracket: Vec::new(),
+        }
+    }
+
+    fn latency_for(&self, player: usize) -> LatencyDist {
+        let l = &self.config.latencies;
+        l[player.min(l.len() - 1)]
+    }
+
+    fn queue_game(&mut self, players: [usize; 2], bracket_slot: usize) {
+        let plies = self.rng.range(self.config.min_moves, self.config.max_moves);
+        self.games.push(SimGame {
+            players,
+            plies_left: plies,
+            turn: 0,
+            bracket_slot,
+        });
+        self.pending.push_back(self.games.len() - 1);
+    }
+
+    /// count requests made during [start_us, end_us), spreading them over the seconds they span
+    fn add_load(&mut self, start_us: u64, end_us: u64, requests: u64) {
+        self.requests += requests;
+        let first = (start_us / 1_000_000) as usize;
+        let last = (end_us / 1_000_000) as usize;
+        if self.load.len() <= last {
+            self.load.resize(last + 1, 0);
+        }
+        let span = (last - first + 1) as u64;
+        for sec in first..=last {
+            self.load[sec] += requests / span;
+        }
+        self.load[last] += requests % span;
+    }
+
+    /// schedule the next ply of a game starting at now_us. Fails if it would end after MAX_SIM_US
+    fn schedule_ply(&mut self, game: usize, now_us: u64) -> Result<(), Error> {
+        let g = &self.games[game];
+        let mover = g.players[g.turn];
+        let dist = self.latency_for(mover);
+        let poll_ms = self.config.poll_ms;
+        // the mover notices its turn on its next poll, then thinks
+        let detect_ms = self.rng.unit() * poll_ms;
+        let think_ms = self.rng.latency_ms(&dist);
+        let ply_ms = detect_ms + think_ms;
+        if !(ply_ms * 1000.0 <= (MAX_SIM_US - now_us) as f64) {
+            return Err(Error::InvalidSimulation);
+        }
+        // opponent polls throughout, mover polls until it notices, then GETs state and POSTs a move
+        let requests = (ply_ms / poll_ms) as u64 + (detect_ms / poll_ms) as u64 + 3;
+        let end_us = now_us + (ply_ms * 1000.0) as u64;
+        self.add_load(now_us, end_us, requests);
+        self.events.push(Reverse((end_us, game)));
+        Ok(())
+    }
+
+    /// start as many pending games as the concurrency limits allow
+    fn dispatch(&mut self, now_us: u64) -> Result<(), Error> {
+        let concurrency = self.config.concurrency;
+        let per_player = self.config.per_player;
+        // games parked on a player who freed up were queued before any still pending
+        while let Some(player) = self.freed.pop() {
+            while self.in_game[player] < per_player {
+                if self.running >= concurrency {
+                    // look at this player's games again once a game finishes
+                    self.freed.push(player);
+                    return Ok(());
+                }
+                match self.blocked[player].pop_front() {
+                    Some(game) => self.try_start(game, now_us)?,
+                    None => break,
+                }
+            }
+        }
+        while self.running < concurrency {
+            match self.pending.pop_front() {
+                Some(game) => self.try_start(game, now_us)?,
+                None => break,
+            }
+        }
+        Ok(())
+    }
+
+    /// start a game, or park it on a player who's in too many games
+    fn try_start(&mut self, game: usize, now_us: u64) -> Result<(), Error> {
+        let per_player = self.config.per_player;
+        let [a, b] = self.games[game].players;
+        if self.in_game[a] >= per_player {
+            self.blocked[a].push_back(game);
+        } else if self.in_game[b] >= per_player {
+            self.blocked[b].push_back(game);
+        } else {
+            self.in_game[a] += 1;
+            self.in_game[b] += 1;
+            self.running += 1;
+            // join + start requests
+            self.add_load(now_us, now_us, 3);
+            self.schedule_ply(game, now_us)?;
+        }
+        Ok(())
+    }
+
+    fn finish_game(&mut self, game: usize) {
+        let [a, b] = self.games[game].players;
+        self.in_game[a] -= 1;
+        self.in_game[b] -= 1;
+        self.running -= 1;
+        self.freed.push(a);
+        self.freed.push(b);
+
+        if self.config.format == Format::Knockout {
+            let winner = if self.rng.unit() < 0.5 { a } else { b };
+            let slot = self.games[game].bracket_slot;
+            // slots form a heap: the winner of slot s advances to slot s / 2
+            if slot > 1 {
+                let parent = slot / 2;
+                match self.bracket[parent].take() {
+                    Some(opponent) => self.queue_game([opponent, winner], parent),
+                    None => self.bracket[parent] = Some(winner),
+                }
+            }
+        }
+    }
+
+    fn build_schedule(&mut self) {
+        let n = self.config.players;
+        match self.config.format {
+            Format::RoundRobin => {
+                for a in 0..n {
+                    for b in (a + 1)..n {
+                        self.queue_game([a, b], 0);
+                    }
+                }
+            }
+            Format::Knockout => {
+                let slots = n.next_power_of_two();
+                self.bracket = vec![None; slots];
+                // first round is played in slots [slots / 2, slots). Top seeds get byes
+                for i in 0..(slots / 2) {
+                    let (a, b) = (i, slots - 1 - i);
+                    let slot = slots / 2 + i;
+                    if b < n {
+                        self.queue_game([a, b], slot);
+                    } else {
+                        let parent = slot / 2;
+                        match self.bracket[parent].take() {
+                            Some(opponent) => self.queue_game([opponent, a], parent),
+                            None => self.bracket[parent] = Some(a),
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    fn run(mut self) -> Result<ScenarioResult, Error> {
+        self.build_schedule();
+        self.dispatch(0)?;
+
+        let mut now_us = 0;
+        while let Some(Reverse((time, game))) = self.events.pop() {
+            now_us = time;
+            let g = &mut self.games[game];
+            g.plies_left -= 1;
+            g.turn ^= 1;
+            if g.plies_left == 0 {
+                self.finish_game(game);
+                self.dispatch(now_us)?;
+            } else {
+                self.schedule_ply(game, now_us)?;
+            }
+        }
+
+        Ok(ScenarioResult {
+            duration_ms: now_us as f64 / 1000.0,
+            requests: self.requests,
+            peak_rps: self.load.iter().copied().max().unwrap_or(0),
+        })
+    }
+}
+
+fn num_games(players: usize, format: Format) -> usize {
+    match format {
+        Format::RoundRobin => players * players.saturating_sub(1) / 2,
+        Format::Knockout => players.saturating_sub(1),
+    }
+}
+
+/// Simulate a tournament schedule over config.scenarios randomized runs.
+/// Fails if a run takes longer than MAX_SIM_US of simulated time
+pub fn simulate(config: &SimConfig) -> Result<SimReport, Error> {
+    let start = Instant::now();
+    let mut seeder = Rng::new(config.seed);
+
+    let mut durations = Vec::with_capacity(config.scenarios as usize);
+    let mut total_requests = 0u64;
+    let mut total_rps = 0.0;
+    let mut total_peak = 0u64;
+    for _ in 0..config.scenarios {
+        let res = Scenario::new(config, seeder.next_u64()).run()?;
+        total_requests += res.requests;
+        if res.duration_ms > 0.0 {
+            total_rps += res.requests as f64 / (res.duration_ms / 1000.0);
+        }
+        total_peak += res.peak_rps;
+        durations.push(res.duration_ms / 1000.0);
+    }
+    durations.sort_by(|a, b| a.partial_cmp(b).unwrap());
+
+    let n = config.scenarios.max(1) as f64;
+    let percentile = |p: f64| -> f64 {
+        if durations.is_empty() {
+            0.0
+        } else {
+            durations[((durations.len() - 1) as f64 * p).round() as usize]
+        }
+    };
+
+    Ok(SimReport {
+        scenarios: config.scenarios,
+        games: num_games(config.players, config.format) as u32,
+        mean_duration_secs: durations.iter().sum::<f64>() / n,
+        p50_duration_secs: percentile(0.5),
+        p95_duration_secs: percentile(0.95),
+        max_duration_secs: percentile(1.0),
+        mean_requests: total_requests as f64 / n,
+        mean_requests_per_sec: total_rps / n,
+        peak_requests_per_sec: total_peak as f64 / n,
+        sim_elapsed_ms: start.elapsed().as_secs_f64() * 1000.0,
+    })
+}
+
+#[derive(FromForm)]
+pub struct SimulateForm {
+    players: usize,
+    format: Option<String>,
+    concurrency: Option<usize>,
+    per_player: Option<usize>,
+    /// comma separated median move latency (ms) for each player
+    latencies: Option<String>,
+    latency_sigma: Option<f64>,
+    poll_ms: Option<f64>,
+    min_moves: Option<u32>,
+    max_moves: Option<u32>,
+    scenarios: Option<u32>,
+    seed: Option<u64>,
+}
+
+impl SimulateForm {
+    fn to_config(&self) -> Result<SimConfig, Error> {
+        let format = match self.format.as_ref().map(|s| s.as_str()) {
+            None | Some("round_robin") => Format::RoundRobin,
+            Some("knockout") => Format::Knockout,
+            Some(_) => return Err(Error::InvalidSimulation),
+        };
+        let sigma = self.latency_sigma.unwrap_or(0.5);
+        let latencies = match &self.latencies {
+            None => vec![LatencyDist {
+                median_ms: 500.0,
+                sigma,
+            }],
+            Some(l) => l
+                .split(',')
+                .map(|v| {
+                    v.trim()
+                        .parse::<f64>()
+                        .ok()
+                        .filter(|ms| *ms >= 0.0 && *ms <= MAX_SIM_LATENCY_MS)
+                        .map(|median_ms| LatencyDist { median_ms, sigma })
+                })
+                .collect::<Option<Vec<LatencyDist>>>()
+                .ok_or(Error::InvalidSimulation)?,
+        };
+
+        let config = SimConfig {
+            players: self.players,
+            format,
+            concurrency: self.concurrency.unwrap_or(usize::MAX),
+            per_player: self.per_player.unwrap_or(1),
+            latencies,
+            poll_ms: self.poll_ms.unwrap_or(100.0),
+            min_moves: self.min_moves.unwrap_or(20),
+            max_moves: self.max_moves.unwrap_or(80),
+            scenarios: self.scenarios.unwrap_or(1000),
+            seed: self.seed.unwrap_or(0),
+        };
+
+        let games = config.scenarios as u64 * num_games(config.players, config.format) as u64;
+        let plies = games * config.max_moves as u64;
+        let dispatch = games * config.players as u64;
+        if config.players < 2
+            || config.players > MAX_SIM_PLAYERS
+            || config.concurrency == 0
+            || config.per_player == 0
+            || config.latencies.is_empty()
+            || !(config.poll_ms >= MIN_SIM_POLL_MS && config.poll_ms <= MAX_SIM_POLL_MS)
+            || !(sigma >= 0.0 && sigma <= MAX_SIM_SIGMA)
+            || config.min_moves == 0
+            || config.min_moves > config.max_moves
+            || config.scenarios == 0
+            || config.scenarios > MAX_SIM_SCENARIOS
+            || plies > MAX_SIM_PLIES
+            || dispatch > MAX_SIM_DISPATCH
+        {
+            Err(Error::InvalidSimulation)
+        } else {
+            Ok(config)
+        }
+    }
+}
+
+/// Dry run a tournament schedule. Doesn't touch the database.
+#[get("/tournament/simulate?<params..>")]
+pub fn tournament_simulate(
+    params: Form<SimulateForm>,
+    _user: User,
+) -> Result<Json<SimReport>, Json<ErrorResp>> {
+    let config = params.to_config()?;
+    Ok(Json(simulate(&config)?))
+}
@@ -1,7 +1,10 @@
 use rocket::request::{Form, FromRequest, Outcome};
 use rocket_contrib::json::Json;
 
+use crate::access_log::RequestUser;
+use crate::handoff;
 use crate::models::{NewUser, User};
+use crate::presence::PRESENCE;
 use crate::shared::{DBConn, Error, ErrorResp, SuccessResp};
 use itertools::Itertools;
 use serde::{Deserialize, Serialize};
@@ -12,12 +15,16 @@ extern crate bcrypt;
 extern crate time;
 use diesel::prelude::*;
 use rocket::http::Status;
-use rocket::http::{Cookie, Cookies};
+use rocket::http::{ContentType, Cookie, Cookies};
+use rocket::response::Content;
 use rocket::{Request, State};
 use std::collections::HashMap;
-use std::sync::RwLock;
+use std::sync::{mpsc, Arc, Mutex, RwLock};
+use std::{env, thread};
 
 const BCRYPT_COST: u32 = 8;
+/// max users inserted by a single statement (postgres allows 65535 bind parameters)
+const BULK_INSERT_CHUNK: usize = 10000;
 
 const HEX_CHARS: [char; 16] = [
     '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f',
@@ -121,6 +128,136 @@ impl ToString for PlayerId {
     }
 }
 
+/// a password to hash, its index in the request, and where to send its hash
+type HashJob = (
+    usize,
+    String,
+    mpsc::Sender<(usize, Result<String, bcrypt::BcryptError>)>,
+);
+
+/// queue of the password hashing threads, started on first use
+static HASH_POOL: Mutex<Option<mpsc::Sender<HashJob>>> = Mutex::new(None);
+
+/// the queue of the shared password hashing pool. It has BULK_HASH_THREADS threads (default
+/// number of cpus), however many bulk requests are hashing at once
+fn hash_pool() -> mpsc::Sender<HashJob> {
+    let mut pool = HASH_POOL.lock().unwrap();
+    pool.get_or_insert_with(|| {
+        let threads = env::var("BULK_HASH_THREADS")
+            .ok()
+            .and_then(|s| s.parse::<usize>().ok())
+            .or_else(|| thread::available_parallelism().ok().map(|n| n.get()))
+            .unwrap_or(4)
+            .max(1);
+        let (jobs, queue) = mpsc::channel::<HashJob>();
+        let queue = Arc::new(Mutex::new(queue));
+        for _ in 0..threads {
+            let queue = queue.clone();
+            thread::spawn(move || loop {
+                let (index, password, hashed) = match queue.lock().unwrap().recv() {
+                    Ok(job) => job,
+                    Err(_) => return,
+                };
+                // the request may have given up on its other hashes
+                let _ = hashed.send((index, bcrypt::hash(password.as_bytes(), BCRYPT_COST)));
+            });
+        }
+        jobs
+    })
+    .clone()
+}
+
+/// hash passwords with bcrypt on the shared hashing pool
+fn hash_passwords(passwords: Vec<String>) -> Result<Vec<String>, Error> {
+    let count = passwords.len();
+    let pool = hash_pool();
+    let (hashed, results) = mpsc::channel();
+    for (index, password) in passwords.into_iter().enumerate() {
+        pool.send((index, password, hashed.clone()))
+            .expect("password hashing threads exited");
+    }
+
+    let mut hashes = vec![String::new(); count];
+    for _ in 0..count {
+        let (index, hash) = results.recv().expect("password hashing thread panicked");
+        hashes[index] = hash?;
+    }
+    Ok(hashes)
+}
+
+/// parse csv as in RFC 4180: fields are separated by commas and records by newlines (or CRLF).
+/// A quoted field can contain commas, newlines, and quotes (doubled). Fields aren't trimmed, and
+/// empty lines are skipped
+fn parse_csv(csv: &str) -> Result<Vec<Vec<String>>, Error> {
+    #[derive(PartialEq)]
+    enum State {
+        FieldStart,
+        Unquoted,
+        Quoted,
+        /// a quote in a quoted field, which either ends it or escapes another quote
+        QuotedQuote,
+    }
+
+    let mut records = Vec::new();
+    let mut record = Vec::new();
+    let mut field = String::new();
+    let mut state = State::FieldStart;
+    let mut chars = csv.chars().peekable();
+    while let Some(c) = chars.next() {
+        if c == '\r' && state != State::Quoted && chars.peek() == Some(&'\n') {
+            continue;
+        }
+        state = match (state, c) {
+            (State::Quoted, '"') => State::QuotedQuote,
+            (State::Quoted, c) => {
+                field.push(c);
+                State::Quoted
+            }
+            (State::QuotedQuote, '"') => {
+                field.push('"');
+                State::Quoted
+            }
+            (State::FieldStart, '"') => State::Quoted,
+            (_, ',') => {
+                record.push(std::mem::take(&mut field));
+                State::FieldStart
+            }
+            (state, '\n') => {
+                // an empty line has no fields
+                if state != State::FieldStart || !record.is_empty() {
+                    record.push(std::mem::take(&mut field));
+                    records.push(std::mem::take(&mut record));
+                }
+                State::FieldStart
+            }
+            (State::FieldStart, c) | (State::Unquoted, c) if c != '"' => {
+                field.push(c);
+                State::Unquoted
+            }
+            // a quote inside an unquoted field, or text after a quoted one
+            _ => return Err(Error::MalformedCsv),
+        };
+    }
+    match state {
+        State::Quoted => return Err(Error::MalformedCsv),
+        State::FieldStart if record.is_empty() => (),
+        _ => {
+            record.push(field);
+            records.push(record);
+        }
+    }
+    Ok(records)
+}
+
+/// a csv field, quoted if it needs to be
+fn csv_field(field: &str) -> String {
+    if field.contains(|c| c == ',' || c == '"' || c == '\r' || c == '\n') {
+        format!("\"{}\"", field.replace('"', "\"\""))
+    } else {
+        field.to_string()
+    }
+}
+
 impl User {
     pub fn check_password(&self, password: &str) -> bool {
         match bcrypt::verify(password.as_bytes(), &self.password_hash) {
@@ -136,7 +273,7 @@ pub struct UserManager<'a> {
     sessions: &'a RwLock<HashMap<String, PlayerId>>,
 }
 
-pub type UserManagerState<'a> = State<'a, RwLock<HashMap<String, PlayerId>>>;
+pub type UserManagerState<'a> = State<'a, Arc<RwLock<HashMap<String, PlayerId>>>>;
 
 impl<'a> UserManager<'a> {
     #[allow(unused_must_use)]
@@ -183,6 +320,76 @@ impl<'a> UserManager<'a> {
         }
     }
 
+    /// create many users at once. Passwords are hashed in parallel and users are inserted with a single
+    /// statement. Users whose username is already taken are skipped.
+    pub fn new_users_bulk(
+        &self,
+        new_users: Vec<BulkUser>,
+        generate_api_keys: bool,
+    ) -> Result<Vec<BulkUserResp>, Error> {
+        use crate::schema::users;
+
+        let (details, passwords): (Vec<(String, String)>, Vec<String>) = new_users
+            .into_iter()
+            .map(|u| ((u.username, u.display_name), u.password))
+            .unzip();
+        let hashes = hash_passwords(passwords)?;
+        let api_keys = details
+            .iter()
+            .map(|_| {
+                if generate_api_keys {
+                    let key = ApiKey::new();
+                    Some((key.to_string(), key.hash().to_string()))
+                } else {
+                    None
+                }
+            })
+            .collect::<Vec<Option<(String, String)>>>();
+
+        let rows = details
+            .iter()
+            .zip(hashes.iter())
+            .zip(api_keys.iter())
+            .map(|(((username, display_name), hash), key)| NewUser {
+                username,
+                display_name,
+                password_hash: hash,
+                api_key_hash: key.as_ref().map(|(_, hash)| hash.as_str()),
+                is_admin: false,
+            })
+            .collect::<Vec<NewUser>>();
+
+        let mut inserted = HashMap::new();
+        for chunk in rows.chunks(BULK_INSERT_CHUNK) {
+            for user in diesel::insert_into(users::table)
+                .values(chunk)
+                .on_conflict(users::username)
+                .do_nothing()
+                .get_results::<User>(&*self.db)?
+            {
+                inserted.insert(user.username, user.id);
+            }
+        }
+
+        Ok(details
+            .into_iter()
+            .zip(api_keys.into_iter())
+            .map(|((username, _), key)| {
+                // a username listed twice is only inserted once
+                let id = inserted.remove(&username);
+                BulkUserResp {
+                    api_key: id.and(key.map(|(key, _)| key)),
+                    error: match id {
+                        Some(_) => None,
+                        None => Some(ErrorResp::from(Error::UsernameAlreadyTaken).error),
+                    },
+                    id,
+                    username,
+                }
+            })
+            .collect())
+    }
+
     /// load a user from the db by user id
     pub fn load_user(&self, user_id: PlayerId) -> Result<User, Error> {
         use crate::schema::users;
@@ -243,12 +450,16 @@ impl<'a> UserManager<'a> {
     }
 
     /// create a new session for the given user
-    pub fn new_session(&self, user_id: PlayerId) -> String {
+    pub fn new_session(&self, user_id: PlayerId) -> Result<String, Error> {
         let mut sessions = self.sessions.write().unwrap();
+        // sessions have been handed off to a new process, which wouldn't see this one
+        if handoff::draining() {
+            return Err(Error::ServerDraining);
+        }
         let session_key = format!("{}", Uuid::new_v4().simple());
         sessions.insert(session_key.clone(), user_id);
 
-        session_key
+        Ok(session_key)
     }
 
     /// determine what user a session belongs to
@@ -296,7 +507,11 @@ fn user_request_guard<U: From<User>>(
             let user = manage.load_user(user_id);
             match user {
                 Err(_) => unauth_resp,
-                Ok(user) => Outcome::Success(U::from(user)),
+                Ok(user) => {
+                    request.local_cache(|| RequestUser(Some(user.id)));
+                    PRESENCE.touch(PlayerId::new(user.id));
+                    Outcome::Success(U::from(user))
+                }
             }
         } else {
             unauth_resp
@@ -306,7 +521,11 @@ fn user_request_guard<U: From<User>>(
         let keys = request.headers().get("x-api-key").collect::<Vec<_>>();
         if keys.len() == 1 {
             match manage.find_user_by_api_key(&keys[0]) {
-                Ok(user) => Outcome::Success(U::from(user)),
+                Ok(user) => {
+                    request.local_cache(|| RequestUser(Some(user.id)));
+                    PRESENCE.touch(PlayerId::new(user.id));
+                    Outcome::Success(U::from(user))
+                }
                 Err(_) => unauth_resp,
             }
         } else {
@@ -366,7 +585,7 @@ pub fn session_new(
     if user.check_password(&login.password) {
         cookies.add_private(Cookie::new(
             "session_key",
-            manage.new_session(PlayerId(user.id)),
+            manage.new_session(PlayerId(user.id))?,
         ));
 
         Ok(Json(SuccessResp { success: true }))
@@ -487,6 +706,102 @@ pub fn user_generate_api_key(
     Ok(Json(ApiKeyResponse { key }))
 }
 
+#[derive(Deserialize)]
+pub struct BulkUser {
+    username: String,
+    display_name: String,
+    password: String,
+}
+
+#[derive(Deserialize)]
+pub struct BulkUsersReq {
+    users: Vec<BulkUser>,
+    #[serde(default)]
+    generate_api_keys: bool,
+}
+
+#[derive(Serialize)]
+pub struct BulkUserResp {
+    username: String,
+    id: Option<i32>,
+    api_key: Option<String>,
+    error: Option<String>,
+}
+
+#[derive(Serialize)]
+pub struct BulkUsersResp {
+    users: Vec<BulkUserResp>,
+}
+
+#[post("/admin/users/bulk", format = "json", data = "<req>")]
+pub fn admin_users_bulk(
+    req: Json<BulkUsersReq>,
+    db: DBConn,
+    state: UserManagerState,
+    user: User,
+) -> Result<Json<BulkUsersResp>, Json<ErrorResp>> {
+    if !user.is_admin {
+        Err(Json::from(Error::NotAdmin))
+    } else {
+        let req = req.into_inner();
+        let users =
+            UserManager::new(db, &*state).new_users_bulk(req.users, req.generate_api_keys)?;
+        Ok(Json(BulkUsersResp { users }))
+    }
+}
+
+/// bulk create users from csv records of username,display_name,password (with an optional header).
+/// Fields are used as given, without trimming. responds with csv records of username,id,api_key,error
+#[post(
+    "/admin/users/bulk?<generate_api_keys>",
+    format = "text/csv",
+    data = "<csv>"
+)]
+pub fn admin_users_bulk_csv(
+    csv: String,
+    generate_api_keys: Option<bool>,
+    db: DBConn,
+    state: UserManagerState,
+    user: User,
+) -> Result<Content<String>, Json<ErrorResp>> {
+    if !user.is_admin {
+        return Err(Json::from(Error::NotAdmin));
+    }
+
+    let mut records = parse_csv(&csv)?;
+    if records.first().map_or(false, |header| {
+        header[..] == ["username", "display_name", "password"]
+    }) {
+        records.remove(0);
+    }
+    let new_users = records
+        .into_iter()
+        .map(|record| match <[String; 3]>::try_from(record) {
+            Ok([username, display_name, password]) => Ok(BulkUser {
+                username,
+                display_name,
+                password,
+            }),
+            Err(_) => Err(Error::MalformedCsv),
+        })
+        .collect::<Result<Vec<BulkUser>, Error>>()?;
+
+    let created = UserManager::new(db, &*state)
+        .new_users_bulk(new_users, generate_api_keys.unwrap_or(false))?;
+
+    let mut out = String::from("username,id,api_key,error\n");
+    for u in created {
+        out.push_str(&format!(
+            "{},{},{},{}\n",
+            csv_field(&u.username),
+            u.id.map_or(String::new(), |id| id.to_string()),
+            u.api_key.unwrap_or_default(),
+            csv_field(&u.error.unwrap_or_default())
+        ));
+    }
+    Ok(Content(ContentType::CSV, out))
+}
+
 #[catch(401)]
 pub fn unauthorized(_: &Request) -> Json<ErrorResp> {
     Json(ErrorResp::from(Error::Unauthorized))